@@ -4,13 +4,167 @@
 #include <ctype.h>
 #include <time.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #define MAX_NAME_LENGTH 50
 #define MAX_PASSWORD_LENGTH 20
 #define MAX_DESCRIPTION_LENGTH 100
 #define ACCOUNTS_DB "accounts.db"
 #define TRANSACTIONS_DB "transactions.db"
+#define ACCOUNTS_INDEX "accounts.idx"
+#define ACCOUNTS_ARCHIVE "accounts.archive"  // closed accounts moved out of accounts.db by compaction
+#define ACCOUNTS_COMPACT "accounts.db.tmp"
+#define INDEX_COMPACT "accounts.idx.tmp"
+#define ACCOUNTS_DIRECT "accounts.dir"  // direct-addressed account table (--direct-index)
+#define DIRECT_MAGIC 0x52444142        // "BADR"
+#define DIRECT_VERSION 1
+#define DIRECT_CHUNK 65536             // account numbers added each time accounts.dir grows
+#define ACCOUNTS_SHARD_MAP "accounts.shards"     // account-number ranges of the shard files, if sharded
+#define SHARD_MAP_TEMP "accounts.shards.tmp"
+#define ACCOUNTS_SHARD_FILE "accounts.%u.%d.db"  // layout generation, shard
+#define SHARD_MAP_MAGIC 0x44524853              // "SHRD"
+#define SHARD_MAP_VERSION 1
+#define MAX_SHARDS 64
+#define SHARD_RECORD_BITS 40                    // a record number holds its shard above these bits
+#define ACCOUNTS_LOCK "accounts.lock"  // byte-range locks shared by every --shared process
+#define LOCK_SESSION_BYTE 0            // shared while open; exclusive for the first and last process
+#define LOCK_STORE_BYTE 1              // shared by postings, exclusive for new accounts and admin jobs
+#define LOCK_LOG_BYTE 2                // appends to the log, its indexes and transactions.desc
+#define LOCK_COUNT_OFFSET 8            // int64 data, not a lock: processes in the session
+#define LOCK_ACCOUNT_BASE 16           // byte LOCK_ACCOUNT_BASE + account number guards that account
+#define TRANSACTIONS_CHAIN "transactions.chain"
+#define TRANSACTIONS_HEADS "transactions.heads"
+#define TRANSACTIONS_DESCRIPTIONS "transactions.desc"
+#define TRANSACTIONS_LEGACY "transactions.db.v1"  // copy of a converted version 1 log
+#define TRANSACTIONS_IDS "transactions.ids"       // transaction ID -> record number
+#define TRANSACTION_SEQUENCE "txid.seq"           // transaction IDs handed out so far
+#define TRANSACTION_ID_BLOCK 65536  // IDs reserved on disk at a time
+#define TRANSACTION_ID_SCAN 4096    // records searched back from the tail for the newest ID
+#define LOG_MAGIC 0x32585442          // "BTX2"
+#define LOG_VERSION 2
+#define DESCRIPTION_MAGIC 0x44585442  // "BTXD"
+#define DESCRIPTION_MIN_SLOTS 1024
+#define INDEX_MAGIC 0x58494142  // "BAIX"
+#define INDEX_VERSION 2
+#define INDEX_MIN_BUCKETS 1024
+#define ACCOUNT_MAP_CHUNK 1024  // records added to accounts.db each time the mapping grows
+#define RECOVERY_MARKER "recovery.pending"
+#define ACCOUNTS_CHECKPOINT "accounts.ckpt"
+#define CHECKPOINT_TEMP "accounts.ckpt.tmp"
+#define CHECKPOINT_MAGIC 0x504b4342  // "BCKP"
+#define CHECKPOINT_VERSION 1
+#define TRANSACTIONS_TIME "transactions.time"        // sparse time index over transactions.db
+#define TIME_INDEX_TEMP "transactions.time.tmp"
+#define TIME_INDEX_MAGIC 0x4d495442  // "BTIM"
+#define TIME_INDEX_VERSION 1
+#define TIME_INDEX_BLOCK 1024        // log records summarised by one time index entry
+#define TRANSACTIONS_ROLLUP "transactions.rollup"    // daily and per-account monthly totals of the log
+#define ROLLUP_TEMP "transactions.rollup.tmp"
+#define ROLLUP_MAGIC 0x4c4c4f52      // "ROLL"
+#define ROLLUP_VERSION 1
+#define CHECKPOINT_INTERVAL 100000   // committed records between automatic checkpoints
+#define REPLAY_MIN_SLOTS 1024
 #define MAX_TRANSACTION_AMOUNT 1000000.0
+#define MAX_TRANSACTION_CENTS ((long)(MAX_TRANSACTION_AMOUNT * 100))
+#define VELOCITY_AMOUNT_LIMIT 50000.0  // default kwacha that may leave an account within the window
+#define VELOCITY_WINDOW_MINUTES 60     // default length of that window
+#define VELOCITY_TRANSFER_LIMIT 20     // default transfers an account may send per hour
+#define VELOCITY_SLOTS 12              // buckets per window; the limits slide one bucket at a time
+#define BATCH_LOG_BUFFER 4096     // records collected before one write to transactions.db
+#define BATCH_GROUP_COMMIT 65536  // default records per fdatasync in batch mode
+#define MAX_BATCH_LINE 512
+#define IMPORT_WRITE_BATCH 65536  // accounts hashed and appended to the store per round of an import
+#define EXPORT_BATCH 65536        // accounts read and formatted per round of an export
+#define EXPORT_LINE_MAX 256       // room for one formatted account line
+#define HISTORY_PAGE_SIZE 20      // transactions shown per screen of history
+#define STATEMENT_PAGE_SIZE 256   // transactions rendered per batch when writing a statement
+#define STATEMENTS_DIR "statements"         // output of the bulk statement job
+#define STATEMENT_WRITE_BUFFER (1 << 20)    // stdio buffer per bulk statement worker
+
+#define ACCOUNT_CACHE_DEFAULT 1024  // accounts kept in memory in file I/O mode
+#define LOCK_STRIPES 1024         // per-account lock stripes in the concurrent engine
+#define STRESS_ACCOUNTS 1000
+#define STRESS_FIRST_ACCOUNT 500000
+#define STRESS_OPENING_BALANCE 100000  // cents per stress-test account
+#define BENCH_FIRST_ACCOUNT 1000000
+#define BENCH_DEFAULT_OPERATIONS 10000  // timed calls per operation
+#define BENCH_MAX_RECORDS 10000000
+#define BENCH_SEED 20250554             // fixed, so runs see the same data and access pattern
+#define LOAD_SEED_ACCOUNTS 1000         // customers in the load-test database before it starts
+#define LOAD_FIRST_ACCOUNT 2000000
+#define LOAD_ACTIONS_PER_SESSION 5      // actions between login and logout
+#define LOAD_DEFAULT_MIX "10:4:2:3:1"   // register%:deposit:withdraw:transfer:history
+#define LOAD_PASSWORD "load1234"
+#define LOAD_OPENING_BALANCE 100000     // cents per seed customer
+#define JOB_MIN_SHARD 4096        // fewest accounts worth a thread of their own in admin jobs
+#define JOB_MAX_THREADS 16
+#define METRICS_INTERVAL 10        // default seconds between rewrites of the metrics file
+#define HISTOGRAM_SUB_BITS 4       // precision bits below each power of two, about 6%
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+// Batch operation codes, also used to index the per-operation counters
+#define BATCH_DEPOSIT 0
+#define BATCH_WITHDRAW 1
+#define BATCH_TRANSFER 2
+#define BATCH_OPEN 3
+#define BATCH_CLOSE 4
+
+// Load test operation types, also used to index the latency samples.
+// DEPOSIT to HISTORY are the actions drawn from the mix inside a session.
+#define LOAD_REGISTER 0
+#define LOAD_LOGIN 1
+#define LOAD_DEPOSIT 2
+#define LOAD_WITHDRAW 3
+#define LOAD_TRANSFER 4
+#define LOAD_HISTORY 5
+#define LOAD_LOGOUT 6
+#define LOAD_SESSION 7    // a whole session, from its arrival to logout
+#define LOAD_TYPES 8
+#define LOAD_ACTIONS 4
+
+// Timed operations, also used to index the latency histograms
+#define METRIC_LOGIN 0
+#define METRIC_HASH_PASSWORD 1
+#define METRIC_FIND_ACCOUNT 2
+#define METRIC_DEPOSIT 3
+#define METRIC_WITHDRAWAL 4
+#define METRIC_TRANSFER 5
+#define METRIC_OPEN_ACCOUNT 6
+#define METRIC_CLOSE_ACCOUNT 7
+#define METRIC_HISTORY_PAGE 8
+#define METRIC_LOG_WRITE 9
+#define METRIC_LOG_SYNC 10
+#define METRIC_VELOCITY_CHECK 11
+#define METRIC_OPERATIONS 12
+
+// I/O counters
+#define IO_FILE_OPENS 0
+#define IO_READ_CALLS 1
+#define IO_RECORDS_READ 2
+#define IO_BYTES_READ 3
+#define IO_WRITE_CALLS 4
+#define IO_RECORDS_WRITTEN 5
+#define IO_BYTES_WRITTEN 6
+#define IO_SYNCS 7
+#define IO_COUNTERS 8
+#define BATCH_OPERATIONS 5
+
+// Storage benchmark operations, in the order they are run
+#define BENCH_FIND_ACCOUNT 0
+#define BENCH_UPDATE_BALANCE 1
+#define BENCH_RECORD_TRANSACTION 2
+#define BENCH_HISTORY_PAGE 3
+#define BENCH_FIND_TRANSACTION 4
+#define BENCH_TRANSFER 5
+#define BENCH_POST_DEPOSIT 6
+#define BENCH_OPERATIONS 7
 
 // Simple hash function for demonstration (not cryptographically secure)
 void simple_sha256(const char* input, char* output) {
@@ -40,7 +194,9 @@ typedef struct {
     time_t dateCreated;
 } BankAccount;
 
-// Structure to hold transaction information
+// Human-readable view of a logged transaction, rendered on demand from a
+// LogRecord. This is also the layout of version 1 log records, which the
+// format converter reads.
 typedef struct {
     int transactionId;
     int accountNumber;
@@ -51,32 +207,1013 @@ typedef struct {
     char description[MAX_DESCRIPTION_LENGTH];
 } Transaction;
 
+// Transaction kinds, stored in one byte of each log record
+typedef enum {
+    TX_VOID,
+    TX_DEPOSIT,
+    TX_WITHDRAWAL,
+    TX_TRANSFER_SENT,
+    TX_TRANSFER_RECEIVED,
+    TX_ACCOUNT_CREATION,
+    TX_ACCOUNT_CLOSURE,
+    TX_INTEREST,
+    TX_PASSWORD_CHANGE,
+    TX_OTHER,
+    TX_TYPES
+} TransactionType;
+
+// Compact transactions.db record (format version 2, 40 bytes). The
+// description text lives once in transactions.desc; records refer to it.
+typedef struct {
+    int64_t timestamp;      // microseconds since the epoch
+    int64_t amount;         // cents
+    int64_t balanceAfter;   // cents
+    int32_t transactionId;
+    int32_t accountNumber;
+    uint32_t description;   // offset of the text in transactions.desc, 0 = none
+    uint8_t type;           // TransactionType
+    uint8_t reserved[3];
+} LogRecord;
+
+// First bytes of a version 2 transactions.db; records follow directly
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t recordSize;
+    uint32_t reserved;
+} LogHeader;
+
+// transactions.desc held in memory with a hash table for interning. The
+// file is a magic number followed by entries of one length byte, the text
+// and a terminating NUL; an entry is identified by its offset.
+typedef struct {
+    int fd;
+    char *text;
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t syncedSize;
+    uint32_t *slots;        // entry offsets, 0 = empty
+    uint32_t slotCount;
+    uint32_t entryCount;
+    pthread_mutex_t lock;
+} DescriptionTable;
+
+// On-disk hash index header (account number -> record number)
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    long bucketCount;
+    long entryCount;
+    long recordCount;
+} IndexHeader;
+
+// One open-addressing bucket; key 0 marks an empty bucket.
+// accounts.idx stores the record number in value, or -(record + 1) for an
+// account moved to accounts.archive; transactions.heads stores the newest
+// transaction in value and the oldest one in aux.
+typedef struct {
+    int key;
+    long value;
+    long aux;
+} IndexSlot;
+
+// Per-transaction links in transactions.chain, parallel to transactions.db
+typedef struct {
+    long prev;
+    long next;
+} TransactionLink;
+
+// accounts.ckpt: every account's balance as of a log position. All records
+// before logPosition are reflected in accounts.db and were on disk when the
+// checkpoint was taken, so recovery only has to replay the records after it.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int64_t logPosition;
+    int64_t accountCount;
+    uint64_t checksum;     // FNV-1a of the entries
+} CheckpointHeader;
+
+// One entry per accounts.db record, in record order
+typedef struct {
+    int32_t accountNumber;
+    int32_t isActive;
+    int64_t balance;
+} CheckpointEntry;
+
+// Running state of one account while a stretch of the log is replayed
+typedef struct {
+    int32_t accountNumber;    // 0 marks an empty slot
+    int8_t closed;            // -1 until a creation or closure record is seen
+    int8_t opened;            // the first record replayed created the account
+    int8_t matched;           // verification: found in accounts.db
+    int64_t openingBalance;   // balance before the first record replayed
+    int64_t balance;          // balance after the newest record replayed
+    long records;
+    long breaks;              // records that do not follow on from the one before
+} AccountReplay;
+
+// Open-addressing table of AccountReplay, grown as accounts show up
+typedef struct {
+    AccountReplay *slots;
+    long bucketCount;
+    long entryCount;
+} ReplayTable;
+
+// One record range of the verification job
+typedef struct {
+    pthread_t thread;
+    long firstRecord;
+    long recordCount;
+    ReplayTable table;
+    int failed;
+} VerifyShard;
+
+// One entry of the sparse time index: the earliest and latest timestamp
+// among TIME_INDEX_BLOCK consecutive log records. Records are appended in
+// roughly time order, so a time range maps to a short run of blocks.
+// Keeping both bounds keeps the index correct if the clock steps back.
+typedef struct {
+    int64_t earliest;
+    int64_t latest;
+} TimeBlock;
+
+// transactions.time starts with this header, followed by one TimeBlock
+// per block of the log
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int64_t recordCount;   // log records the blocks account for
+} TimeIndexHeader;
+
+// The time index in memory, kept up to date by every append and guarded by
+// transactionLog.lock. A block's bounds may be wider than its records
+// (after a rollback, say), which costs a wasted read but never a missed
+// record.
+typedef struct {
+    TimeBlock *blocks;
+    long blockCount;
+    long capacity;
+    long recordCount;
+    int valid;             // 0 after an allocation failure: queries scan the whole log
+} TimeIndex;
+
+// Totals of one local day's records of each type; day is YYYYMMDD
+typedef struct {
+    int32_t day;
+    int32_t reserved;
+    int64_t counts[TX_TYPES];
+    int64_t amounts[TX_TYPES];   // cents
+} DayRollup;
+
+// Money into and out of one account in one local month (YYYYMM)
+typedef struct {
+    int32_t accountNumber;
+    int32_t month;
+    int64_t moneyIn;    // cents
+    int64_t moneyOut;   // cents
+    int64_t records;
+} MonthRollup;
+
+// transactions.rollup starts with this header, followed by the DayRollups
+// and then the MonthRollups
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    int64_t recordCount;   // log records the totals account for
+    int64_t dayCount;
+    int64_t monthCount;
+} RollupHeader;
+
+// The rollups in memory, kept up to date by every append and rollback and
+// guarded by transactionLog.lock. Both tables are open-addressed; a zero
+// day or account number marks an empty slot.
+typedef struct {
+    DayRollup *days;
+    long dayBuckets;
+    long dayCount;
+    MonthRollup *months;
+    long monthBuckets;
+    long monthCount;
+    int64_t dayStart;      // local day of the last record rolled up, in
+    int64_t dayEnd;        // epoch microseconds, so most records skip localtime_r
+    int currentDay;
+    int valid;             // 0 after an allocation failure: totals are unavailable until restart
+} Rollups;
+
+// Money and transfers that recently left one account, for the velocity
+// limits. Each ring splits its window into VELOCITY_SLOTS buckets: slot
+// number s (time / slot length) lives in bucket s % VELOCITY_SLOTS, and
+// the newest slot number says which buckets are still current.
+typedef struct {
+    int32_t accountNumber;
+    int32_t transferTotal;
+    int32_t transfers[VELOCITY_SLOTS];
+    int64_t amounts[VELOCITY_SLOTS];   // cents
+    int64_t amountTotal;
+    int64_t amountSlot;
+    int64_t transferSlot;
+} VelocityEntry;
+
+// The velocity limits and the counters behind them, kept up to date by
+// every append and rollback. The counters have a lock of their own, taken
+// inside transactionLog.lock, so a check never waits out a log write or
+// sync. The table is open-addressed; a zero account number marks an empty slot.
+typedef struct {
+    int64_t amountLimit;       // cents per window, 0 for no limit
+    int windowMinutes;
+    int transferLimit;         // transfers sent per hour, 0 for no limit
+    int set;                   // given on the command line, so bulk runs keep them
+    VelocityEntry *entries;
+    long bucketCount;
+    long entryCount;
+    int valid;                 // 0 after an allocation failure: nothing is refused until restart
+    pthread_mutex_t lock;
+} VelocityLimits;
+
+// A query for the transactions of one account, or of every account, in
+// [from, to). Only the log blocks whose time span overlaps the range are
+// read. Matches are returned in log order, which is time order apart from
+// clock adjustments.
+typedef struct {
+    int accountNumber;     // 0 matches every account
+    int64_t from;
+    int64_t to;
+    long *blocks;          // candidate blocks, in log order
+    long blockCount;
+    long nextBlock;
+    LogRecord *records;    // the block being scanned
+    int loadedRecords;
+    int nextRecord;
+    long logRecords;       // log size when the query started
+    long recordsRead;
+    int pageSize;
+    Transaction *page;
+} RangeCursor;
+
+// A log record routed to the bulk statement worker that owns its account
+typedef struct {
+    long position;     // the account's index in the job's account snapshot
+    LogRecord record;
+} StatementEntry;
+
+// One worker of the bulk statement job. Accounts are dealt out by snapshot
+// position (position % workerCount), and the job's single pass over the log
+// hands each worker the records of its own accounts in log order.
+typedef struct {
+    pthread_t thread;
+    int worker;
+    int workerCount;
+    const BankAccount *accounts;
+    long accountCount;
+    const char *statementDate;
+    StatementEntry *entries;
+    long entryCount;
+    long entryCapacity;
+    long statements;
+    int failed;
+} StatementShard;
+
+// Position in one account's history. Records are rendered a page at a
+// time into page, so memory use does not depend on the history's length.
+typedef struct {
+    int accountNumber;
+    int newestFirst;
+    long nextRecord;   // next record to return, -1 once the history is exhausted
+    long endRecord;    // oldest first: records from here on are not returned, -1 = none
+    int chainFd;
+    int pageSize;
+    Transaction *page;
+} HistoryCursor;
+
+// A consistent read view of the ledger. Every record below logPosition is
+// committed, and none of the postings still in flight can land below it,
+// so an account's newest record there gives its balance at that point.
+// Readers hold no lock while they use it; postings carry on past it.
+typedef struct {
+    long logPosition;
+    int chainFd;       // transactions.chain, opened on first use
+} Snapshot;
+
+// accounts.db mapped into memory; the file is padded with empty records
+// up to capacity and trimmed back to recordCount on close
+typedef struct {
+    int fd;
+    BankAccount *records;
+    long recordCount;
+    long capacity;
+    int deferSync;  // batch mode: one msync at the end instead of one per record
+} AccountMap;
+
+// One cached account; entries form a doubly linked LRU list and hash chains
+typedef struct {
+    BankAccount account;
+    long recordNumber;
+    int dirty;        // write-back: changed in memory, not yet in accounts.db
+    int prev;         // towards the most recently used entry
+    int next;         // towards the least recently used entry
+    int hashNext;
+} CachedAccount;
+
+// accounts.dir: one int64 slot per account number, found by arithmetic
+// rather than hashing, so a lookup is one read (one load when mapped). It is
+// a sparse file, so only the pages of number ranges in use take disk space.
+// accounts.idx is still kept up to date; this table is derived from it.
+typedef struct {
+    int fd;
+    void *base;             // read-only mapping in mapped mode, NULL otherwise
+    size_t length;
+    const int64_t *slots;
+    IndexHeader header;     // bucketCount is the number of slots
+} DirectIndex;
+
+// --shared: fcntl locks on accounts.lock let several processes post to the
+// same files. They live in a file of their own because POSIX drops every
+// lock a process holds on a file as soon as it closes any descriptor of it,
+// and accounts.db is opened and closed per operation. An account's lock is
+// keyed by its number, which unlike its record position survives
+// compaction. fcntl locks belong to the whole process, so the holder counts
+// keep one thread's unlock from releasing a lock another still relies on.
+typedef struct {
+    int fd;
+    int storeHolders;           // threads of this process holding the store byte shared
+    int logHolders;             // threads of this process inside the log byte
+    pthread_mutex_t storeLock;
+    pthread_mutex_t logLock;
+} SharedLocks;
+
+// accounts.shards: with more than one shard, the accounts are split by
+// account-number range over accounts.<generation>.<shard>.db; without the
+// file the store is the single accounts.db. A record number carries its
+// shard above SHARD_RECORD_BITS and its place in that file below, so the
+// indexes, the cache and the direct table work unchanged.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t generation;               // a reshard writes new files, never over the live ones
+    int32_t shardCount;
+    int32_t firstAccount[MAX_SHARDS];  // lowest account number of each shard; [0] is unused
+} ShardMap;
+
+// Reads the account store one record at a time, shard file after shard file
+typedef struct {
+    const char *mode;
+    int shard;
+    FILE *file;
+    long nextRecord;   // place in the current shard file
+    int failed;
+} StoreScan;
+
+// One shard file read into, or written from, its slice of a job's accounts
+typedef struct {
+    pthread_t thread;
+    int shard;
+    int write;
+    BankAccount *accounts;
+    long count;
+    int failed;
+} ShardTransfer;
+
+// Bounded LRU of account records for file I/O mode; mapped mode reads the
+// store directly and bypasses it. Write-through updates accounts.db on every
+// change. Write-back only marks the entry dirty and writes it when it is
+// evicted or the cache is flushed; that is safe because startup recovery
+// restores balances from the log. Password changes and closures are always
+// written through.
+typedef struct {
+    CachedAccount *entries;
+    int *buckets;
+    int capacity;
+    int count;
+    int head;         // most recently used, -1 if empty
+    int tail;         // least recently used
+    int writeBack;
+    long hits;
+    long misses;
+    long evictions;
+    long deferredWrites;   // dirty entries later written by eviction or flush
+    pthread_mutex_t lock;
+} AccountCache;
+
+// accounts.idx mapped read-only for lookups in mapped mode
+typedef struct {
+    int fd;
+    void *base;
+    size_t length;
+    long bucketCount;
+} IndexMap;
+
+// transactions.db is the bank's write-ahead log. Every change is appended
+// to it before the account record is touched, and the append is the
+// commit point:
+//  - if the append fails, nothing changes;
+//  - if applying the change to accounts.db fails, the records are cut
+//    off the log again and the operation fails as a whole;
+//  - once committed, records are handed to the OS, so they survive a
+//    process crash. They are fdatasync'ed once groupCommitRecords
+//    records are pending, or once the oldest pending record is
+//    groupCommitMicros old. With the defaults (1 record, 0 us) every
+//    commit is on disk before the operation reports success. A power
+//    failure can lose at most the pending window.
+// After an unclean shutdown, startup cuts off any torn record, loads the
+// newest checkpoint (accounts.ckpt) and replays only the records after it.
+// Every record gets a transaction ID when it is appended. IDs only ever
+// increase: they are reserved on disk in blocks, so a crash can leave a
+// gap but never hands out an ID twice.
+typedef struct {
+    int fd;
+    long recordCount;
+    int pendingRecords;
+    struct timespec firstPending;
+    int groupCommitRecords;
+    long groupCommitMicros;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t flusher;
+    int flusherRunning;
+    LogRecord *buffer;        // batch mode: records appended but not yet written
+    int bufferedRecords;
+    int bufferCapacity;
+    int deferLinks;           // batch mode: link chains in bulk instead of per commit
+    long linkedCount;         // records already linked into the per-account chains
+    long *inFlight;           // first record of every append not yet committed or rolled back
+    int inFlightCount;
+    int inFlightCapacity;
+    int idMapFd;              // transactions.ids: one int64 per ID, record number + 1 (0 = none)
+    int sequenceFd;           // txid.seq: first ID not yet reserved
+    long nextTransactionId;
+    long reservedTransactionId;
+} TransactionLog;
+
+// Per-thread state of the engine stress test
+typedef struct {
+    pthread_t thread;
+    unsigned int seed;
+    long operations;
+    long applied;
+    long rejected;
+    long netDepositCents;  // deposits minus withdrawals applied by this thread
+} StressWorker;
+
+// Latencies of one operation type as seen by one load-test client
+typedef struct {
+    long *nanos;
+    long count;
+    long capacity;
+    long rejected;   // refused by validation, e.g. insufficient funds
+    long errors;     // storage failures
+} LatencySamples;
+
+// Settings shared by every load-test client
+typedef struct {
+    int clients;
+    long durationNanos;
+    double sessionRate;      // sessions per second over all clients, 0 = closed loop
+    int registerPercent;     // sessions that register a new account first
+    int weights[LOAD_ACTIONS];
+    int weightTotal;
+    struct timespec start;
+    atomic_int nextAccount;  // next account number to register
+} LoadConfig;
+
+// One simulated customer. In closed loop it starts a new session as soon
+// as the previous one ends; in open loop sessions arrive on a fixed
+// schedule and a late start counts towards the session's latency.
+typedef struct {
+    pthread_t thread;
+    LoadConfig *config;
+    unsigned int seed;
+    long firstArrival;       // open loop: nanoseconds after the start
+    LatencySamples samples[LOAD_TYPES];
+    int failed;              // ran out of memory for samples, or could not sleep
+} LoadClient;
+
+// One account range of the monthly interest job. The shard fills in the
+// INTEREST records it owes and where each credited account lives.
+typedef struct {
+    pthread_t thread;
+    BankAccount *accounts;
+    long firstAccount;
+    long accountCount;
+    float interestRate;
+    int64_t timestamp;
+    uint32_t description;
+    LogRecord *records;
+    long *positions;
+    long credited;
+    atomic_long *progress;
+} InterestShard;
+
+// Output of an account compaction: the new store (one file per shard),
+// the archive it appends closed accounts to, and the index of both being built
+typedef struct {
+    FILE *outputs[MAX_SHARDS];
+    FILE *archive;
+    IndexSlot *slots;
+    long bucketCount;
+    long entryCount;
+    long liveCounts[MAX_SHARDS];  // records written to each new shard file
+    long liveCount;               // ...and to all of them
+    long archiveCount;            // records in accounts.archive, including earlier runs
+} CompactionJob;
+
+// Latency distribution of one operation in HDR histogram style: a value
+// is bucketed by its power of two and the next HISTOGRAM_SUB_BITS bits, so
+// recording costs one relaxed increment and percentiles read back within
+// about 6% at any scale
+typedef struct {
+    atomic_long buckets[HISTOGRAM_BUCKETS];
+    atomic_long totalNanos;
+    atomic_long maxNanos;
+} LatencyHistogram;
+
+// Background thread that rewrites the metrics file every interval
+typedef struct {
+    pthread_t thread;
+    char path[4096];
+    int intervalSeconds;
+    int running;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} MetricsWriter;
+
+// Outcome of posting one operation to the ledger
+typedef enum {
+    POST_OK,
+    POST_BAD_FORMAT,
+    POST_INVALID_AMOUNT,
+    POST_LIMIT_EXCEEDED,
+    POST_INVALID_DETAILS,
+    POST_NO_ACCOUNT,
+    POST_ACCOUNT_CLOSED,
+    POST_ACCOUNT_EXISTS,
+    POST_SAME_ACCOUNT,
+    POST_INSUFFICIENT_FUNDS,
+    POST_VELOCITY_LIMIT,
+    POST_BALANCE_REMAINING,
+    POST_STORAGE_ERROR,
+    POST_NOT_DURABLE         // applied, but the log could not be synced to disk
+} PostResult;
+
+// One parsed line of an import file. The text fields point into the file,
+// which stays in memory for the whole import.
+typedef struct {
+    int accountNumber;
+    int exported;          // 1: salt and hash written by --export, 0: a password to hash
+    int isActive;          // 0: exported as closed
+    long line;
+    long balance;          // cents
+    int64_t dateCreated;   // exported lines only
+    const char *name;
+    const char *secret;    // the password, or the exported salt
+    const char *hash;
+} ImportEntry;
+
+typedef struct {
+    long line;
+    PostResult result;
+} ImportReject;
+
+// One stretch of whole lines of an import file, parsed and then sorted by
+// account number on its own thread
+typedef struct {
+    pthread_t thread;
+    char *text;
+    long length;
+    long lineCount;
+    ImportEntry *entries;
+    long entryCount;
+    ImportReject *rejects;
+    long rejectCount;
+    int failed;
+} ImportSlice;
+
+// Builds one part of a round of new account records, salts and hashes included
+typedef struct {
+    pthread_t thread;
+    const ImportEntry **entries;
+    BankAccount *accounts;
+    long count;
+    time_t created;
+    unsigned int seed;
+} ImportHasher;
+
+// Formats one part of a round of an export into its own buffer
+typedef struct {
+    pthread_t thread;
+    const BankAccount *accounts;
+    long count;
+    char *buffer;
+    long length;
+    long exported;
+} ExportFormatter;
+
+// Storage mode, chosen on the command line
+int useMappedStorage = 0;
+AccountMap accountMap = { -1, NULL, 0, 0, 0 };
+IndexMap accountIndexMap = { -1, NULL, 0, 0 };
+int useDirectIndex = 0;
+DirectIndex directIndex = { .fd = -1 };
+ShardMap shardMap = { SHARD_MAP_MAGIC, SHARD_MAP_VERSION, 0, 1, { 0 } };
+int sharedAccess = 0;
+SharedLocks sharedLocks = {
+    .fd = -1,
+    .storeLock = PTHREAD_MUTEX_INITIALIZER,
+    .logLock = PTHREAD_MUTEX_INITIALIZER
+};
+int accountCacheSize = ACCOUNT_CACHE_DEFAULT;
+AccountCache accountCache = {
+    .head = -1,
+    .tail = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+TransactionLog transactionLog = {
+    .fd = -1,
+    .idMapFd = -1,
+    .sequenceFd = -1,
+    .groupCommitRecords = 1,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER
+};
+DescriptionTable descriptionTable = {
+    .fd = -1,
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+TimeIndex timeIndex = { NULL, 0, 0, 0, 1 };
+Rollups rollups = { NULL, 0, 0, NULL, 0, 0, 0, 0, 0, 1 };
+VelocityLimits velocityLimits = {
+    .amountLimit = (int64_t)(VELOCITY_AMOUNT_LIMIT * 100),
+    .windowMinutes = VELOCITY_WINDOW_MINUTES,
+    .transferLimit = VELOCITY_TRANSFER_LIMIT,
+    .valid = 1,
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+int databaseOpen = 0;
+long checkpointInterval = CHECKPOINT_INTERVAL;
+long checkpointPosition = -1;  // log position of the newest checkpoint, -1 if there is none
+
+const char *transactionTypeNames[TX_TYPES] = {
+    "VOID", "DEPOSIT", "WITHDRAWAL", "TRANSFER_SENT", "TRANSFER_RECEIVED",
+    "ACCOUNT_CREATION", "ACCOUNT_CLOSURE", "INTEREST", "PASSWORD_CHANGE", "OTHER"
+};
+
+// Striped per-account locks for the concurrent engine. An operation on two
+// accounts always takes the lower stripe first, so transfers cannot deadlock.
+pthread_mutex_t accountStripes[LOCK_STRIPES];
+int accountStripesReady = 0;
+
+// Postings hold this shared; adding an account holds it exclusively because
+// that may grow and remap the account store and its index
+pthread_rwlock_t accountStoreLock = PTHREAD_RWLOCK_INITIALIZER;
+
+const char *batchOperationNames[BATCH_OPERATIONS] = { "deposit", "withdraw", "transfer", "open", "close" };
+const char *benchOperationNames[BENCH_OPERATIONS] = {
+    "find_account", "update_balance", "record_transaction", "history_page",
+    "find_transaction", "transfer", "post_deposit"
+};
+
+// Instrumentation; nothing below is touched on the hot path unless metrics are on
+int metricsEnabled = 0;
+struct timespec metricsStart;
+LatencyHistogram latencyHistograms[METRIC_OPERATIONS];
+atomic_long ioCounters[IO_COUNTERS];
+MetricsWriter metricsWriter = {
+    .intervalSeconds = METRICS_INTERVAL,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER
+};
+const char *metricNames[METRIC_OPERATIONS] = {
+    "login", "hash_password", "find_account", "deposit", "withdrawal", "transfer",
+    "open_account", "close_account", "history_page", "log_write", "log_sync", "velocity_check"
+};
+const char *ioCounterNames[IO_COUNTERS] = {
+    "file_opens", "read_calls", "records_read", "bytes_read",
+    "write_calls", "records_written", "bytes_written", "syncs"
+};
+
 // Global variables for current session
 BankAccount currentUser;
 int isLoggedIn = 0;
 
 // Database function prototypes
 int initializeDatabase();
+void closeDatabase();
+long trimAccountPadding();
+int mapAccountStore(long recordCount);
+int growAccountStore();
+void unmapAccountStore();
+void syncMappedAccount(long recordNumber);
+BankAccount *mappedAccount(int accountNumber, long *recordNumber);
+int mapAccountIndex();
+void unmapAccountIndex();
+off_t directOffset(long accountNumber);
+int mapDirectIndex();
+void closeDirectIndex();
+int rebuildDirectIndex();
+int openDirectIndex(long recordCount);
+int64_t directEntry(long value);
+int directLookup(int accountNumber, long *recordNumber);
+int insertDirectIndex(int accountNumber, long recordNumber, long recordCount);
+int updateDirectIndex(int accountNumber, long recordNumber, long recordCount);
+int loadShardMap();
+int shardOfAccount(const ShardMap *map, int accountNumber);
+void shardFilePath(const ShardMap *map, int shard, char *path, size_t size);
+long shardRecord(int shard, long record);
+int recordShard(long recordNumber);
+long recordInShard(long recordNumber);
+FILE *openShardFile(int shard, const char *mode);
+long shardRecordCount(int shard);
+long storeRecordCount();
+int syncAccountStore();
+int openStoreScan(StoreScan *scan, const char *mode);
+int nextStoreRecord(StoreScan *scan, BankAccount *account, long *recordNumber);
+int rewriteStoreRecord(StoreScan *scan, const BankAccount *account);
+int closeStoreScan(StoreScan *scan);
+void *shardTransferWorker(void *arg);
+int transferAccountStore(BankAccount *accounts, const long *starts, int write);
+long loadAccountStore(BankAccount **accounts, long *starts);
+int compareAccountNumbers(const void *a, const void *b);
+long reshardAccounts(int shardCount);
+int openSharedLocks();
+void closeSharedLocks();
+long readProcessCount();
+void writeProcessCount(long count);
+int lockByte(off_t offset, short type, int wait);
+void lockSharedStore(int exclusive);
+void unlockSharedStore(int exclusive);
+void lockSharedLog();
+void unlockSharedLog();
+void lockSharedAccounts(int firstAccount, int secondAccount);
+void unlockSharedAccounts(int firstAccount, int secondAccount);
+int refreshSharedLog();
+int refreshSharedLogLocked();
+void lockAccountStore(int exclusive);
+void unlockAccountStore(int exclusive);
 int createAccount(const BankAccount *account);
 int findAccountByNumber(int accountNumber, BankAccount *result);
+int initAccountCache(int capacity);
+void freeAccountCache();
+int cacheFindLocked(int accountNumber);
+void cacheUnlinkLocked(int entry);
+void cachePushFrontLocked(int entry);
+void cacheRemoveLocked(int entry);
+int cacheGet(int accountNumber, BankAccount *account, long *recordNumber);
+int cachePut(const BankAccount *account, long recordNumber, int dirty);
+void cacheInvalidate(int accountNumber);
+int flushAccountCache(int invalidate);
+int writeAccountRecords(const BankAccount *accounts, const long *recordNumbers, int count);
+int loadAccount(int accountNumber, BankAccount *account, long *recordNumber);
+int storeAccounts(const BankAccount *accounts, const long *recordNumbers, int count, int writeThrough);
+void showCacheStatistics();
+int locateAccount(int accountNumber, long *recordNumber);
+int readArchivedAccount(int accountNumber, long archiveRecord, BankAccount *account);
+int readIndexedAccount(int accountNumber, long *recordNumber, BankAccount *account);
+long indexBucket(int key, long bucketCount);
+long indexBucketCount(long entries, long minBuckets);
+const IndexSlot *indexFind(const IndexSlot *slots, long bucketCount, int key);
+int indexAdd(IndexSlot **slots, long *bucketCount, long *entryCount, int key, long value);
+void indexPut(IndexSlot *slots, long bucketCount, const IndexSlot *entry, long *entryCount);
+int writeIndexFile(const char *path, const IndexSlot *slots, long bucketCount, long entryCount, long recordCount);
+int growIndexSlots(IndexSlot **slots, long *bucketCount);
+int readIndexHeader(FILE *file, IndexHeader *header);
+int indexIsCurrent(const char *path, long recordCount);
+int indexLookup(const char *path, int key, IndexSlot *result);
+int growIndex(const char *path, FILE *file, const IndexHeader *header);
+int indexUpsert(const char *path, const IndexSlot *entry, long recordCount);
+int rebuildAccountIndex();
+int insertAccountIndex(int accountNumber, long recordNumber, long recordCount);
+int rebuildTransactionIndex();
+int64_t currentMicros();
+void formatTimestamp(int64_t micros, char *buffer);
+int64_t parseTimestamp(const char *text);
+TransactionType transactionTypeFromName(const char *name);
+off_t logOffset(long recordNumber);
+uint32_t descriptionHash(const char *text);
+long logRecordCount(long fileSize);
+int openDescriptionTable();
+int loadDescriptionsLocked(off_t fileSize);
+int refreshDescriptionsLocked();
+void closeDescriptionTable();
+int growDescriptionSlots();
+uint32_t internDescription(const char *text);
+uint32_t internDescriptionLocked(const char *text);
+void renderDescription(uint32_t offset, char *buffer);
+int syncDescriptionTable();
+void renderTransaction(const LogRecord *record, Transaction *transaction);
+int prepareTransactionLog();
+long convertLegacyLog();
+int linkTransaction(int accountNumber, long recordNumber);
+long repairTransactionLog();
+int openTransactionLog(long recordCount, long linkedCount);
+void closeTransactionLog();
+int appendTransactions(LogRecord *records, int count, long *firstRecord);
+int appendTransactionsLocked(LogRecord *records, int count, long *firstRecord);
+void settleTransactionsLocked(long firstRecord);
+void rollbackTransactions(long firstRecord, int count);
+int commitTransactions(const LogRecord *records, int count, long firstRecord);
+int flushLogBufferLocked();
+int flushTransactionLog();
+int enableLogBuffering(int capacity);
+int linkTransactionRange(long firstRecord, long count);
+int linkDeferredTransactions();
+int syncTransactionLogLocked();
+int syncTransactionLog();
+long microsSince(const struct timespec *start);
+void *groupCommitFlusher(void *arg);
+int readLogRecord(long recordNumber, LogRecord *record);
+long reconcileAccountsWithLog();
+uint64_t checkpointChecksum(uint64_t hash, const CheckpointEntry *entries, long count);
+int writeCheckpoint();
+int checkpointIfDue();
+int loadCheckpoint(CheckpointHeader *header, CheckpointEntry **entries);
+long trimTransactionIndex(long transactionCount);
+int growTimeIndexLocked(long blockCount);
+void indexRecordTimesLocked(const LogRecord *records, long firstRecord, long count);
+int loadTimeIndex(long transactionCount);
+int writeTimeIndex();
+void freeTimeIndex();
+int rollupDayLocked(int64_t timestamp);
+DayRollup *findDayRollupLocked(int day, int create);
+long monthRollupBucket(int accountNumber, int month, long bucketCount);
+MonthRollup *findMonthRollupLocked(int accountNumber, int month, int create);
+void rollUpRecordsLocked(const LogRecord *records, long count, int sign);
+void unrollRecordsLocked(long firstRecord, long count);
+int loadRollups(long transactionCount);
+int writeRollups();
+void freeRollups();
+int readDayRollup(int day, DayRollup *totals);
+int readMonthRollup(int accountNumber, int month, MonthRollup *totals);
+int parseRollupKey(const char *text, int withDay);
+void showRollups();
+int64_t velocitySlotMicros(int transfers);
+void advanceVelocityEntry(VelocityEntry *entry, int64_t amountSlot, int64_t transferSlot);
+VelocityEntry *findVelocityEntryLocked(int accountNumber, int create);
+void noteVelocityLocked(const LogRecord *records, long count, int sign);
+int loadVelocity(long transactionCount);
+void freeVelocity();
+void disableVelocityLimits();
+PostResult checkVelocity(int accountNumber, long amountCents, int transfer);
+void showVelocityLimits();
+int64_t balanceBefore(const LogRecord *record);
+int initReplayTable(ReplayTable *table, long expectedAccounts);
+AccountReplay *replayEntry(ReplayTable *table, int accountNumber, int create);
+void replayRecord(AccountReplay *state, const LogRecord *record);
+int replayLogRange(ReplayTable *table, long firstRecord, long recordCount);
+long replayLogTail();
+void *verifyShardWorker(void *arg);
+void checkAccountAgainstLog(ReplayTable *ledger, const BankAccount *account, long *mismatched, long *unlogged);
+int verifyLedger();
 int updateAccountBalance(int accountNumber, long newBalanceCents);
 int updateAccountPassword(int accountNumber, const char *newPassword);
-int recordTransaction(const Transaction *transaction);
-int getAccountTransactions(int accountNumber, Transaction **transactions, int *count);
-void freeTransactions(Transaction *transactions);
+int recordTransaction(LogRecord *record);
+int openTransactionIds(long recordCount);
+long newestTransactionId(long recordCount, long *recordNumber);
+void closeTransactionIds();
+int reserveTransactionIdsLocked(int count);
+int mapTransactionIds(const LogRecord *records, long firstRecord, long count);
+int rebuildTransactionIdMap(long recordCount);
+long findTransactionRecord(long transactionId);
+int findTransactionById(long transactionId, Transaction *transaction);
+int openHistoryCursor(HistoryCursor *cursor, int accountNumber, long offset, int newestFirst, int pageSize);
+int advanceHistoryCursor(HistoryCursor *cursor);
+int nextHistoryBatch(HistoryCursor *cursor);
+void closeHistoryCursor(HistoryCursor *cursor);
+int openRangeCursor(RangeCursor *cursor, int accountNumber, int64_t from, int64_t to, int pageSize);
+int nextRangeBatch(RangeCursor *cursor);
+void closeRangeCursor(RangeCursor *cursor);
+void limitRangeCursor(RangeCursor *cursor, long endRecord);
+void openSnapshot(Snapshot *snapshot);
+int snapshotAccount(Snapshot *snapshot, int accountNumber, BankAccount *account);
+void closeSnapshot(Snapshot *snapshot);
+int64_t parseDate(const char *text, int dayOffset);
+int readPeriod(int64_t *from, int64_t *to, char *label, int labelSize);
+void showRangeResults(RangeCursor *cursor);
 int validateEnhancedPassword(const char *password);
 void clearInputBuffer();
 void printHeader(const char *title);
 void getCurrentTimestamp(char* buffer);
 void generateSalt(char* salt, int length);
+void generateSaltSeeded(char *salt, int length, unsigned int *seed);
 void hashPassword(const char* plain, const char* salt, char* hashed);
 void safeInputString(char* buffer, int size, const char* prompt);
 int getIntegerInput(const char* prompt);
 float getFloatInput(const char* prompt);
 int transferFundsWithRollback(int fromAccount, int toAccount, long amountCents);
 int closeAccount(int accountNumber);
-void applyMonthlyInterest();
+int creditInterest(BankAccount *account, float interestRate, int64_t timestamp, uint32_t description,
+                   LogRecord *record);
+void *interestShardWorker(void *arg);
+int jobThreadCount(long accountCount);
+long applyMonthlyInterest();
 void generateAccountStatement();
+void writeStatementHeader(FILE *file, const BankAccount *account, const char *statementDate, const char *period);
+void writeStatementLine(FILE *file, const char *timestamp, const char *type, long amount, long balanceAfter);
+int addStatementEntry(StatementShard *shard, long position, const LogRecord *record);
+int writeBulkStatement(const BankAccount *account, const char *statementDate,
+                       const LogRecord *records, long count, char *buffer);
+void *statementShardWorker(void *arg);
+long generateAllStatements();
+int copyArchivedEntries(CompactionJob *job);
+int readStoreRecords(FILE *store, long firstRecord, long count, BankAccount *accounts);
+int placeCompactedAccount(CompactionJob *job, const BankAccount *account);
+int rewriteCompactedAccount(CompactionJob *job, long value, const BankAccount *account);
+long *collectChangedAccounts(long firstRecord, long recordCount, long *accountCount);
+long compactAccounts();
+
+// Ledger posting prototypes (shared by the menus and batch mode)
+void fillTransaction(LogRecord *record, int accountNumber, TransactionType type,
+                     long amountCents, long balanceAfter, const char *description);
+const char *postResultMessage(PostResult result);
+int postApplied(PostResult result);
+PostResult postDeposit(int accountNumber, long amountCents, long *balanceAfter);
+PostResult postWithdrawal(int accountNumber, long amountCents, long *balanceAfter);
+PostResult postTransfer(int fromAccount, int toAccount, long amountCents, long *balanceAfter);
+PostResult postOpenAccount(const BankAccount *account);
+PostResult postCloseAccount(int accountNumber);
+PostResult executeDeposit(int accountNumber, long amountCents, long *balanceAfter);
+PostResult executeWithdrawal(int accountNumber, long amountCents, long *balanceAfter);
+PostResult executeTransfer(int fromAccount, int toAccount, long amountCents, long *balanceAfter);
+PostResult executeOpenAccount(const BankAccount *account);
+PostResult executeCloseAccount(int accountNumber);
+PostResult findOpenAccount(int accountNumber, BankAccount *account);
+PostResult checkAmount(long amountCents);
+
+// Concurrent engine prototypes
+void initAccountStripes();
+int accountStripe(int accountNumber);
+void lockAccounts(int firstAccount, int secondAccount);
+void unlockAccounts(int firstAccount, int secondAccount);
+PostResult engineDeposit(int accountNumber, long amountCents, long *balanceAfter);
+PostResult engineWithdrawal(int accountNumber, long amountCents, long *balanceAfter);
+PostResult engineTransfer(int fromAccount, int toAccount, long amountCents, long *balanceAfter);
+PostResult engineOpenAccount(const BankAccount *account);
+PostResult engineCloseAccount(int accountNumber);
+int engineAuthenticate(int accountNumber, const char *password, BankAccount *account);
+int engineReadHistory(int accountNumber, HistoryCursor *cursor);
+void removeDatabaseFiles();
+long totalAccountBalances();
+void *stressWorker(void *arg);
+int runStressTest(int threadCount, long operationCount);
+
+// Storage benchmark prototypes
+int compareLongs(const void *a, const void *b);
+long nanosSince(const struct timespec *start);
+int sleepUntil(const struct timespec *deadline);
+int createBenchDatabase(long accountCount, long transactionCount, long *balances);
+long benchmarkOperation(int operation, long accountCount, long transactionCount, long *balances,
+                        long operations, long *nanos, unsigned int *seed);
+int runBenchmark(long accountCount, long transactionCount, long operations);
+
+// Load generator prototypes
+int parseLoadMix(const char *text, LoadConfig *config);
+int addLatencySample(LatencySamples *samples, long nanos);
+void timeLoadOperation(LoadClient *client, int type, const struct timespec *start, PostResult result);
+void runLoadSession(LoadClient *client);
+void *loadClientWorker(void *arg);
+void printLatencyRow(const char *name, LoadClient *clients, int clientCount, int type, double seconds);
+int runLoadTest(int clientCount, double seconds, double sessionRate, const char *mix);
+
+// Batch mode prototypes
+int parseAmountCents(const char *text, long *cents);
+int splitBatchLine(char *line, char **fields, int maxFields);
+PostResult applyBatchLine(char **fields, int fieldCount, int *operation);
+int runBatch(const char *path);
+
+// Bulk import and export prototypes
+PostResult parseImportLine(char *line, ImportEntry *entry);
+void *importParseWorker(void *arg);
+int compareImportEntries(const void *a, const void *b);
+int compareImportRejects(const void *a, const void *b);
+int compareInts(const void *a, const void *b);
+int *collectAccountNumbers(long *count);
+void *importHashWorker(void *arg);
+int writeImportedAccounts(const ImportEntry **accepted, long count, const int *fds, const long *originalCounts);
+int runImport(const char *path);
+void *exportFormatWorker(void *arg);
+int runExport(const char *path);
+
+// Instrumentation prototypes
+void enableMetrics();
+void startMetric(struct timespec *start);
+void stopMetric(int metric, const struct timespec *start);
+int histogramBucket(long nanos);
+long histogramBucketLimit(int bucket);
+void recordLatency(int metric, long nanos);
+void countIo(int counter, long amount);
+void writeMetrics(FILE *output);
+int writeMetricsFile(const char *path);
+void *metricsFileWriter(void *arg);
+int startMetricsWriter(const char *path, int intervalSeconds);
+void stopMetricsWriter();
+void showMetrics();
+FILE *openFile(const char *path, const char *mode);
+int openDescriptor(const char *path, int flags, mode_t mode);
+size_t readRecords(void *buffer, size_t size, size_t count, FILE *file);
+size_t writeRecords(const void *buffer, size_t size, size_t count, FILE *file);
+ssize_t readAt(int fd, void *buffer, size_t length, off_t offset);
+ssize_t writeAt(int fd, const void *buffer, size_t length, off_t offset);
+int syncDescriptor(int fd);
+int syncMapping(void *address, size_t length);
 
 // Currency conversion helpers
 float centsToFloat(long cents);
@@ -84,8 +1221,12 @@ long floatToCents(float amount);
 
 // Business logic function prototypes
 void mainMenu();
+void adminMenu();
+void lookupTransaction();
+void listTransactionsByDate();
 void userMenu();
 void registerAccount();
+int authenticateUser(int accountNumber, const char *password, BankAccount *account);
 int login();
 void depositFunds();
 void withdrawFunds();
@@ -95,14 +1236,226 @@ void displayAccountDetails();
 void viewTransactionHistory();
 void closeCurrentAccount();
 
-int main() {
+int main(int argc, char *argv[]) {
     srand(time(NULL));
     
+    const char *batchFile = NULL;
+    const char *importFile = NULL, *exportFile = NULL;
+    int groupCommitSet = 0;
+    int verify = 0;
+    int compact = 0;
+    int reshard = 0;
+    long benchAccounts = 0, benchTransactions = 0, benchOperations = BENCH_DEFAULT_OPERATIONS;
+    int loadClients = 0;
+    double loadSeconds = 0, loadRate = 0;
+    const char *loadMix = LOAD_DEFAULT_MIX;
+    const char *metricsFile = NULL;
+    int metricsInterval = METRICS_INTERVAL;
+    
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--mmap") == 0) {
+            useMappedStorage = 1;
+        } else if (strcmp(argv[i], "--direct-index") == 0) {
+            useDirectIndex = 1;
+        } else if (strcmp(argv[i], "--shared") == 0) {
+            sharedAccess = 1;
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchFile = argv[++i];
+        } else if (strcmp(argv[i], "--stress-test") == 0 && i + 2 < argc &&
+                   atoi(argv[i + 1]) > 0 && atol(argv[i + 2]) > 0) {
+            disableVelocityLimits();
+            return runStressTest(atoi(argv[i + 1]), atol(argv[i + 2])) ? 0 : 1;
+        } else if (strcmp(argv[i], "--group-commit") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            transactionLog.groupCommitRecords = atoi(argv[++i]);
+            groupCommitSet = 1;
+        } else if (strcmp(argv[i], "--group-window") == 0 && i + 1 < argc && atol(argv[i + 1]) >= 0) {
+            transactionLog.groupCommitMicros = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--cache-size") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            accountCacheSize = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--write-back") == 0) {
+            accountCache.writeBack = 1;
+        } else if (strcmp(argv[i], "--velocity-limit") == 0 && i + 2 < argc &&
+                   atof(argv[i + 1]) >= 0 && atof(argv[i + 1]) <= 1e12 && atoi(argv[i + 2]) > 0) {
+            velocityLimits.amountLimit = (int64_t)(atof(argv[++i]) * 100 + 0.5);
+            velocityLimits.windowMinutes = atoi(argv[++i]);
+            velocityLimits.set = 1;
+        } else if (strcmp(argv[i], "--transfer-limit") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 0) {
+            velocityLimits.transferLimit = atoi(argv[++i]);
+            velocityLimits.set = 1;
+        } else if (strcmp(argv[i], "--checkpoint-interval") == 0 && i + 1 < argc && atol(argv[i + 1]) >= 0) {
+            checkpointInterval = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = 1;
+        } else if (strcmp(argv[i], "--compact") == 0) {
+            compact = 1;
+        } else if (strcmp(argv[i], "--reshard") == 0 && i + 1 < argc &&
+                   atoi(argv[i + 1]) >= 1 && atoi(argv[i + 1]) <= MAX_SHARDS) {
+            reshard = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--import") == 0 && i + 1 < argc) {
+            importFile = argv[++i];
+        } else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+            exportFile = argv[++i];
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 2 < argc &&
+                   atol(argv[i + 1]) > 0 && atol(argv[i + 1]) <= BENCH_MAX_RECORDS &&
+                   atol(argv[i + 2]) > 0 && atol(argv[i + 2]) <= BENCH_MAX_RECORDS) {
+            benchAccounts = atol(argv[++i]);
+            benchTransactions = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-ops") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0) {
+            benchOperations = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--load-test") == 0 && i + 2 < argc &&
+                   atoi(argv[i + 1]) > 0 && atof(argv[i + 2]) > 0) {
+            loadClients = atoi(argv[++i]);
+            loadSeconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--load-rate") == 0 && i + 1 < argc && atof(argv[i + 1]) >= 0) {
+            loadRate = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--load-mix") == 0 && i + 1 < argc) {
+            loadMix = argv[++i];
+        } else if (strcmp(argv[i], "--metrics") == 0) {
+            enableMetrics();
+        } else if (strcmp(argv[i], "--metrics-file") == 0 && i + 1 < argc) {
+            metricsFile = argv[++i];
+        } else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0) {
+            metricsInterval = atoi(argv[++i]);
+        } else {
+            printf("Usage: %s [--mmap] [--direct-index] [--cache-size N] [--write-back]\n", argv[0]);
+            printf("       %*s [--group-commit N] [--group-window MICROS] [--checkpoint-interval N]\n",
+                   (int)strlen(argv[0]), "");
+            printf("       %*s [--velocity-limit AMOUNT MINUTES] [--transfer-limit N]\n",
+                   (int)strlen(argv[0]), "");
+            printf("       %*s [--shared] [--batch FILE | --verify | --compact | --reshard N]\n",
+                   (int)strlen(argv[0]), "");
+            printf("       %*s [--import FILE | --export FILE]\n", (int)strlen(argv[0]), "");
+            printf("       %*s [--metrics] [--metrics-file FILE] [--metrics-interval SECONDS]\n",
+                   (int)strlen(argv[0]), "");
+            printf("       %s --stress-test THREADS OPERATIONS\n", argv[0]);
+            printf("       %s [storage options] --bench ACCOUNTS TRANSACTIONS [--bench-ops N]\n", argv[0]);
+            printf("       %s [storage options] --load-test CLIENTS SECONDS [--load-rate N] [--load-mix MIX]\n",
+                   argv[0]);
+            printf("  --mmap                 keep accounts.db memory-mapped instead of using file I/O\n");
+            printf("  --direct-index         find accounts through accounts.dir, a table indexed by account number\n");
+            printf("  --cache-size N         accounts cached in memory in file I/O mode, 0 to disable (default %d)\n",
+                   ACCOUNT_CACHE_DEFAULT);
+            printf("  --write-back           defer cached balance writes until eviction or shutdown\n");
+            printf("  --shared               let several processes (teller terminals) use the database at once\n");
+            printf("  --batch FILE           post the operations in FILE without the menus and exit\n");
+            printf("  --stress-test T N      run N random operations on T threads in a scratch database\n");
+            printf("  --bench A T            time each storage operation on a scratch database of A accounts\n");
+            printf("                         and T transactions (up to %d each); prints CSV\n", BENCH_MAX_RECORDS);
+            printf("  --bench-ops N          timed calls per benchmarked operation (default %d)\n",
+                   BENCH_DEFAULT_OPERATIONS);
+            printf("  --load-test C S        run scripted customer sessions on C threads for S seconds in a\n");
+            printf("                         scratch database; reports latency per operation\n");
+            printf("  --load-rate N          start N sessions per second in total instead of back to back\n");
+            printf("  --load-mix MIX         REGISTER%%:DEPOSIT:WITHDRAW:TRANSFER:HISTORY (default %s)\n",
+                   LOAD_DEFAULT_MIX);
+            printf("  --group-commit N       fdatasync the transaction log once N records are pending (default 1)\n");
+            printf("  --group-window MICROS  ...or once the oldest pending record is this old (default off)\n");
+            printf("  --checkpoint-interval N\n");
+            printf("                         checkpoint the balances every N transactions, 0 for shutdown only (default %d)\n",
+                   CHECKPOINT_INTERVAL);
+            printf("  --velocity-limit K M   refuse withdrawals and transfers that would take more than K kwacha\n");
+            printf("                         out of an account within M minutes, K 0 for no limit (default %.0f %d)\n",
+                   VELOCITY_AMOUNT_LIMIT, VELOCITY_WINDOW_MINUTES);
+            printf("  --transfer-limit N     refuse a transfer once an account has sent N in the last hour, 0 for no\n");
+            printf("                         limit (default %d). Batch, bench and load runs skip both unless given\n",
+                   VELOCITY_TRANSFER_LIMIT);
+            printf("  --verify               rebuild every balance from the log, compare with the accounts and exit\n");
+            printf("  --compact              move closed accounts from the account files to %s and exit\n",
+                   ACCOUNTS_ARCHIVE);
+            printf("  --reshard N            split the accounts over N files by account-number range (1 to %d,\n",
+                   MAX_SHARDS);
+            printf("                         1 for a single accounts.db) and exit\n");
+            printf("  --import FILE          add the accounts in the CSV file FILE and exit\n");
+            printf("  --export FILE          write every account to FILE in the format --import reads and exit\n");
+            printf("  --metrics              time operations and count file I/O (Admin Tools > Performance Metrics)\n");
+            printf("  --metrics-file FILE    also rewrite FILE with the metrics every interval and at exit\n");
+            printf("  --metrics-interval S   seconds between rewrites of the metrics file (default %d)\n",
+                   METRICS_INTERVAL);
+            return 1;
+        }
+    }
+    
+    // Other processes' changes are only seen by reading the files, so
+    // nothing about the accounts may be kept in memory between operations
+    if (sharedAccess) {
+        if (useMappedStorage || useDirectIndex || accountCache.writeBack || batchFile != NULL ||
+            benchAccounts > 0 || loadClients > 0 || reshard > 0 || importFile != NULL) {
+            printf("❌ --shared cannot be combined with --mmap, --direct-index, --write-back, --batch,\n");
+            printf("   --bench, --load-test, --reshard or --import.\n");
+            return 1;
+        }
+        accountCacheSize = 0;
+    }
+    if (reshard > 0 && (useMappedStorage || batchFile != NULL)) {
+        printf("❌ --reshard rewrites the account files and cannot be combined with --mmap or --batch.\n");
+        return 1;
+    }
+    if (importFile != NULL && exportFile != NULL) {
+        printf("❌ --import and --export cannot be combined; run them one after the other.\n");
+        return 1;
+    }
+    if (importFile != NULL && (useMappedStorage || batchFile != NULL)) {
+        printf("❌ --import appends to the account files and cannot be combined with --mmap or --batch.\n");
+        return 1;
+    }
+    
+    if (metricsFile != NULL) {
+        if (!metricsEnabled) enableMetrics();
+        if (!startMetricsWriter(metricsFile, metricsInterval)) {
+            printf("❌ Cannot write the metrics file %s!\n", metricsFile);
+            return 1;
+        }
+        atexit(stopMetricsWriter);
+    }
+    
+    if (batchFile != NULL || benchAccounts > 0 || loadClients > 0) disableVelocityLimits();
+    if (benchAccounts > 0) {
+        return runBenchmark(benchAccounts, benchTransactions, benchOperations) ? 0 : 1;
+    }
+    if (loadClients > 0) {
+        return runLoadTest(loadClients, loadSeconds, loadRate, loadMix) ? 0 : 1;
+    }
+    
+    // Batch runs keep accounts resident (when there is one accounts.db to
+    // map) and batch their log writes
+    if (batchFile != NULL) {
+        if (access(ACCOUNTS_SHARD_MAP, F_OK) != 0) useMappedStorage = 1;
+        if (!groupCommitSet) transactionLog.groupCommitRecords = BATCH_GROUP_COMMIT;
+    }
+    
     if (!initializeDatabase()) {
         printf("❌ Failed to initialize database system!\n");
         return 1;
     }
     
+    if (batchFile != NULL) {
+        int success = runBatch(batchFile);
+        closeDatabase();
+        return success ? 0 : 1;
+    }
+    if (verify) {
+        int success = verifyLedger();
+        closeDatabase();
+        return success ? 0 : 1;
+    }
+    if (reshard > 0) {
+        long accounts = reshardAccounts(reshard);
+        if (accounts >= 0) printf("✅ %ld account(s) now in %d shard file(s).\n", accounts, reshard);
+        closeDatabase();
+        return accounts >= 0 ? 0 : 1;
+    }
+    if (compact) {
+        long archived = compactAccounts();
+        if (archived >= 0) printf("✅ %ld closed account(s) moved to %s.\n", archived, ACCOUNTS_ARCHIVE);
+        closeDatabase();
+        return archived >= 0 ? 0 : 1;
+    }
+    if (importFile != NULL || exportFile != NULL) {
+        int success = importFile != NULL ? runImport(importFile) : runExport(exportFile);
+        closeDatabase();
+        return success ? 0 : 1;
+    }
+    
     printf("============================================\n");
     printf("      WELCOME TO CM BANK\n");
     printf("        Student: 2025554164\n");
@@ -110,6 +1463,7 @@ int main() {
     printf("============================================\n");
     
     mainMenu();
+    closeDatabase();
     return 0;
 }
 
@@ -125,379 +1479,7094 @@ long floatToCents(float amount) {
 int initializeDatabase() {
     FILE *file;
     
-    file = fopen(ACCOUNTS_DB, "ab");
-    if (file == NULL) return 0;
-    fclose(file);
-    
-    file = fopen(TRANSACTIONS_DB, "ab");
-    if (file == NULL) return 0;
-    fclose(file);
+    initAccountStripes();
     
-    return 1;
-}
-
-// Security Functions (Android compatible)
-void generateSalt(char* salt, int length) {
-    const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789./";
-    for (int i = 0; i < length; i++) {
-        salt[i] = chars[rand() % (sizeof(chars) - 1)];
-    }
-    salt[length] = '\0';
-}
-
-void hashPassword(const char* plain, const char* salt, char* hashed) {
-    char salted[256];
-    snprintf(salted, sizeof(salted), "%s%s", plain, salt);
-    simple_sha256(salted, hashed);
-}
-
-// Input Handling Functions
-void safeInputString(char* buffer, int size, const char* prompt) {
-    printf("%s", prompt);
-    memset(buffer, 0, size);
-    if (fgets(buffer, size, stdin) != NULL) {
-        buffer[strcspn(buffer, "\n")] = 0;
-    } else {
-        buffer[0] = 0;
-        clearInputBuffer();
+    // A process joining others waits until none of them is in the middle
+    // of an operation, then reads the files as they left them
+    int firstProcess = 1;
+    if (sharedAccess) {
+        firstProcess = openSharedLocks();
+        if (firstProcess < 0) return 0;
+        if (!firstProcess) lockSharedStore(1);
     }
-}
-
-int getIntegerInput(const char* prompt) {
-    char buffer[100];
-    int value;
     
-    while (1) {
-        safeInputString(buffer, sizeof(buffer), prompt);
-        if (sscanf(buffer, "%d", &value) == 1) {
-            return value;
-        }
-        printf("Invalid input! Please enter a valid number.\n");
+    // Only --reshard changes the map, and not while other processes are running
+    if (!loadShardMap()) return 0;
+    if (useMappedStorage && shardMap.shardCount > 1) {
+        printf("❌ --mmap needs a single accounts.db; run --reshard 1 first.\n");
+        return 0;
     }
-}
-
-float getFloatInput(const char* prompt) {
-    char buffer[100];
-    float value;
-    
-    while (1) {
-        safeInputString(buffer, sizeof(buffer), prompt);
-        if (sscanf(buffer, "%f", &value) == 1) {
-            return value;
-        }
-        printf("Invalid input! Please enter a valid number.\n");
+    for (int shard = 0; shard < shardMap.shardCount; shard++) {
+        file = openShardFile(shard, "ab");
+        if (file == NULL) return 0;
+        fclose(file);
     }
-}
-
-int validateEnhancedPassword(const char *password) {
-    int len = strlen(password);
-    if (len < 8) return 0;
     
-    int hasDigit = 0, hasAlpha = 0;
-    for (int i = 0; i < len; i++) {
-        if (isdigit(password[i])) hasDigit = 1;
-        if (isalpha(password[i])) hasAlpha = 1;
-    }
-    return hasDigit && hasAlpha;
-}
-
-// Database Functions
-int createAccount(const BankAccount *account) {
-    FILE *file = fopen(ACCOUNTS_DB, "ab");
-    if (file == NULL) return 0;
+    long recordCount = trimAccountPadding();
+    if (recordCount < 0) return 0;
     
-    int result = fwrite(account, sizeof(BankAccount), 1, file);
-    fclose(file);
-    return result == 1;
-}
-
-int findAccountByNumber(int accountNumber, BankAccount *result) {
-    FILE *file = fopen(ACCOUNTS_DB, "rb");
+    file = openFile(TRANSACTIONS_DB, "ab");
     if (file == NULL) return 0;
+    fclose(file);
     
-    BankAccount account;
-    int found = 0;
+    if (!openDescriptionTable()) return 0;
+    if (!prepareTransactionLog()) {
+        closeDescriptionTable();
+        return 0;
+    }
     
-    while (fread(&account, sizeof(BankAccount), 1, file)) {
-        if (account.accountNumber == accountNumber) {
-            *result = account;
-            found = 1;
-            break;
+    // While other processes are running the marker is theirs, not a sign of a crash
+    int needsRecovery = firstProcess && access(RECOVERY_MARKER, F_OK) == 0;
+    long transactionCount = needsRecovery ? repairTransactionLog() : -1;
+    if (!needsRecovery) {
+        file = openFile(TRANSACTIONS_DB, "rb");
+        if (file == NULL) {
+            closeDescriptionTable();
+            return 0;
         }
+        fseek(file, 0, SEEK_END);
+        transactionCount = logRecordCount(ftell(file));
+        fclose(file);
+    }
+    if (transactionCount < 0) {
+        closeDescriptionTable();
+        return 0;
     }
     
-    fclose(file);
-    return found;
-}
-
-int updateAccountBalance(int accountNumber, long newBalanceCents) {
-    FILE *file = fopen(ACCOUNTS_DB, "rb+");
-    if (file == NULL) return 0;
+    // Rebuild the indexes if they are missing, corrupt or out of date
+    if (!indexIsCurrent(ACCOUNTS_INDEX, recordCount) && !rebuildAccountIndex()) {
+        closeDescriptionTable();
+        return 0;
+    }
     
-    BankAccount account;
-    long position;
-    int found = 0;
+    long linkCount = -1;
+    file = openFile(TRANSACTIONS_CHAIN, "rb");
+    if (file != NULL) {
+        fseek(file, 0, SEEK_END);
+        linkCount = ftell(file) / sizeof(TransactionLink);
+        fclose(file);
+    }
     
-    while (fread(&account, sizeof(BankAccount), 1, file)) {
-        position = ftell(file) - sizeof(BankAccount);
-        
-        if (account.accountNumber == accountNumber) {
-            account.balance = newBalanceCents;
-            fseek(file, position, SEEK_SET);
-            int writeResult = fwrite(&account, sizeof(BankAccount), 1, file);
-            found = (writeResult == 1);
-            break;
+    // After a crash only the records past the indexed part need linking
+    long linkedCount = transactionCount;
+    if (linkCount != transactionCount || !indexIsCurrent(TRANSACTIONS_HEADS, transactionCount)) {
+        linkedCount = needsRecovery ? trimTransactionIndex(transactionCount) : -1;
+        if (linkedCount < 0) {
+            if (!rebuildTransactionIndex()) {
+                closeDescriptionTable();
+                return 0;
+            }
+            linkedCount = transactionCount;
         }
     }
     
-    fclose(file);
-    return found;
+    if (useMappedStorage && (!mapAccountStore(recordCount) || !mapAccountIndex())) {
+        closeDatabase();
+        return 0;
+    }
+    if (!useMappedStorage && !initAccountCache(accountCacheSize)) {
+        closeDatabase();
+        return 0;
+    }
+    if (useDirectIndex && !openDirectIndex(recordCount)) {
+        closeDatabase();
+        return 0;
+    }
+    
+    if (!openTransactionLog(transactionCount, linkedCount)) {
+        closeDatabase();
+        return 0;
+    }
+    if (!loadTimeIndex(transactionCount)) {
+        printf("⚠️  Could not build the time index; date queries will scan the whole log.\n");
+    }
+    if (!loadRollups(transactionCount)) {
+        printf("⚠️  Could not build the daily and monthly totals; they are unavailable this session.\n");
+    }
+    if (!loadVelocity(transactionCount)) {
+        printf("⚠️  Could not rebuild the velocity limit counters; the limits are off this session.\n");
+    }
+    if (linkedCount < transactionCount) {
+        printf("🔧 Indexing %ld transaction(s) written since the last checkpoint...\n",
+               transactionCount - linkedCount);
+        if (!linkDeferredTransactions()) {
+            closeDatabase();
+            return 0;
+        }
+    }
+    
+    CheckpointHeader checkpoint;
+    if (loadCheckpoint(&checkpoint, NULL)) checkpointPosition = checkpoint.logPosition;
+    
+    // The previous session did not shut down cleanly
+    if (needsRecovery) {
+        long repaired = replayLogTail();
+        if (repaired == -2) {
+            printf("⚠️  No usable checkpoint; checking every account against the log...\n");
+            repaired = reconcileAccountsWithLog();
+        }
+        if (repaired < 0) {
+            closeDatabase();
+            return 0;
+        }
+        if (repaired > 0) {
+            printf("⚠️  Recovered %ld account(s) from the transaction log.\n", repaired);
+        }
+        
+        // Start the new session from a known good point
+        if (!writeCheckpoint()) {
+            closeDatabase();
+            return 0;
+        }
+    } else if (sharedLocks.fd >= 0 && checkpointPosition < 0 && !writeCheckpoint()) {
+        // The last process to leave replays from here
+        closeDatabase();
+        return 0;
+    }
+    
+    file = openFile(RECOVERY_MARKER, "w");
+    if (file == NULL) {
+        closeDatabase();
+        return 0;
+    }
+    fclose(file);
+    databaseOpen = 1;
+    
+    if (sharedLocks.fd >= 0) {
+        writeProcessCount(firstProcess ? 1 : readProcessCount() + 1);
+        if (firstProcess) {
+            lockByte(LOCK_SESSION_BYTE, F_RDLCK, 0);
+        } else {
+            unlockSharedStore(1);
+        }
+    }
+    return 1;
+}
+
+void closeDatabase() {
+    int logSynced = linkDeferredTransactions() && syncTransactionLog();
+    if (!flushAccountCache(0)) {
+        printf("⚠️  Some cached account changes could not be written; they will be recovered from the log.\n");
+        logSynced = 0;
+    }
+    
+    // With --shared, if a process died mid-operation, the last one to
+    // leave repairs what it left behind, as recovery would at the next start
+    int lastProcess = 1;
+    int shared = databaseOpen && sharedLocks.fd >= 0;
+    if (shared) {
+        lockAccountStore(1);
+        long processes = readProcessCount();
+        lastProcess = lockByte(LOCK_SESSION_BYTE, F_WRLCK, 0);
+        writeProcessCount(lastProcess ? 0 : processes - 1);
+        
+        long repaired = lastProcess && processes > 1 && logSynced ? replayLogTail() : 0;
+        if (repaired == -2) repaired = reconcileAccountsWithLog();
+        if (repaired > 0) printf("⚠️  Recovered %ld account(s) from the transaction log.\n", repaired);
+        if (repaired < 0) logSynced = 0;
+    }
+    
+    // The next recovery, if one is ever needed, can start from here
+    if (databaseOpen && logSynced && !writeCheckpoint()) {
+        printf("⚠️  Could not write a checkpoint of the account balances.\n");
+    }
+    if (shared) unlockAccountStore(1);
+    freeAccountCache();
+    closeTransactionLog();
+    freeTimeIndex();
+    freeRollups();
+    freeVelocity();
+    closeDescriptionTable();
+    closeDirectIndex();
+    unmapAccountIndex();
+    unmapAccountStore();
+    
+    // Only a fully synced shutdown lets the next start skip recovery
+    if (databaseOpen && logSynced && lastProcess) remove(RECOVERY_MARKER);
+    closeSharedLocks();
+    databaseOpen = 0;
+}
+
+// Instrumentation Functions
+
+void enableMetrics() {
+    metricsEnabled = 1;
+    clock_gettime(CLOCK_MONOTONIC, &metricsStart);
+}
+
+// Operations are timed between these two calls; with metrics off neither
+// reads the clock
+void startMetric(struct timespec *start) {
+    if (metricsEnabled) clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+void stopMetric(int metric, const struct timespec *start) {
+    if (metricsEnabled) recordLatency(metric, nanosSince(start));
+}
+
+// Values below HISTOGRAM_SUB_BUCKETS get a bucket each; above that, each
+// power of two is split into HISTOGRAM_SUB_BUCKETS equal buckets
+int histogramBucket(long nanos) {
+    if (nanos < HISTOGRAM_SUB_BUCKETS) return nanos > 0 ? (int)nanos : 0;
+    int exponent = 63 - __builtin_clzl((unsigned long)nanos);
+    long mantissa = nanos >> (exponent - HISTOGRAM_SUB_BITS);
+    return (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + (int)(mantissa - HISTOGRAM_SUB_BUCKETS);
+}
+
+// Highest value that falls into a bucket
+long histogramBucketLimit(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) return bucket;
+    int shift = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+    long mantissa = HISTOGRAM_SUB_BUCKETS + bucket % HISTOGRAM_SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void recordLatency(int metric, long nanos) {
+    LatencyHistogram *histogram = &latencyHistograms[metric];
+    atomic_fetch_add_explicit(&histogram->buckets[histogramBucket(nanos)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->totalNanos, nanos, memory_order_relaxed);
+    
+    long max = atomic_load_explicit(&histogram->maxNanos, memory_order_relaxed);
+    while (nanos > max &&
+           !atomic_compare_exchange_weak_explicit(&histogram->maxNanos, &max, nanos,
+                                                 memory_order_relaxed, memory_order_relaxed)) {}
+}
+
+void countIo(int counter, long amount) {
+    if (metricsEnabled) atomic_fetch_add_explicit(&ioCounters[counter], amount, memory_order_relaxed);
+}
+
+// Dumps every counter and histogram, one line each, so the output can be
+// read by people and by scripts alike
+void writeMetrics(FILE *output) {
+    char timestamp[32];
+    time_t now = time(NULL);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    fprintf(output, "# metrics at %s, %.1f s after start\n", timestamp, nanosSince(&metricsStart) / 1e9);
+    
+    for (int counter = 0; counter < IO_COUNTERS; counter++) {
+        fprintf(output, "counter %s %ld\n", ioCounterNames[counter], atomic_load(&ioCounters[counter]));
+    }
+    
+    const double percentiles[] = { 0.50, 0.90, 0.99, 0.999 };
+    for (int metric = 0; metric < METRIC_OPERATIONS; metric++) {
+        LatencyHistogram *histogram = &latencyHistograms[metric];
+        long buckets[HISTOGRAM_BUCKETS];
+        long count = 0;
+        for (int bucket = 0; bucket < HISTOGRAM_BUCKETS; bucket++) {
+            buckets[bucket] = atomic_load_explicit(&histogram->buckets[bucket], memory_order_relaxed);
+            count += buckets[bucket];
+        }
+        
+        // Each percentile is the upper limit of the bucket that reaches it
+        double values[4] = { 0, 0, 0, 0 };
+        long seen = 0;
+        int next = 0;
+        for (int bucket = 0; bucket < HISTOGRAM_BUCKETS && next < 4 && count > 0; bucket++) {
+            seen += buckets[bucket];
+            while (next < 4 && seen >= (long)(percentiles[next] * count + 0.5)) {
+                values[next++] = histogramBucketLimit(bucket) / 1e3;
+            }
+        }
+        fprintf(output, "latency %s count=%ld mean_us=%.2f p50_us=%.2f p90_us=%.2f p99_us=%.2f "
+                "p999_us=%.2f max_us=%.2f\n", metricNames[metric], count,
+                count > 0 ? atomic_load(&histogram->totalNanos) / 1e3 / count : 0.0,
+                values[0], values[1], values[2], values[3], atomic_load(&histogram->maxNanos) / 1e3);
+    }
+}
+
+// Replaces the metrics file in one rename, so readers never see half of it
+int writeMetricsFile(const char *path) {
+    char tempPath[4200];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", path);
+    
+    FILE *file = fopen(tempPath, "w");
+    if (file == NULL) return 0;
+    writeMetrics(file);
+    int success = fclose(file) == 0 && rename(tempPath, path) == 0;
+    if (!success) remove(tempPath);
+    return success;
+}
+
+void *metricsFileWriter(void *arg) {
+    (void)arg;
+    struct timespec deadline, now;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += metricsWriter.intervalSeconds;
+    
+    pthread_mutex_lock(&metricsWriter.lock);
+    while (metricsWriter.running) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        if (now.tv_sec < deadline.tv_sec ||
+            (now.tv_sec == deadline.tv_sec && now.tv_nsec < deadline.tv_nsec)) {
+            pthread_cond_timedwait(&metricsWriter.wake, &metricsWriter.lock, &deadline);
+            continue;
+        }
+        pthread_mutex_unlock(&metricsWriter.lock);
+        if (!writeMetricsFile(metricsWriter.path)) {
+            fprintf(stderr, "⚠️  Could not write the metrics file %s\n", metricsWriter.path);
+        }
+        pthread_mutex_lock(&metricsWriter.lock);
+        deadline.tv_sec += metricsWriter.intervalSeconds;
+    }
+    pthread_mutex_unlock(&metricsWriter.lock);
+    return NULL;
+}
+
+// Starts rewriting path every intervalSeconds. A relative path is resolved
+// now, since the scratch-database modes change directory.
+int startMetricsWriter(const char *path, int intervalSeconds) {
+    char directory[2048];
+    if (path[0] == '/') {
+        snprintf(metricsWriter.path, sizeof(metricsWriter.path), "%s", path);
+    } else if (getcwd(directory, sizeof(directory)) != NULL) {
+        snprintf(metricsWriter.path, sizeof(metricsWriter.path), "%s/%s", directory, path);
+    } else {
+        return 0;
+    }
+    metricsWriter.intervalSeconds = intervalSeconds;
+    if (!writeMetricsFile(metricsWriter.path)) return 0;
+    
+    metricsWriter.running = 1;
+    if (pthread_create(&metricsWriter.thread, NULL, metricsFileWriter, NULL) != 0) {
+        metricsWriter.running = 0;
+        return 0;
+    }
+    return 1;
+}
+
+// Stops the writer and leaves the final numbers in the file
+void stopMetricsWriter() {
+    pthread_mutex_lock(&metricsWriter.lock);
+    int running = metricsWriter.running;
+    metricsWriter.running = 0;
+    pthread_cond_signal(&metricsWriter.wake);
+    pthread_mutex_unlock(&metricsWriter.lock);
+    
+    if (!running) return;
+    pthread_join(metricsWriter.thread, NULL);
+    writeMetricsFile(metricsWriter.path);
+}
+
+void showMetrics() {
+    printHeader("PERFORMANCE METRICS");
+    if (metricsEnabled) {
+        writeMetrics(stdout);
+    } else {
+        printf("Metrics are off. Start the program with --metrics or --metrics-file FILE.\n");
+    }
+    printf("============================================\n");
+}
+
+// I/O wrappers for the database files. They keep the I/O counters and,
+// with metrics off, cost one branch on top of the call they wrap.
+FILE *openFile(const char *path, const char *mode) {
+    FILE *file = fopen(path, mode);
+    if (file != NULL) countIo(IO_FILE_OPENS, 1);
+    return file;
+}
+
+int openDescriptor(const char *path, int flags, mode_t mode) {
+    int fd = open(path, flags, mode);
+    if (fd >= 0) countIo(IO_FILE_OPENS, 1);
+    return fd;
+}
+
+size_t readRecords(void *buffer, size_t size, size_t count, FILE *file) {
+    size_t records = fread(buffer, size, count, file);
+    if (metricsEnabled) {
+        countIo(IO_READ_CALLS, 1);
+        countIo(IO_RECORDS_READ, records);
+        countIo(IO_BYTES_READ, records * size);
+    }
+    return records;
+}
+
+size_t writeRecords(const void *buffer, size_t size, size_t count, FILE *file) {
+    size_t records = fwrite(buffer, size, count, file);
+    if (metricsEnabled) {
+        countIo(IO_WRITE_CALLS, 1);
+        countIo(IO_RECORDS_WRITTEN, records);
+        countIo(IO_BYTES_WRITTEN, records * size);
+    }
+    return records;
+}
+
+// Positioned reads and writes fetch whole blocks as often as single
+// records, so they count calls and bytes only
+ssize_t readAt(int fd, void *buffer, size_t length, off_t offset) {
+    ssize_t result = pread(fd, buffer, length, offset);
+    if (metricsEnabled) {
+        countIo(IO_READ_CALLS, 1);
+        if (result > 0) countIo(IO_BYTES_READ, result);
+    }
+    return result;
+}
+
+ssize_t writeAt(int fd, const void *buffer, size_t length, off_t offset) {
+    ssize_t result = pwrite(fd, buffer, length, offset);
+    if (metricsEnabled) {
+        countIo(IO_WRITE_CALLS, 1);
+        if (result > 0) countIo(IO_BYTES_WRITTEN, result);
+    }
+    return result;
+}
+
+int syncDescriptor(int fd) {
+    countIo(IO_SYNCS, 1);
+#ifdef __APPLE__
+    // macOS has no fdatasync; fsync also writes the file's metadata
+    return fsync(fd);
+#else
+    return fdatasync(fd);
+#endif
+}
+
+int syncMapping(void *address, size_t length) {
+    countIo(IO_SYNCS, 1);
+    return msync(address, length, MS_SYNC);
+}
+
+// Security Functions (Android compatible)
+void generateSalt(char* salt, int length) {
+    const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789./";
+    for (int i = 0; i < length; i++) {
+        salt[i] = chars[rand() % (sizeof(chars) - 1)];
+    }
+    salt[length] = '\0';
+}
+
+// The same from a caller's own seed, so import threads do not share rand()
+void generateSaltSeeded(char *salt, int length, unsigned int *seed) {
+    const char chars[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789./";
+    for (int i = 0; i < length; i++) {
+        salt[i] = chars[rand_r(seed) % (sizeof(chars) - 1)];
+    }
+    salt[length] = '\0';
+}
+
+void hashPassword(const char* plain, const char* salt, char* hashed) {
+    struct timespec start;
+    startMetric(&start);
+    char salted[256];
+    snprintf(salted, sizeof(salted), "%s%s", plain, salt);
+    simple_sha256(salted, hashed);
+    stopMetric(METRIC_HASH_PASSWORD, &start);
+}
+
+// Input Handling Functions
+void safeInputString(char* buffer, int size, const char* prompt) {
+    printf("%s", prompt);
+    memset(buffer, 0, size);
+    if (fgets(buffer, size, stdin) != NULL) {
+        buffer[strcspn(buffer, "\n")] = 0;
+    } else {
+        buffer[0] = 0;
+        clearInputBuffer();
+    }
+}
+
+int getIntegerInput(const char* prompt) {
+    char buffer[100];
+    int value;
+    
+    while (1) {
+        safeInputString(buffer, sizeof(buffer), prompt);
+        if (sscanf(buffer, "%d", &value) == 1) {
+            return value;
+        }
+        printf("Invalid input! Please enter a valid number.\n");
+    }
+}
+
+float getFloatInput(const char* prompt) {
+    char buffer[100];
+    float value;
+    
+    while (1) {
+        safeInputString(buffer, sizeof(buffer), prompt);
+        if (sscanf(buffer, "%f", &value) == 1) {
+            return value;
+        }
+        printf("Invalid input! Please enter a valid number.\n");
+    }
+}
+
+int validateEnhancedPassword(const char *password) {
+    int len = strlen(password);
+    if (len < 8) return 0;
+    
+    int hasDigit = 0, hasAlpha = 0;
+    for (int i = 0; i < len; i++) {
+        if (isdigit(password[i])) hasDigit = 1;
+        if (isalpha(password[i])) hasAlpha = 1;
+    }
+    return hasDigit && hasAlpha;
+}
+
+// Account shard functions
+
+// Reads accounts.shards; without it the store is the single accounts.db
+int loadShardMap() {
+    ShardMap map = { SHARD_MAP_MAGIC, SHARD_MAP_VERSION, 0, 1, { 0 } };
+    FILE *file = openFile(ACCOUNTS_SHARD_MAP, "rb");
+    if (file == NULL) {
+        shardMap = map;
+        return 1;
+    }
+    
+    int valid = readRecords(&map, sizeof(ShardMap), 1, file) == 1 &&
+                map.magic == SHARD_MAP_MAGIC && map.version == SHARD_MAP_VERSION &&
+                map.shardCount >= 1 && map.shardCount <= MAX_SHARDS;
+    fclose(file);
+    for (int shard = 2; valid && shard < map.shardCount; shard++) {
+        valid = map.firstAccount[shard] > map.firstAccount[shard - 1];
+    }
+    if (!valid) {
+        printf("❌ %s is damaged; the account shards cannot be found.\n", ACCOUNTS_SHARD_MAP);
+        return 0;
+    }
+    shardMap = map;
+    return 1;
+}
+
+int shardOfAccount(const ShardMap *map, int accountNumber) {
+    int low = 0, high = map->shardCount - 1;
+    while (low < high) {
+        int middle = (low + high + 1) / 2;
+        if (accountNumber >= map->firstAccount[middle]) low = middle;
+        else high = middle - 1;
+    }
+    return low;
+}
+
+void shardFilePath(const ShardMap *map, int shard, char *path, size_t size) {
+    if (map->shardCount == 1) snprintf(path, size, "%s", ACCOUNTS_DB);
+    else snprintf(path, size, ACCOUNTS_SHARD_FILE, map->generation, shard);
+}
+
+long shardRecord(int shard, long record) {
+    return ((long)shard << SHARD_RECORD_BITS) | record;
+}
+
+int recordShard(long recordNumber) {
+    return (int)(recordNumber >> SHARD_RECORD_BITS);
+}
+
+long recordInShard(long recordNumber) {
+    return recordNumber & ((1L << SHARD_RECORD_BITS) - 1);
+}
+
+FILE *openShardFile(int shard, const char *mode) {
+    char path[64];
+    shardFilePath(&shardMap, shard, path, sizeof(path));
+    return openFile(path, mode);
+}
+
+long shardRecordCount(int shard) {
+    char path[64];
+    struct stat info;
+    shardFilePath(&shardMap, shard, path, sizeof(path));
+    return stat(path, &info) == 0 ? info.st_size / (long)sizeof(BankAccount) : -1;
+}
+
+// Records in the whole store; accounts.idx and accounts.dir are current for this count
+long storeRecordCount() {
+    long total = 0;
+    for (int shard = 0; shard < shardMap.shardCount; shard++) {
+        long count = shardRecordCount(shard);
+        if (count < 0) return -1;
+        total += count;
+    }
+    return total;
+}
+
+int syncAccountStore() {
+    int success = 1;
+    for (int shard = 0; shard < shardMap.shardCount; shard++) {
+        char path[64];
+        shardFilePath(&shardMap, shard, path, sizeof(path));
+        int fd = openDescriptor(path, O_RDONLY, 0);
+        success = fd >= 0 && syncDescriptor(fd) == 0 && success;
+        if (fd >= 0) close(fd);
+    }
+    return success;
+}
+
+// Store scans visit every record of every shard in shard order
+int openStoreScan(StoreScan *scan, const char *mode) {
+    scan->mode = mode;
+    scan->shard = 0;
+    scan->nextRecord = 0;
+    scan->failed = 0;
+    scan->file = openShardFile(0, mode);
+    if (scan->file == NULL) return 0;
+    setvbuf(scan->file, NULL, _IOFBF, 1 << 20);
+    return 1;
+}
+
+int nextStoreRecord(StoreScan *scan, BankAccount *account, long *recordNumber) {
+    while (scan->file != NULL) {
+        if (readRecords(account, sizeof(BankAccount), 1, scan->file) == 1) {
+            *recordNumber = shardRecord(scan->shard, scan->nextRecord++);
+            return 1;
+        }
+        
+        fclose(scan->file);
+        scan->file = NULL;
+        if (++scan->shard == shardMap.shardCount) break;
+        scan->nextRecord = 0;
+        scan->file = openShardFile(scan->shard, scan->mode);
+        if (scan->file == NULL) scan->failed = 1;
+        else setvbuf(scan->file, NULL, _IOFBF, 1 << 20);
+    }
+    return 0;
+}
+
+// Replaces the record nextStoreRecord just returned
+int rewriteStoreRecord(StoreScan *scan, const BankAccount *account) {
+    long position = (scan->nextRecord - 1) * (long)sizeof(BankAccount);
+    int success = fseek(scan->file, position, SEEK_SET) == 0 &&
+                  writeRecords(account, sizeof(BankAccount), 1, scan->file) == 1 &&
+                  fseek(scan->file, 0, SEEK_CUR) == 0;
+    if (!success) scan->failed = 1;
+    return success;
+}
+
+// Returns 0 if any shard could not be opened, read or written back
+int closeStoreScan(StoreScan *scan) {
+    if (scan->file != NULL && fclose(scan->file) != 0) scan->failed = 1;
+    scan->file = NULL;
+    return !scan->failed;
+}
+
+void *shardTransferWorker(void *arg) {
+    ShardTransfer *transfer = arg;
+    char path[64];
+    shardFilePath(&shardMap, transfer->shard, path, sizeof(path));
+    int fd = openDescriptor(path, transfer->write ? O_WRONLY : O_RDONLY, 0);
+    transfer->failed = fd < 0;
+    
+    char *bytes = (char *)transfer->accounts;
+    size_t length = transfer->count * sizeof(BankAccount), done = 0;
+    while (!transfer->failed && done < length) {
+        size_t part = length - done < (1 << 26) ? length - done : (1 << 26);
+        ssize_t moved = transfer->write ? writeAt(fd, bytes + done, part, done)
+                                        : readAt(fd, bytes + done, part, done);
+        transfer->failed = moved <= 0;
+        if (moved > 0) done += moved;
+    }
+    if (fd >= 0) close(fd);
+    return NULL;
+}
+
+// Reads (or writes back) the whole store, one thread per shard;
+// starts[shard] is where each shard's records begin in accounts
+int transferAccountStore(BankAccount *accounts, const long *starts, int write) {
+    ShardTransfer transfers[MAX_SHARDS];
+    int started = 0, success = 1;
+    
+    for (int shard = 0; shard < shardMap.shardCount; shard++) {
+        ShardTransfer *transfer = &transfers[shard];
+        transfer->shard = shard;
+        transfer->write = write;
+        transfer->accounts = accounts + starts[shard];
+        transfer->count = starts[shard + 1] - starts[shard];
+        transfer->failed = 0;
+    }
+    if (shardMap.shardCount == 1) {
+        shardTransferWorker(&transfers[0]);
+        return !transfers[0].failed;
+    }
+    
+    for (int shard = 0; shard < shardMap.shardCount; shard++) {
+        if (pthread_create(&transfers[shard].thread, NULL, shardTransferWorker, &transfers[shard]) != 0) {
+            success = 0;
+            break;
+        }
+        started++;
+    }
+    for (int shard = 0; shard < started; shard++) {
+        pthread_join(transfers[shard].thread, NULL);
+        success = success && !transfers[shard].failed;
+    }
+    return success;
+}
+
+// Reads every account record into one array, in shard order; starts must
+// have room for shardCount + 1 offsets. Returns the record count, or -1.
+long loadAccountStore(BankAccount **accounts, long *starts) {
+    starts[0] = 0;
+    for (int shard = 0; shard < shardMap.shardCount; shard++) {
+        long count = shardRecordCount(shard);
+        if (count < 0) return -1;
+        starts[shard + 1] = starts[shard] + count;
+    }
+    
+    long total = starts[shardMap.shardCount];
+    *accounts = malloc((total > 0 ? total : 1) * sizeof(BankAccount));
+    if (*accounts == NULL) return -1;
+    if (!transferAccountStore(*accounts, starts, 0)) {
+        free(*accounts);
+        *accounts = NULL;
+        return -1;
+    }
+    return total;
+}
+
+// Database Functions
+int createAccount(const BankAccount *account) {
+    if (accountMap.records != NULL) {
+        if (accountMap.recordCount == accountMap.capacity && !growAccountStore()) return 0;
+        
+        long recordNumber = accountMap.recordCount;
+        accountMap.records[recordNumber] = *account;
+        accountMap.recordCount++;
+        syncMappedAccount(recordNumber);
+        
+        if (!insertAccountIndex(account->accountNumber, recordNumber, recordNumber + 1) && !rebuildAccountIndex()) {
+            return 0;
+        }
+        return mapAccountIndex() && updateDirectIndex(account->accountNumber, recordNumber, recordNumber + 1);
+    }
+    
+    int shard = shardOfAccount(&shardMap, account->accountNumber);
+    FILE *file = openShardFile(shard, "ab");
+    if (file == NULL) return 0;
+    
+    fseek(file, 0, SEEK_END);
+    long recordNumber = shardRecord(shard, ftell(file) / sizeof(BankAccount));
+    int result = writeRecords(account, sizeof(BankAccount), 1, file);
+    if (fclose(file) != 0) result = 0;
+    if (result != 1) return 0;
+    
+    long recordCount = shardMap.shardCount == 1 ? recordNumber + 1 : storeRecordCount();
+    
+    // A failed index update would hide the new account, so fall back to a full rebuild
+    return (insertAccountIndex(account->accountNumber, recordNumber, recordCount) || rebuildAccountIndex()) &&
+           updateDirectIndex(account->accountNumber, recordNumber, recordCount);
+}
+
+// Mapped account store functions
+
+// Drops empty records left at the end of accounts.db by an unclean shutdown
+// in mapped mode; a sharded store is never mapped and has none
+long trimAccountPadding() {
+    if (shardMap.shardCount > 1) return storeRecordCount();
+    
+    FILE *file = openFile(ACCOUNTS_DB, "rb");
+    if (file == NULL) return -1;
+    
+    fseek(file, 0, SEEK_END);
+    long fileRecords = ftell(file) / sizeof(BankAccount);
+    long recordCount = fileRecords;
+    BankAccount account;
+    
+    while (recordCount > 0) {
+        fseek(file, (recordCount - 1) * (long)sizeof(BankAccount), SEEK_SET);
+        if (readRecords(&account, sizeof(BankAccount), 1, file) != 1 || account.accountNumber != 0) break;
+        recordCount--;
+    }
+    fclose(file);
+    
+    if (recordCount != fileRecords && truncate(ACCOUNTS_DB, recordCount * (long)sizeof(BankAccount)) != 0) {
+        return -1;
+    }
+    return recordCount;
+}
+
+int mapAccountStore(long recordCount) {
+    accountMap.fd = openDescriptor(ACCOUNTS_DB, O_RDWR, 0);
+    if (accountMap.fd < 0) return 0;
+    
+    accountMap.recordCount = recordCount;
+    accountMap.capacity = (recordCount / ACCOUNT_MAP_CHUNK + 1) * ACCOUNT_MAP_CHUNK;
+    if (ftruncate(accountMap.fd, accountMap.capacity * (off_t)sizeof(BankAccount)) != 0) {
+        close(accountMap.fd);
+        accountMap.fd = -1;
+        return 0;
+    }
+    
+    void *base = mmap(NULL, accountMap.capacity * sizeof(BankAccount),
+                      PROT_READ | PROT_WRITE, MAP_SHARED, accountMap.fd, 0);
+    if (base == MAP_FAILED) {
+        close(accountMap.fd);
+        accountMap.fd = -1;
+        return 0;
+    }
+    accountMap.records = base;
+    return 1;
+}
+
+// Extends the file by one chunk and maps it again at the new size
+int growAccountStore() {
+    long capacity = accountMap.capacity + ACCOUNT_MAP_CHUNK;
+    if (ftruncate(accountMap.fd, capacity * (off_t)sizeof(BankAccount)) != 0) return 0;
+    
+    void *base = mmap(NULL, capacity * sizeof(BankAccount),
+                      PROT_READ | PROT_WRITE, MAP_SHARED, accountMap.fd, 0);
+    if (base == MAP_FAILED) return 0;
+    
+    munmap(accountMap.records, accountMap.capacity * sizeof(BankAccount));
+    accountMap.records = base;
+    accountMap.capacity = capacity;
+    return 1;
+}
+
+void unmapAccountStore() {
+    if (accountMap.records == NULL) return;
+    
+    syncMapping(accountMap.records, accountMap.capacity * sizeof(BankAccount));
+    munmap(accountMap.records, accountMap.capacity * sizeof(BankAccount));
+    if (ftruncate(accountMap.fd, accountMap.recordCount * (off_t)sizeof(BankAccount)) != 0) {
+        printf("⚠️  Could not trim accounts.db; it will be trimmed on next start.\n");
+    }
+    close(accountMap.fd);
+    
+    accountMap.fd = -1;
+    accountMap.records = NULL;
+    accountMap.recordCount = 0;
+    accountMap.capacity = 0;
+}
+
+// Commit point for a changed record: schedule write-back of the pages it spans
+void syncMappedAccount(long recordNumber) {
+    if (accountMap.deferSync) return;
+    
+    long pageSize = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)&accountMap.records[recordNumber];
+    uintptr_t end = start + sizeof(BankAccount);
+    start -= start % pageSize;
+    msync((void *)start, end - start, MS_ASYNC);
+}
+
+BankAccount *mappedAccount(int accountNumber, long *recordNumber) {
+    if (!locateAccount(accountNumber, recordNumber)) return NULL;
+    if (*recordNumber < 0 || *recordNumber >= accountMap.recordCount) return NULL;
+    
+    BankAccount *account = &accountMap.records[*recordNumber];
+    return account->accountNumber == accountNumber ? account : NULL;
+}
+
+// (Re)maps accounts.idx so lookups need no file I/O; called again whenever the index changes size
+int mapAccountIndex() {
+    unmapAccountIndex();
+    
+    accountIndexMap.fd = openDescriptor(ACCOUNTS_INDEX, O_RDONLY, 0);
+    if (accountIndexMap.fd < 0) return 0;
+    
+    struct stat info;
+    if (fstat(accountIndexMap.fd, &info) != 0 || info.st_size < (off_t)sizeof(IndexHeader)) {
+        unmapAccountIndex();
+        return 0;
+    }
+    
+    void *base = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, accountIndexMap.fd, 0);
+    if (base == MAP_FAILED) {
+        unmapAccountIndex();
+        return 0;
+    }
+    
+    const IndexHeader *header = base;
+    accountIndexMap.base = base;
+    accountIndexMap.length = info.st_size;
+    accountIndexMap.bucketCount = header->bucketCount;
+    if (header->magic != INDEX_MAGIC ||
+        sizeof(IndexHeader) + header->bucketCount * sizeof(IndexSlot) > (size_t)info.st_size) {
+        unmapAccountIndex();
+        return 0;
+    }
+    return 1;
+}
+
+void unmapAccountIndex() {
+    if (accountIndexMap.base != NULL) munmap(accountIndexMap.base, accountIndexMap.length);
+    if (accountIndexMap.fd >= 0) close(accountIndexMap.fd);
+    
+    accountIndexMap.fd = -1;
+    accountIndexMap.base = NULL;
+    accountIndexMap.length = 0;
+    accountIndexMap.bucketCount = 0;
+}
+
+// Hash index functions (shared by accounts.idx and transactions.heads)
+long indexBucket(int key, long bucketCount) {
+    return (long)(((uint32_t)key * 2654435761u) & (uint32_t)(bucketCount - 1));
+}
+
+// Keep tables at most half full so probe chains stay short
+long indexBucketCount(long entries, long minBuckets) {
+    long bucketCount = INDEX_MIN_BUCKETS;
+    while (bucketCount < entries * 2 || bucketCount < minBuckets) {
+        bucketCount *= 2;
+    }
+    return bucketCount;
+}
+
+void indexPut(IndexSlot *slots, long bucketCount, const IndexSlot *entry, long *entryCount) {
+    long bucket = indexBucket(entry->key, bucketCount);
+    while (slots[bucket].key != 0 && slots[bucket].key != entry->key) {
+        bucket = (bucket + 1) & (bucketCount - 1);
+    }
+    if (slots[bucket].key == 0) (*entryCount)++;
+    slots[bucket] = *entry;
+}
+
+const IndexSlot *indexFind(const IndexSlot *slots, long bucketCount, int key) {
+    long bucket = indexBucket(key, bucketCount);
+    for (long probes = 0; probes < bucketCount && slots[bucket].key != 0; probes++) {
+        if (slots[bucket].key == key) return &slots[bucket];
+        bucket = (bucket + 1) & (bucketCount - 1);
+    }
+    return NULL;
+}
+
+// Inserts into an in-memory table, doubling it first if it would be more than half full
+int indexAdd(IndexSlot **slots, long *bucketCount, long *entryCount, int key, long value) {
+    if ((*entryCount + 1) * 2 > *bucketCount && !growIndexSlots(slots, bucketCount)) return 0;
+    
+    IndexSlot entry = { key, value, 0 };
+    indexPut(*slots, *bucketCount, &entry, entryCount);
+    return 1;
+}
+
+int writeIndexFile(const char *path, const IndexSlot *slots, long bucketCount,
+                   long entryCount, long recordCount) {
+    IndexHeader header;
+    header.magic = INDEX_MAGIC;
+    header.version = INDEX_VERSION;
+    header.bucketCount = bucketCount;
+    header.entryCount = entryCount;
+    header.recordCount = recordCount;
+    
+    FILE *file = openFile(path, "wb");
+    if (file == NULL) return 0;
+    
+    int success = writeRecords(&header, sizeof(IndexHeader), 1, file) == 1 &&
+                  writeRecords(slots, sizeof(IndexSlot), bucketCount, file) == (size_t)bucketCount;
+    return (fclose(file) == 0) && success;
+}
+
+// Doubles an in-memory table, rehashing every entry; on failure the old
+// table is left as it was
+int growIndexSlots(IndexSlot **slots, long *bucketCount) {
+    IndexSlot *grown = calloc(*bucketCount * 2, sizeof(IndexSlot));
+    if (grown == NULL) return 0;
+    
+    long rehashed = 0;
+    for (long i = 0; i < *bucketCount; i++) {
+        if ((*slots)[i].key != 0) indexPut(grown, *bucketCount * 2, &(*slots)[i], &rehashed);
+    }
+    free(*slots);
+    *slots = grown;
+    *bucketCount *= 2;
+    return 1;
+}
+
+int readIndexHeader(FILE *file, IndexHeader *header) {
+    fseek(file, 0, SEEK_SET);
+    return readRecords(header, sizeof(IndexHeader), 1, file) == 1 &&
+           header->magic == INDEX_MAGIC &&
+           header->version == INDEX_VERSION;
+}
+
+// An index is usable only if it was last written for the current record count
+int indexIsCurrent(const char *path, long recordCount) {
+    FILE *file = openFile(path, "rb");
+    if (file == NULL) return 0;
+    
+    IndexHeader header;
+    int current = readIndexHeader(file, &header) && header.recordCount == recordCount;
+    fclose(file);
+    return current;
+}
+
+int indexLookup(const char *path, int key, IndexSlot *result) {
+    if (key == 0) return 0;
+    
+    FILE *file = openFile(path, "rb");
+    if (file == NULL) return 0;
+    
+    IndexHeader header;
+    if (!readIndexHeader(file, &header)) {
+        fclose(file);
+        return 0;
+    }
+    
+    IndexSlot slot;
+    int found = 0;
+    long bucket = indexBucket(key, header.bucketCount);
+    for (long probes = 0; probes < header.bucketCount; probes++) {
+        fseek(file, sizeof(IndexHeader) + bucket * sizeof(IndexSlot), SEEK_SET);
+        if (readRecords(&slot, sizeof(IndexSlot), 1, file) != 1 || slot.key == 0) break;
+        if (slot.key == key) {
+            *result = slot;
+            found = 1;
+            break;
+        }
+        bucket = (bucket + 1) & (header.bucketCount - 1);
+    }
+    
+    fclose(file);
+    return found;
+}
+
+// Rehashes an existing index into a table twice its size
+int growIndex(const char *path, FILE *file, const IndexHeader *header) {
+    long bucketCount = header->bucketCount * 2;
+    IndexSlot *slots = calloc(bucketCount, sizeof(IndexSlot));
+    if (slots == NULL) return 0;
+    
+    IndexSlot slot;
+    long entryCount = 0;
+    fseek(file, sizeof(IndexHeader), SEEK_SET);
+    for (long i = 0; i < header->bucketCount; i++) {
+        if (readRecords(&slot, sizeof(IndexSlot), 1, file) != 1) {
+            free(slots);
+            return 0;
+        }
+        if (slot.key != 0) indexPut(slots, bucketCount, &slot, &entryCount);
+    }
+    
+    int success = writeIndexFile(path, slots, bucketCount, entryCount, header->recordCount);
+    free(slots);
+    return success;
+}
+
+// Inserts or replaces one entry and records that the index covers recordCount records
+int indexUpsert(const char *path, const IndexSlot *entry, long recordCount) {
+    FILE *file = openFile(path, "rb+");
+    if (file == NULL) return 0;
+    
+    IndexHeader header;
+    if (!readIndexHeader(file, &header)) {
+        fclose(file);
+        return 0;
+    }
+    
+    if ((header.entryCount + 1) * 2 > header.bucketCount) {
+        int grown = growIndex(path, file, &header);
+        fclose(file);
+        return grown && indexUpsert(path, entry, recordCount);
+    }
+    
+    IndexSlot slot;
+    long bucket = indexBucket(entry->key, header.bucketCount);
+    while (1) {
+        fseek(file, sizeof(IndexHeader) + bucket * sizeof(IndexSlot), SEEK_SET);
+        if (readRecords(&slot, sizeof(IndexSlot), 1, file) != 1) {
+            fclose(file);
+            return 0;
+        }
+        if (slot.key == 0 || slot.key == entry->key) break;
+        bucket = (bucket + 1) & (header.bucketCount - 1);
+    }
+    
+    if (slot.key == 0) header.entryCount++;
+    if (recordCount > header.recordCount) header.recordCount = recordCount;
+    
+    fseek(file, sizeof(IndexHeader) + bucket * sizeof(IndexSlot), SEEK_SET);
+    int success = writeRecords(entry, sizeof(IndexSlot), 1, file) == 1;
+    fseek(file, 0, SEEK_SET);
+    success = writeRecords(&header, sizeof(IndexHeader), 1, file) == 1 && success;
+    return (fclose(file) == 0) && success;
+}
+
+// Account index functions
+int rebuildAccountIndex() {
+    long recordCount = storeRecordCount();
+    StoreScan scan;
+    if (recordCount < 0 || !openStoreScan(&scan, "rb")) return 0;
+    
+    long archiveCount = 0;
+    FILE *archive = openFile(ACCOUNTS_ARCHIVE, "rb");
+    if (archive != NULL) {
+        fseek(archive, 0, SEEK_END);
+        archiveCount = ftell(archive) / sizeof(BankAccount);
+        fseek(archive, 0, SEEK_SET);
+    }
+    
+    long bucketCount = indexBucketCount(recordCount + archiveCount, 0);
+    IndexSlot *slots = calloc(bucketCount, sizeof(IndexSlot));
+    if (slots == NULL) {
+        if (archive != NULL) fclose(archive);
+        closeStoreScan(&scan);
+        return 0;
+    }
+    
+    BankAccount account;
+    IndexSlot entry;
+    long entryCount = 0, record;
+    
+    // Archived accounts go in first, so a copy still in the store (left
+    // by an interrupted compaction) takes precedence
+    for (record = 0; archive != NULL && readRecords(&account, sizeof(BankAccount), 1, archive); record++) {
+        if (account.accountNumber == 0) continue;
+        entry.key = account.accountNumber;
+        entry.value = -(record + 1);
+        entry.aux = 0;
+        indexPut(slots, bucketCount, &entry, &entryCount);
+    }
+    if (archive != NULL) fclose(archive);
+    
+    while (nextStoreRecord(&scan, &account, &record)) {
+        if (account.accountNumber == 0) continue;
+        entry.key = account.accountNumber;
+        entry.value = record;
+        entry.aux = 0;
+        indexPut(slots, bucketCount, &entry, &entryCount);
+    }
+    
+    int success = closeStoreScan(&scan) &&
+                  writeIndexFile(ACCOUNTS_INDEX, slots, bucketCount, entryCount, recordCount);
+    free(slots);
+    return success;
+}
+
+int insertAccountIndex(int accountNumber, long recordNumber, long recordCount) {
+    IndexSlot entry;
+    entry.key = accountNumber;
+    entry.value = recordNumber;
+    entry.aux = 0;
+    return indexUpsert(ACCOUNTS_INDEX, &entry, recordCount);
+}
+
+int locateAccount(int accountNumber, long *recordNumber) {
+    if (directIndex.fd >= 0) return directLookup(accountNumber, recordNumber);
+    
+    if (accountIndexMap.base != NULL) {
+        const IndexSlot *slots = (const IndexSlot *)((const char *)accountIndexMap.base + sizeof(IndexHeader));
+        const IndexSlot *slot = indexFind(slots, accountIndexMap.bucketCount, accountNumber);
+        if (slot == NULL) return 0;
+        *recordNumber = slot->value;
+        return 1;
+    }
+    
+    IndexSlot slot;
+    if (!indexLookup(ACCOUNTS_INDEX, accountNumber, &slot)) return 0;
+    *recordNumber = slot.value;
+    return 1;
+}
+
+// Reads the indexed record from its shard and checks that it really belongs
+// to the account; archived accounts are not in the store and are not found here
+int readIndexedAccount(int accountNumber, long *recordNumber, BankAccount *account) {
+    if (!locateAccount(accountNumber, recordNumber) || *recordNumber < 0) return 0;
+    
+    FILE *file = openShardFile(recordShard(*recordNumber), "rb");
+    if (file == NULL) return 0;
+    fseek(file, recordInShard(*recordNumber) * (long)sizeof(BankAccount), SEEK_SET);
+    int found = readRecords(account, sizeof(BankAccount), 1, file) == 1 &&
+                account->accountNumber == accountNumber;
+    fclose(file);
+    return found;
+}
+
+// Direct account table functions
+
+off_t directOffset(long accountNumber) {
+    return sizeof(IndexHeader) + (off_t)accountNumber * sizeof(int64_t);
+}
+
+// Slots hold record + 1 for accounts.db, -(record + 1) for the archive
+// (the accounts.idx value as it is), and 0 where there is no account
+int64_t directEntry(long value) {
+    return value >= 0 ? value + 1 : value;
+}
+
+// (Re)maps accounts.dir read-only; called again whenever the table grows
+int mapDirectIndex() {
+    if (directIndex.base != NULL) munmap(directIndex.base, directIndex.length);
+    directIndex.base = NULL;
+    directIndex.slots = NULL;
+    
+    size_t length = directOffset(directIndex.header.bucketCount);
+    void *base = mmap(NULL, length, PROT_READ, MAP_SHARED, directIndex.fd, 0);
+    if (base == MAP_FAILED) return 0;
+    
+    directIndex.base = base;
+    directIndex.length = length;
+    directIndex.slots = (const int64_t *)((const char *)base + sizeof(IndexHeader));
+    return 1;
+}
+
+void closeDirectIndex() {
+    if (directIndex.base != NULL) munmap(directIndex.base, directIndex.length);
+    if (directIndex.fd >= 0) close(directIndex.fd);
+    
+    directIndex.fd = -1;
+    directIndex.base = NULL;
+    directIndex.length = 0;
+    directIndex.slots = NULL;
+    memset(&directIndex.header, 0, sizeof(IndexHeader));
+}
+
+// Writes a fresh accounts.dir from accounts.idx, which must be current.
+// The slots are filled through a temporary mapping, so only the pages
+// that hold accounts are ever allocated on disk.
+int rebuildDirectIndex() {
+    FILE *file = openFile(ACCOUNTS_INDEX, "rb");
+    if (file == NULL) return 0;
+    
+    IndexHeader source;
+    IndexSlot *slots = NULL;
+    int success = readIndexHeader(file, &source);
+    if (success) {
+        slots = malloc((source.bucketCount > 0 ? source.bucketCount : 1) * sizeof(IndexSlot));
+        success = slots != NULL &&
+                  (long)readRecords(slots, sizeof(IndexSlot), source.bucketCount, file) == source.bucketCount;
+    }
+    fclose(file);
+    
+    int highest = 0;
+    for (long i = 0; success && i < source.bucketCount; i++) {
+        if (slots[i].key > highest) highest = slots[i].key;
+    }
+    
+    IndexHeader header = { DIRECT_MAGIC, DIRECT_VERSION, ((long)highest / DIRECT_CHUNK + 1) * DIRECT_CHUNK,
+                           0, success ? source.recordCount : 0 };
+    size_t length = directOffset(header.bucketCount);
+    int fd = success ? openDescriptor(ACCOUNTS_DIRECT, O_RDWR | O_CREAT | O_TRUNC, 0644) : -1;
+    success = fd >= 0 && ftruncate(fd, length) == 0;
+    
+    void *base = success ? mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    success = base != MAP_FAILED;
+    if (success) {
+        int64_t *table = (int64_t *)((char *)base + sizeof(IndexHeader));
+        for (long i = 0; i < source.bucketCount; i++) {
+            if (slots[i].key <= 0) continue;
+            table[slots[i].key] = directEntry(slots[i].value);
+            header.entryCount++;
+        }
+        
+        // The header goes in last, so an interrupted rebuild is never taken as current
+        memcpy(base, &header, sizeof(IndexHeader));
+        success = syncMapping(base, length) == 0;
+        munmap(base, length);
+    }
+    free(slots);
+    if (fd >= 0) close(fd);
+    return success;
+}
+
+// Opens accounts.dir, first rebuilding it if it is missing or was last
+// written for a different number of account records
+int openDirectIndex(long recordCount) {
+    closeDirectIndex();
+    
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (attempt > 0 && !rebuildDirectIndex()) return 0;
+        
+        directIndex.fd = openDescriptor(ACCOUNTS_DIRECT, O_RDWR, 0);
+        IndexHeader *header = &directIndex.header;
+        if (directIndex.fd >= 0 &&
+            readAt(directIndex.fd, header, sizeof(IndexHeader), 0) == sizeof(IndexHeader) &&
+            header->magic == DIRECT_MAGIC && header->version == DIRECT_VERSION &&
+            header->recordCount == recordCount) {
+            if (!useMappedStorage || mapDirectIndex()) return 1;
+        }
+        closeDirectIndex();
+    }
+    return 0;
+}
+
+// One load when mapped, otherwise one read
+int directLookup(int accountNumber, long *recordNumber) {
+    if (accountNumber <= 0 || accountNumber >= directIndex.header.bucketCount) return 0;
+    
+    int64_t entry;
+    if (directIndex.slots != NULL) {
+        entry = directIndex.slots[accountNumber];
+    } else if (readAt(directIndex.fd, &entry, sizeof(entry), directOffset(accountNumber)) != sizeof(entry)) {
+        return 0;
+    }
+    if (entry == 0) return 0;
+    
+    *recordNumber = entry > 0 ? entry - 1 : entry;
+    return 1;
+}
+
+// Records a new account; the sparse file grows a chunk at a time to cover it
+int insertDirectIndex(int accountNumber, long recordNumber, long recordCount) {
+    IndexHeader *header = &directIndex.header;
+    if (accountNumber <= 0) return 0;
+    
+    if (accountNumber >= header->bucketCount) {
+        long bucketCount = ((long)accountNumber / DIRECT_CHUNK + 1) * DIRECT_CHUNK;
+        if (ftruncate(directIndex.fd, directOffset(bucketCount)) != 0) return 0;
+        header->bucketCount = bucketCount;
+        if (directIndex.base != NULL && !mapDirectIndex()) return 0;
+    }
+    
+    int64_t entry = directEntry(recordNumber);
+    if (writeAt(directIndex.fd, &entry, sizeof(entry), directOffset(accountNumber)) != sizeof(entry)) return 0;
+    header->entryCount++;
+    if (recordCount > header->recordCount) header->recordCount = recordCount;
+    return writeAt(directIndex.fd, header, sizeof(IndexHeader), 0) == sizeof(IndexHeader);
+}
+
+// A failed update would hide the new account, so fall back to a full rebuild
+int updateDirectIndex(int accountNumber, long recordNumber, long recordCount) {
+    if (directIndex.fd < 0 || insertDirectIndex(accountNumber, recordNumber, recordCount)) return 1;
+    
+    closeDirectIndex();
+    remove(ACCOUNTS_DIRECT);
+    return openDirectIndex(recordCount);
+}
+
+// Reads a closed account that compaction moved to accounts.archive
+int readArchivedAccount(int accountNumber, long archiveRecord, BankAccount *account) {
+    FILE *file = openFile(ACCOUNTS_ARCHIVE, "rb");
+    if (file == NULL) return 0;
+    
+    fseek(file, archiveRecord * (long)sizeof(BankAccount), SEEK_SET);
+    int found = readRecords(account, sizeof(BankAccount), 1, file) == 1 &&
+                account->accountNumber == accountNumber;
+    fclose(file);
+    return found;
+}
+
+// Account cache functions
+int initAccountCache(int capacity) {
+    freeAccountCache();
+    if (capacity <= 0) return 1;
+    
+    accountCache.entries = malloc(capacity * sizeof(CachedAccount));
+    accountCache.buckets = malloc(capacity * 2 * sizeof(int));
+    if (accountCache.entries == NULL || accountCache.buckets == NULL) {
+        freeAccountCache();
+        return 0;
+    }
+    for (int i = 0; i < capacity * 2; i++) accountCache.buckets[i] = -1;
+    accountCache.capacity = capacity;
+    return 1;
+}
+
+void freeAccountCache() {
+    free(accountCache.entries);
+    free(accountCache.buckets);
+    accountCache.entries = NULL;
+    accountCache.buckets = NULL;
+    accountCache.capacity = 0;
+    accountCache.count = 0;
+    accountCache.head = -1;
+    accountCache.tail = -1;
+}
+
+int cacheFindLocked(int accountNumber) {
+    int entry = accountCache.buckets[(uint32_t)accountNumber % (accountCache.capacity * 2)];
+    while (entry >= 0 && accountCache.entries[entry].account.accountNumber != accountNumber) {
+        entry = accountCache.entries[entry].hashNext;
+    }
+    return entry;
+}
+
+void cacheUnlinkLocked(int entry) {
+    CachedAccount *cached = &accountCache.entries[entry];
+    if (cached->prev >= 0) accountCache.entries[cached->prev].next = cached->next;
+    else accountCache.head = cached->next;
+    if (cached->next >= 0) accountCache.entries[cached->next].prev = cached->prev;
+    else accountCache.tail = cached->prev;
+}
+
+void cachePushFrontLocked(int entry) {
+    CachedAccount *cached = &accountCache.entries[entry];
+    cached->prev = -1;
+    cached->next = accountCache.head;
+    if (accountCache.head >= 0) accountCache.entries[accountCache.head].prev = entry;
+    accountCache.head = entry;
+    if (accountCache.tail < 0) accountCache.tail = entry;
+}
+
+// Takes the entry out of its hash chain and the LRU list; the slot is then
+// refilled by moving the last entry into it, so entries stay dense
+void cacheRemoveLocked(int entry) {
+    int *link = &accountCache.buckets[(uint32_t)accountCache.entries[entry].account.accountNumber %
+                                      (accountCache.capacity * 2)];
+    while (*link != entry) link = &accountCache.entries[*link].hashNext;
+    *link = accountCache.entries[entry].hashNext;
+    cacheUnlinkLocked(entry);
+    
+    int last = --accountCache.count;
+    if (entry == last) return;
+    
+    // Re-point everything that referred to the moved entry
+    CachedAccount *moved = &accountCache.entries[last];
+    link = &accountCache.buckets[(uint32_t)moved->account.accountNumber % (accountCache.capacity * 2)];
+    while (*link != last) link = &accountCache.entries[*link].hashNext;
+    *link = entry;
+    if (moved->prev >= 0) accountCache.entries[moved->prev].next = entry;
+    else accountCache.head = entry;
+    if (moved->next >= 0) accountCache.entries[moved->next].prev = entry;
+    else accountCache.tail = entry;
+    accountCache.entries[entry] = *moved;
+}
+
+int cacheGet(int accountNumber, BankAccount *account, long *recordNumber) {
+    if (accountCache.capacity == 0) return 0;
+    
+    pthread_mutex_lock(&accountCache.lock);
+    int entry = cacheFindLocked(accountNumber);
+    if (entry < 0) {
+        accountCache.misses++;
+        pthread_mutex_unlock(&accountCache.lock);
+        return 0;
+    }
+    
+    accountCache.hits++;
+    cacheUnlinkLocked(entry);
+    cachePushFrontLocked(entry);
+    *account = accountCache.entries[entry].account;
+    *recordNumber = accountCache.entries[entry].recordNumber;
+    pthread_mutex_unlock(&accountCache.lock);
+    return 1;
+}
+
+// Adds or refreshes an account as most recently used, evicting the least
+// recently used one when full; a dirty victim is written out first
+int cachePut(const BankAccount *account, long recordNumber, int dirty) {
+    if (accountCache.capacity == 0) return 1;
+    
+    pthread_mutex_lock(&accountCache.lock);
+    int entry = cacheFindLocked(account->accountNumber);
+    
+    if (entry >= 0) {
+        cacheUnlinkLocked(entry);
+        dirty = dirty || accountCache.entries[entry].dirty;
+    } else {
+        if (accountCache.count == accountCache.capacity) {
+            int victim = accountCache.tail;
+            if (accountCache.entries[victim].dirty) {
+                if (!writeAccountRecords(&accountCache.entries[victim].account,
+                                         &accountCache.entries[victim].recordNumber, 1)) {
+                    pthread_mutex_unlock(&accountCache.lock);
+                    return 0;
+                }
+                accountCache.deferredWrites++;
+            }
+            cacheRemoveLocked(victim);
+            accountCache.evictions++;
+        }
+        entry = accountCache.count++;
+        int bucket = (uint32_t)account->accountNumber % (accountCache.capacity * 2);
+        accountCache.entries[entry].hashNext = accountCache.buckets[bucket];
+        accountCache.buckets[bucket] = entry;
+    }
+    
+    accountCache.entries[entry].account = *account;
+    accountCache.entries[entry].recordNumber = recordNumber;
+    accountCache.entries[entry].dirty = dirty;
+    cachePushFrontLocked(entry);
+    pthread_mutex_unlock(&accountCache.lock);
+    return 1;
+}
+
+void cacheInvalidate(int accountNumber) {
+    if (accountCache.capacity == 0) return;
+    
+    pthread_mutex_lock(&accountCache.lock);
+    int entry = cacheFindLocked(accountNumber);
+    if (entry >= 0) cacheRemoveLocked(entry);
+    pthread_mutex_unlock(&accountCache.lock);
+}
+
+// Writes every dirty entry to accounts.db; with invalidate, also empties
+// the cache, for callers that are about to rewrite accounts.db themselves
+int flushAccountCache(int invalidate) {
+    if (accountCache.capacity == 0) return 1;
+    
+    pthread_mutex_lock(&accountCache.lock);
+    int success = 1;
+    for (int entry = 0; entry < accountCache.count; entry++) {
+        CachedAccount *cached = &accountCache.entries[entry];
+        if (!cached->dirty) continue;
+        if (writeAccountRecords(&cached->account, &cached->recordNumber, 1)) {
+            cached->dirty = 0;
+            accountCache.deferredWrites++;
+        } else {
+            success = 0;
+        }
+    }
+    if (invalidate && success) {
+        for (int i = 0; i < accountCache.capacity * 2; i++) accountCache.buckets[i] = -1;
+        accountCache.count = 0;
+        accountCache.head = -1;
+        accountCache.tail = -1;
+    }
+    pthread_mutex_unlock(&accountCache.lock);
+    return success;
+}
+
+// Writes one account or a transfer's pair to the store, opening each shard
+// file once; if the second write fails, the first record is put back so
+// the caller can roll back the pair as a unit
+int writeAccountRecords(const BankAccount *accounts, const long *recordNumbers, int count) {
+    FILE *files[2] = { NULL, NULL };
+    files[0] = openShardFile(recordShard(recordNumbers[0]), "rb+");
+    if (files[0] == NULL) return 0;
+    
+    BankAccount previous;
+    int written = 0, success = 1;
+    for (; written < count; written++) {
+        int sameShard = written == 0 || recordShard(recordNumbers[written]) == recordShard(recordNumbers[0]);
+        if (!sameShard && files[1] == NULL) {
+            files[1] = openShardFile(recordShard(recordNumbers[written]), "rb+");
+            if (files[1] == NULL) break;
+        }
+        FILE *file = files[sameShard ? 0 : 1];
+        long position = recordInShard(recordNumbers[written]) * (long)sizeof(BankAccount);
+        if (written == 0 && count > 1) {
+            fseek(file, position, SEEK_SET);
+            if (readRecords(&previous, sizeof(BankAccount), 1, file) != 1) break;
+        }
+        fseek(file, position, SEEK_SET);
+        if (writeRecords(&accounts[written], sizeof(BankAccount), 1, file) != 1) break;
+    }
+    
+    if (written > 0 && written < count) {
+        fseek(files[0], recordInShard(recordNumbers[0]) * (long)sizeof(BankAccount), SEEK_SET);
+        writeRecords(&previous, sizeof(BankAccount), 1, files[0]);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (files[i] != NULL && fclose(files[i]) != 0) success = 0;
+    }
+    return success && written == count;
+}
+
+// Reads an account through the cache (file I/O mode only)
+int loadAccount(int accountNumber, BankAccount *account, long *recordNumber) {
+    if (cacheGet(accountNumber, account, recordNumber)) return 1;
+    
+    int found = readIndexedAccount(accountNumber, recordNumber, account);
+    if (found) cachePut(account, *recordNumber, 0);
+    return found;
+}
+
+// Stores changed accounts according to the cache policy (file I/O mode only)
+int storeAccounts(const BankAccount *accounts, const long *recordNumbers, int count, int writeThrough) {
+    int deferred = accountCache.writeBack && accountCache.capacity > 0 && !writeThrough;
+    if (!deferred) {
+        if (!writeAccountRecords(accounts, recordNumbers, count)) return 0;
+        // A failed put only means the account was not cached, so disk stays authoritative
+        for (int i = 0; i < count; i++) cachePut(&accounts[i], recordNumbers[i], 0);
+        return 1;
+    }
+    
+    // If an eviction cannot make room, write the whole unit through instead
+    for (int i = 0; i < count; i++) {
+        if (!cachePut(&accounts[i], recordNumbers[i], 1)) {
+            return writeAccountRecords(accounts, recordNumbers, count);
+        }
+    }
+    return 1;
+}
+
+void showCacheStatistics() {
+    printHeader("ACCOUNT CACHE");
+    if (accountMap.records != NULL) {
+        printf("Accounts are memory-mapped; the cache is not used.\n");
+    } else if (accountCache.capacity == 0) {
+        printf("The account cache is disabled.\n");
+    } else {
+        pthread_mutex_lock(&accountCache.lock);
+        long lookups = accountCache.hits + accountCache.misses;
+        int dirty = 0;
+        for (int entry = 0; entry < accountCache.count; entry++) dirty += accountCache.entries[entry].dirty;
+        
+        printf("Policy:          %s\n", accountCache.writeBack ? "write-back" : "write-through");
+        printf("Entries:         %d of %d (%d dirty)\n", accountCache.count, accountCache.capacity, dirty);
+        printf("Hits:            %ld\n", accountCache.hits);
+        printf("Misses:          %ld\n", accountCache.misses);
+        printf("Hit rate:        %.1f%%\n", lookups > 0 ? 100.0 * accountCache.hits / lookups : 0.0);
+        printf("Evictions:       %ld\n", accountCache.evictions);
+        printf("Deferred writes: %ld\n", accountCache.deferredWrites);
+        pthread_mutex_unlock(&accountCache.lock);
+    }
+    printf("============================================\n");
+}
+
+int findAccountByNumber(int accountNumber, BankAccount *result) {
+    struct timespec start;
+    startMetric(&start);
+    long recordNumber;
+    int found;
+    
+    if (accountMap.records != NULL) {
+        BankAccount *account = mappedAccount(accountNumber, &recordNumber);
+        found = account != NULL;
+        if (found) *result = *account;
+    } else {
+        found = loadAccount(accountNumber, result, &recordNumber);
+    }
+    
+    // Read-only from here: postings need an open account, so they never
+    // change an archived one
+    if (!found && locateAccount(accountNumber, &recordNumber) && recordNumber < 0) {
+        found = readArchivedAccount(accountNumber, -recordNumber - 1, result);
+    }
+    stopMetric(METRIC_FIND_ACCOUNT, &start);
+    return found;
+}
+
+int updateAccountBalance(int accountNumber, long newBalanceCents) {
+    if (accountMap.records != NULL) {
+        long recordNumber;
+        BankAccount *account = mappedAccount(accountNumber, &recordNumber);
+        if (account == NULL) return 0;
+        account->balance = newBalanceCents;
+        syncMappedAccount(recordNumber);
+        return 1;
+    }
+    
+    BankAccount account;
+    long recordNumber;
+    if (!loadAccount(accountNumber, &account, &recordNumber)) return 0;
+    
+    account.balance = newBalanceCents;
+    return storeAccounts(&account, &recordNumber, 1, 0);
+}
+
+int updateAccountPassword(int accountNumber, const char *newPassword) {
+    if (accountMap.records != NULL) {
+        long recordNumber;
+        BankAccount *account = mappedAccount(accountNumber, &recordNumber);
+        if (account == NULL) return 0;
+        generateSalt(account->salt, 16);
+        hashPassword(newPassword, account->salt, account->passwordHash);
+        syncMappedAccount(recordNumber);
+        return 1;
+    }
+    
+    BankAccount account;
+    long recordNumber;
+    if (!loadAccount(accountNumber, &account, &recordNumber)) return 0;
+    
+    char newSalt[17];
+    char newHash[65];
+    generateSalt(newSalt, 16);
+    hashPassword(newPassword, newSalt, newHash);
+    
+    strcpy(account.passwordHash, newHash);
+    strcpy(account.salt, newSalt);
+    
+    // The log cannot restore a password, so it always goes straight to disk
+    return storeAccounts(&account, &recordNumber, 1, 1);
+}
+
+// Compact log record functions
+int64_t currentMicros() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Renders a log timestamp the way getCurrentTimestamp formats the current time
+void formatTimestamp(int64_t micros, char *buffer) {
+    time_t seconds = (time_t)(micros / 1000000);
+    struct tm t;
+    localtime_r(&seconds, &t);
+    strftime(buffer, 20, "%Y-%m-%d %H:%M", &t);
+}
+
+// Reads a version 1 timestamp string back into epoch microseconds
+int64_t parseTimestamp(const char *text) {
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    if (sscanf(text, "%d-%d-%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday,
+               &t.tm_hour, &t.tm_min, &t.tm_sec) < 5) {
+        return 0;
+    }
+    t.tm_year -= 1900;
+    t.tm_mon -= 1;
+    t.tm_isdst = -1;
+    time_t seconds = mktime(&t);
+    return seconds == (time_t)-1 ? 0 : (int64_t)seconds * 1000000;
+}
+
+TransactionType transactionTypeFromName(const char *name) {
+    for (int type = 0; type < TX_TYPES; type++) {
+        if (strcmp(name, transactionTypeNames[type]) == 0) return (TransactionType)type;
+    }
+    return TX_OTHER;
+}
+
+off_t logOffset(long recordNumber) {
+    return sizeof(LogHeader) + recordNumber * (off_t)sizeof(LogRecord);
+}
+
+long logRecordCount(long fileSize) {
+    return fileSize > (long)sizeof(LogHeader) ? (fileSize - (long)sizeof(LogHeader)) / (long)sizeof(LogRecord) : 0;
+}
+
+uint32_t descriptionHash(const char *text) {
+    uint32_t hash = 2166136261u;
+    while (*text) {
+        hash = (hash ^ (unsigned char)*text++) * 16777619u;
+    }
+    return hash;
+}
+
+// Loads transactions.desc, cutting off an entry torn by a crash
+int openDescriptionTable() {
+    DescriptionTable *table = &descriptionTable;
+    table->fd = openDescriptor(TRANSACTIONS_DESCRIPTIONS, O_RDWR | O_CREAT, 0644);
+    if (table->fd < 0) return 0;
+    
+    struct stat info;
+    if (fstat(table->fd, &info) != 0) {
+        closeDescriptionTable();
+        return 0;
+    }
+    
+    uint32_t magic = DESCRIPTION_MAGIC;
+    if (info.st_size < (off_t)sizeof(magic)) {
+        if (writeAt(table->fd, &magic, sizeof(magic), 0) != sizeof(magic) ||
+            ftruncate(table->fd, sizeof(magic)) != 0) {
+            closeDescriptionTable();
+            return 0;
+        }
+        info.st_size = sizeof(magic);
+    }
+    
+    table->capacity = info.st_size + 4096;
+    table->text = malloc(table->capacity);
+    table->slotCount = DESCRIPTION_MIN_SLOTS;
+    table->slots = calloc(table->slotCount, sizeof(uint32_t));
+    if (table->text == NULL || table->slots == NULL ||
+        readAt(table->fd, table->text, sizeof(magic), 0) != sizeof(magic) ||
+        memcmp(table->text, &magic, sizeof(magic)) != 0) {
+        closeDescriptionTable();
+        return 0;
+    }
+    
+    table->entryCount = 0;
+    table->size = sizeof(magic);
+    table->syncedSize = sizeof(magic);
+    if (!loadDescriptionsLocked(info.st_size)) {
+        closeDescriptionTable();
+        return 0;
+    }
+    return 1;
+}
+
+// Reads and interns the entries between table->size and fileSize. An entry
+// torn by a crash is cut off, so the next one is written in its place.
+int loadDescriptionsLocked(off_t fileSize) {
+    DescriptionTable *table = &descriptionTable;
+    if (fileSize > table->capacity) {
+        uint32_t capacity = fileSize + 4096;
+        char *grown = realloc(table->text, capacity);
+        if (grown == NULL) return 0;
+        table->text = grown;
+        table->capacity = capacity;
+    }
+    
+    size_t bytes = fileSize - table->size;
+    if (readAt(table->fd, table->text + table->size, bytes, table->size) != (ssize_t)bytes) return 0;
+    
+    uint32_t offset = table->size;
+    while (offset < fileSize) {
+        uint32_t length = (unsigned char)table->text[offset];
+        if (offset + length + 2 > fileSize || table->text[offset + length + 1] != '\0') break;
+        
+        uint32_t slot = descriptionHash(table->text + offset + 1) & (table->slotCount - 1);
+        while (table->slots[slot] != 0) slot = (slot + 1) & (table->slotCount - 1);
+        table->slots[slot] = offset;
+        table->entryCount++;
+        offset += length + 2;
+        if (table->entryCount * 2 > table->slotCount && !growDescriptionSlots()) return 0;
+    }
+    
+    if (offset != fileSize && ftruncate(table->fd, offset) != 0) return 0;
+    
+    // Entries read from the file are already on disk
+    if (table->syncedSize == table->size) table->syncedSize = offset;
+    table->size = offset;
+    return 1;
+}
+
+// --shared: takes in the entries other processes have added since this one
+// last looked. Called with the log lock held, so none is half written.
+int refreshDescriptionsLocked() {
+    struct stat info;
+    if (sharedLocks.fd < 0) return 1;
+    if (fstat(descriptionTable.fd, &info) != 0) return 0;
+    return info.st_size <= descriptionTable.size || loadDescriptionsLocked(info.st_size);
+}
+
+void closeDescriptionTable() {
+    if (descriptionTable.fd >= 0) close(descriptionTable.fd);
+    descriptionTable.fd = -1;
+    free(descriptionTable.text);
+    free(descriptionTable.slots);
+    descriptionTable.text = NULL;
+    descriptionTable.slots = NULL;
+    descriptionTable.size = 0;
+    descriptionTable.capacity = 0;
+    descriptionTable.slotCount = 0;
+    descriptionTable.entryCount = 0;
+}
+
+// Doubles the intern table, keeping it at most half full
+int growDescriptionSlots() {
+    DescriptionTable *table = &descriptionTable;
+    uint32_t slotCount = table->slotCount * 2;
+    uint32_t *slots = calloc(slotCount, sizeof(uint32_t));
+    if (slots == NULL) return 0;
+    
+    for (uint32_t i = 0; i < table->slotCount; i++) {
+        if (table->slots[i] == 0) continue;
+        uint32_t slot = descriptionHash(table->text + table->slots[i] + 1) & (slotCount - 1);
+        while (slots[slot] != 0) slot = (slot + 1) & (slotCount - 1);
+        slots[slot] = table->slots[i];
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->slotCount = slotCount;
+    return 1;
+}
+
+// Returns the offset of the text in transactions.desc, adding it the first
+// time it is seen; 0 (no description) if it cannot be stored
+uint32_t internDescription(const char *text) {
+    if (text[0] == '\0') return 0;
+    
+    // Other processes append to the same file, so the end is found under the log lock
+    lockSharedLog();
+    pthread_mutex_lock(&descriptionTable.lock);
+    uint32_t offset = 0;
+    if (descriptionTable.fd >= 0 && refreshDescriptionsLocked()) offset = internDescriptionLocked(text);
+    pthread_mutex_unlock(&descriptionTable.lock);
+    unlockSharedLog();
+    return offset;
+}
+
+uint32_t internDescriptionLocked(const char *text) {
+    DescriptionTable *table = &descriptionTable;
+    uint32_t hash = descriptionHash(text);
+    uint32_t slot = hash & (table->slotCount - 1);
+    while (table->slots[slot] != 0) {
+        if (strcmp(table->text + table->slots[slot] + 1, text) == 0) return table->slots[slot];
+        slot = (slot + 1) & (table->slotCount - 1);
+    }
+    
+    size_t length = strnlen(text, MAX_DESCRIPTION_LENGTH - 1);
+    if (table->size + length + 2 > table->capacity) {
+        uint32_t capacity = table->capacity * 2;
+        char *grown = realloc(table->text, capacity);
+        if (grown == NULL) return 0;
+        table->text = grown;
+        table->capacity = capacity;
+    }
+    
+    uint32_t offset = table->size;
+    char *entry = table->text + offset;
+    entry[0] = (char)length;
+    memcpy(entry + 1, text, length);
+    entry[length + 1] = '\0';
+    if (writeAt(table->fd, entry, length + 2, offset) != (ssize_t)(length + 2)) return 0;
+    
+    table->size += length + 2;
+    table->slots[slot] = offset;
+    table->entryCount++;
+    if (table->entryCount * 2 > table->slotCount) growDescriptionSlots();
+    return offset;
+}
+
+void renderDescription(uint32_t offset, char *buffer) {
+    pthread_mutex_lock(&descriptionTable.lock);
+    if (offset >= descriptionTable.size && sharedLocks.fd >= 0) {
+        // Added by another process after this one last looked
+        pthread_mutex_unlock(&descriptionTable.lock);
+        lockSharedLog();
+        pthread_mutex_lock(&descriptionTable.lock);
+        if (descriptionTable.fd >= 0) refreshDescriptionsLocked();
+        unlockSharedLog();
+    }
+    if (offset >= sizeof(uint32_t) && offset < descriptionTable.size) {
+        strcpy(buffer, descriptionTable.text + offset + 1);
+    } else {
+        buffer[0] = '\0';
+    }
+    pthread_mutex_unlock(&descriptionTable.lock);
+}
+
+// Makes new descriptions durable; called before the log itself is synced
+int syncDescriptionTable() {
+    pthread_mutex_lock(&descriptionTable.lock);
+    uint32_t size = descriptionTable.size;
+    int dirty = descriptionTable.fd >= 0 && size != descriptionTable.syncedSize;
+    pthread_mutex_unlock(&descriptionTable.lock);
+    
+    if (!dirty) return 1;
+    if (syncDescriptor(descriptionTable.fd) != 0) return 0;
+    
+    pthread_mutex_lock(&descriptionTable.lock);
+    if (size > descriptionTable.syncedSize) descriptionTable.syncedSize = size;
+    pthread_mutex_unlock(&descriptionTable.lock);
+    return 1;
+}
+
+void renderTransaction(const LogRecord *record, Transaction *transaction) {
+    transaction->transactionId = record->transactionId;
+    transaction->accountNumber = record->accountNumber;
+    strcpy(transaction->type, transactionTypeNames[record->type < TX_TYPES ? record->type : TX_OTHER]);
+    transaction->amount = record->amount;
+    transaction->balanceAfter = record->balanceAfter;
+    formatTimestamp(record->timestamp, transaction->timestamp);
+    renderDescription(record->description, transaction->description);
+}
+
+// Gives a new transactions.db its header and converts a version 1 log
+int prepareTransactionLog() {
+    FILE *file = openFile(TRANSACTIONS_DB, "rb+");
+    if (file == NULL) return 0;
+    
+    LogHeader header;
+    size_t headerBytes = readRecords(&header, 1, sizeof(header), file);
+    if (headerBytes == 0) {
+        header.magic = LOG_MAGIC;
+        header.version = LOG_VERSION;
+        header.recordSize = sizeof(LogRecord);
+        header.reserved = 0;
+        rewind(file);
+        int written = writeRecords(&header, sizeof(header), 1, file) == 1;
+        return (fclose(file) == 0) && written;
+    }
+    fclose(file);
+    
+    if (headerBytes == sizeof(header) && header.magic == LOG_MAGIC) {
+        if (header.version == LOG_VERSION && header.recordSize == sizeof(LogRecord)) return 1;
+        printf("❌ %s uses an unsupported format (version %u)!\n", TRANSACTIONS_DB, header.version);
+        return 0;
+    }
+    return convertLegacyLog() >= 0;
+}
+
+// Rewrites a version 1 transactions.db (168-byte records with text fields)
+// in the compact format. Record numbers do not change, so the chain and
+// heads files stay valid. The old log is kept as transactions.db.v1.
+long convertLegacyLog() {
+    FILE *legacy = openFile(TRANSACTIONS_DB, "rb");
+    if (legacy == NULL) return -1;
+    
+    char tempPath[64];
+    snprintf(tempPath, sizeof(tempPath), "%s.tmp", TRANSACTIONS_DB);
+    FILE *converted = openFile(tempPath, "wb");
+    if (converted == NULL) {
+        fclose(legacy);
+        return -1;
+    }
+    
+    LogHeader header = { LOG_MAGIC, LOG_VERSION, sizeof(LogRecord), 0 };
+    int success = writeRecords(&header, sizeof(header), 1, converted) == 1;
+    
+    Transaction *block = malloc(BATCH_LOG_BUFFER * sizeof(Transaction));
+    LogRecord *records = malloc(BATCH_LOG_BUFFER * sizeof(LogRecord));
+    success = success && block != NULL && records != NULL;
+    
+    long recordCount = 0;
+    size_t blockRecords;
+    while (success && (blockRecords = readRecords(block, sizeof(Transaction), BATCH_LOG_BUFFER, legacy)) > 0) {
+        for (size_t i = 0; i < blockRecords; i++) {
+            LogRecord *record = &records[i];
+            memset(record, 0, sizeof(LogRecord));
+            block[i].type[sizeof(block[i].type) - 1] = '\0';
+            block[i].timestamp[sizeof(block[i].timestamp) - 1] = '\0';
+            block[i].description[MAX_DESCRIPTION_LENGTH - 1] = '\0';
+            
+            record->timestamp = parseTimestamp(block[i].timestamp);
+            record->amount = block[i].amount;
+            record->balanceAfter = block[i].balanceAfter;
+            record->transactionId = block[i].transactionId != 0 ? block[i].transactionId
+                                                                : (int32_t)(recordCount + i + 1);
+            record->accountNumber = block[i].accountNumber;
+            record->description = internDescription(block[i].description);
+            record->type = transactionTypeFromName(block[i].type);
+        }
+        success = writeRecords(records, sizeof(LogRecord), blockRecords, converted) == blockRecords;
+        recordCount += blockRecords;
+    }
+    long legacySize = ftell(legacy);
+    
+    free(block);
+    free(records);
+    fclose(legacy);
+    success = (fflush(converted) == 0) && success;
+    success = success && fsync(fileno(converted)) == 0 && syncDescriptionTable();
+    long convertedSize = ftell(converted);
+    success = (fclose(converted) == 0) && success;
+    
+    // Keep the old log under a second name, then swap the new one in atomically
+    remove(TRANSACTIONS_LEGACY);
+    success = success && link(TRANSACTIONS_DB, TRANSACTIONS_LEGACY) == 0 &&
+              rename(tempPath, TRANSACTIONS_DB) == 0;
+    if (!success) {
+        remove(tempPath);
+        printf("❌ Failed to convert %s to the compact format!\n", TRANSACTIONS_DB);
+        return -1;
+    }
+    
+    printf("🔄 Converted %ld transaction(s) to the compact log format (%ld KB -> %ld KB).\n",
+           recordCount, legacySize / 1024, convertedSize / 1024);
+    printf("   The previous log was kept as %s.\n", TRANSACTIONS_LEGACY);
+    return recordCount;
+}
+
+// Transaction index functions
+int rebuildTransactionIndex() {
+    FILE *file = openFile(TRANSACTIONS_DB, "rb");
+    if (file == NULL) return 0;
+    
+    fseek(file, 0, SEEK_END);
+    long transactionCount = logRecordCount(ftell(file));
+    fseek(file, logOffset(0), SEEK_SET);
+    
+    // The heads table grows with the number of accounts, not of transactions
+    TransactionLink *links = malloc((transactionCount > 0 ? transactionCount : 1) * sizeof(TransactionLink));
+    long bucketCount = indexBucketCount(0, 0);
+    IndexSlot *slots = calloc(bucketCount, sizeof(IndexSlot));
+    if (links == NULL || slots == NULL) {
+        free(links);
+        free(slots);
+        fclose(file);
+        return 0;
+    }
+    
+    // Link every record to the previous and next record of the same account
+    LogRecord transaction;
+    long entryCount = 0;
+    for (long record = 0; record < transactionCount &&
+         readRecords(&transaction, sizeof(LogRecord), 1, file); record++) {
+        links[record].prev = -1;
+        links[record].next = -1;
+        if (transaction.accountNumber == 0) continue;  // voided record
+        
+        IndexSlot entry;
+        entry.key = transaction.accountNumber;
+        entry.value = record;
+        entry.aux = record;
+        
+        long bucket = indexBucket(entry.key, bucketCount);
+        while (slots[bucket].key != 0 && slots[bucket].key != entry.key) {
+            bucket = (bucket + 1) & (bucketCount - 1);
+        }
+        if (slots[bucket].key == entry.key) {
+            links[record].prev = slots[bucket].value;
+            links[slots[bucket].value].next = record;
+            entry.aux = slots[bucket].aux;
+        }
+        indexPut(slots, bucketCount, &entry, &entryCount);
+        if (entryCount * 2 > bucketCount && !growIndexSlots(&slots, &bucketCount)) {
+            free(links);
+            free(slots);
+            fclose(file);
+            return 0;
+        }
+    }
+    fclose(file);
+    
+    int success = 0;
+    file = openFile(TRANSACTIONS_CHAIN, "wb");
+    if (file != NULL) {
+        success = writeRecords(links, sizeof(TransactionLink), transactionCount, file) == (size_t)transactionCount;
+        success = (fclose(file) == 0) && success;
+    }
+    success = success && writeIndexFile(TRANSACTIONS_HEADS, slots, bucketCount, entryCount, transactionCount);
+    
+    free(links);
+    free(slots);
+    return success;
+}
+
+// Appends the new record to the end of its account's chain. The new link
+// is written before the old tail points at it, so trimTransactionIndex can
+// always find and undo a forward pointer left by an interrupted link.
+int linkTransaction(int accountNumber, long recordNumber) {
+    FILE *file = openFile(TRANSACTIONS_CHAIN, "rb+");
+    if (file == NULL) return 0;
+    
+    TransactionLink link;
+    link.prev = -1;
+    link.next = -1;
+    
+    IndexSlot head;
+    int hasHistory = indexLookup(TRANSACTIONS_HEADS, accountNumber, &head);
+    if (hasHistory) {
+        link.prev = head.value;
+    } else {
+        head.key = accountNumber;
+        head.aux = recordNumber;
+    }
+    head.value = recordNumber;
+    
+    fseek(file, recordNumber * (long)sizeof(TransactionLink), SEEK_SET);
+    int success = writeRecords(&link, sizeof(TransactionLink), 1, file) == 1;
+    
+    if (hasHistory) {
+        TransactionLink last;
+        fseek(file, link.prev * (long)sizeof(TransactionLink), SEEK_SET);
+        success = success && readRecords(&last, sizeof(TransactionLink), 1, file) == 1;
+        last.next = recordNumber;
+        fseek(file, link.prev * (long)sizeof(TransactionLink), SEEK_SET);
+        success = success && writeRecords(&last, sizeof(TransactionLink), 1, file) == 1;
+    }
+    success = (fclose(file) == 0) && success;
+    
+    return success && indexUpsert(TRANSACTIONS_HEADS, &head, recordNumber + 1);
+}
+
+// Links a run of records in one pass: the heads table is loaded once and
+// the new chain entries are written with a single append, before the old
+// tails are pointed at them
+int linkTransactionRange(long firstRecord, long count) {
+    if (count <= 0) return 1;
+    
+    FILE *file = openFile(TRANSACTIONS_HEADS, "rb");
+    if (file == NULL) return 0;
+    
+    IndexHeader header;
+    if (!readIndexHeader(file, &header) || header.recordCount != firstRecord) {
+        fclose(file);
+        return 0;
+    }
+    
+    IndexSlot *slots = malloc(header.bucketCount * sizeof(IndexSlot));
+    if (slots == NULL || readRecords(slots, sizeof(IndexSlot), header.bucketCount, file) != (size_t)header.bucketCount) {
+        free(slots);
+        fclose(file);
+        return 0;
+    }
+    fclose(file);
+    
+    long bucketCount = header.bucketCount;
+    long entryCount = header.entryCount;
+    
+    TransactionLink *links = malloc(count * sizeof(TransactionLink));
+    FILE *chain = openFile(TRANSACTIONS_CHAIN, "rb+");
+    int success = links != NULL && chain != NULL;
+    
+    // Read the run back in large blocks rather than record by record
+    LogRecord *block = malloc(BATCH_LOG_BUFFER * sizeof(LogRecord));
+    success = success && block != NULL;
+    
+    for (long i = 0; success && i < count; i++) {
+        long record = firstRecord + i;
+        if (i % BATCH_LOG_BUFFER == 0) {
+            long blockRecords = count - i < BATCH_LOG_BUFFER ? count - i : BATCH_LOG_BUFFER;
+            size_t length = blockRecords * sizeof(LogRecord);
+            if (readAt(transactionLog.fd, block, length, logOffset(record)) != (ssize_t)length ||
+                !mapTransactionIds(block, record, blockRecords)) {
+                success = 0;
+                break;
+            }
+        }
+        const LogRecord *transaction = &block[i % BATCH_LOG_BUFFER];
+        links[i].prev = -1;
+        links[i].next = -1;
+        if (transaction->accountNumber == 0) continue;  // voided record
+        
+        long bucket = indexBucket(transaction->accountNumber, bucketCount);
+        while (slots[bucket].key != 0 && slots[bucket].key != transaction->accountNumber) {
+            bucket = (bucket + 1) & (bucketCount - 1);
+        }
+        
+        if (slots[bucket].key == 0) {
+            slots[bucket].key = transaction->accountNumber;
+            slots[bucket].aux = record;
+            slots[bucket].value = record;
+            entryCount++;
+            
+            // Keep the table at most half full as new accounts show up
+            if (entryCount * 2 > bucketCount && !growIndexSlots(&slots, &bucketCount)) {
+                success = 0;
+                break;
+            }
+            continue;
+        } else {
+            long previous = slots[bucket].value;
+            links[i].prev = previous;
+            if (previous >= firstRecord) links[previous - firstRecord].next = record;
+        }
+        slots[bucket].value = record;
+    }
+    
+    if (success) {
+        fseek(chain, firstRecord * (long)sizeof(TransactionLink), SEEK_SET);
+        success = writeRecords(links, sizeof(TransactionLink), count, chain) == (size_t)count;
+    }
+    
+    // Accounts that already had history: their old tail lives in the
+    // existing part of the chain
+    for (long i = 0; success && i < count; i++) {
+        long previous = links[i].prev;
+        if (previous < 0 || previous >= firstRecord) continue;
+        
+        TransactionLink tail;
+        fseek(chain, previous * (long)sizeof(TransactionLink), SEEK_SET);
+        success = readRecords(&tail, sizeof(TransactionLink), 1, chain) == 1;
+        tail.next = firstRecord + i;
+        fseek(chain, previous * (long)sizeof(TransactionLink), SEEK_SET);
+        success = success && writeRecords(&tail, sizeof(TransactionLink), 1, chain) == 1;
+    }
+    if (chain != NULL) success = (fclose(chain) == 0) && success;
+    success = success && writeIndexFile(TRANSACTIONS_HEADS, slots, bucketCount, entryCount, firstRecord + count);
+    
+    free(block);
+    free(links);
+    free(slots);
+    return success;
+}
+
+// Works out how much of the log transactions.heads already covers after
+// an unclean shutdown, and cuts transactions.chain back to match, so only
+// the tail has to be linked again. A link past that point is written
+// before its predecessor points at it, so any forward pointer left behind
+// can be found from the discarded links. Returns the number of records
+// still covered, or -1 if the files need a full rebuild.
+long trimTransactionIndex(long transactionCount) {
+    FILE *file = openFile(TRANSACTIONS_HEADS, "rb");
+    if (file == NULL) return -1;
+    IndexHeader header;
+    int valid = readIndexHeader(file, &header);
+    fclose(file);
+    
+    long linkedCount = valid ? header.recordCount : -1;
+    if (linkedCount < 0 || linkedCount > transactionCount) return -1;
+    
+    file = openFile(TRANSACTIONS_CHAIN, "rb+");
+    if (file == NULL) return -1;
+    fseek(file, 0, SEEK_END);
+    long chainCount = ftell(file) / sizeof(TransactionLink);
+    int success = chainCount >= linkedCount;
+    
+    TransactionLink link, previous;
+    for (long record = linkedCount; success && record < chainCount; record++) {
+        fseek(file, record * (long)sizeof(TransactionLink), SEEK_SET);
+        success = readRecords(&link, sizeof(TransactionLink), 1, file) == 1;
+        if (!success || link.prev < 0 || link.prev >= linkedCount) continue;
+        
+        fseek(file, link.prev * (long)sizeof(TransactionLink), SEEK_SET);
+        success = readRecords(&previous, sizeof(TransactionLink), 1, file) == 1;
+        if (success && previous.next == record) {
+            previous.next = -1;
+            fseek(file, link.prev * (long)sizeof(TransactionLink), SEEK_SET);
+            success = writeRecords(&previous, sizeof(TransactionLink), 1, file) == 1;
+        }
+    }
+    success = (fclose(file) == 0) && success;
+    
+    if (!success || truncate(TRANSACTIONS_CHAIN, linkedCount * (long)sizeof(TransactionLink)) != 0) return -1;
+    return linkedCount;
+}
+
+// Transaction log functions
+
+// Cuts off a torn trailing record and a transfer whose second half never made it to disk
+long repairTransactionLog() {
+    FILE *file = openFile(TRANSACTIONS_DB, "rb");
+    if (file == NULL) return -1;
+    
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    long recordCount = logRecordCount(fileSize);
+    
+    LogRecord last;
+    if (recordCount > 0) {
+        fseek(file, logOffset(recordCount - 1), SEEK_SET);
+        if (readRecords(&last, sizeof(LogRecord), 1, file) == 1 && last.type == TX_TRANSFER_SENT) {
+            recordCount--;
+        }
+    }
+    fclose(file);
+    
+    if (logOffset(recordCount) != fileSize &&
+        truncate(TRANSACTIONS_DB, logOffset(recordCount)) != 0) {
+        return -1;
+    }
+    return recordCount;
+}
+
+// linkedCount is how much of the log the chain and heads files cover; the
+// caller links the rest with linkDeferredTransactions
+int openTransactionLog(long recordCount, long linkedCount) {
+    transactionLog.fd = openDescriptor(TRANSACTIONS_DB, O_RDWR, 0);
+    if (transactionLog.fd < 0) return 0;
+    
+    transactionLog.recordCount = recordCount;
+    transactionLog.linkedCount = linkedCount;
+    transactionLog.pendingRecords = 0;
+    if (!openTransactionIds(recordCount)) {
+        closeTransactionLog();
+        return 0;
+    }
+    
+    // A time window needs a thread to flush records nobody else commits after
+    if (transactionLog.groupCommitRecords > 1 && transactionLog.groupCommitMicros > 0) {
+        transactionLog.flusherRunning = 1;
+        if (pthread_create(&transactionLog.flusher, NULL, groupCommitFlusher, NULL) != 0) {
+            transactionLog.flusherRunning = 0;
+            closeTransactionLog();
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void closeTransactionLog() {
+    if (transactionLog.flusherRunning) {
+        pthread_mutex_lock(&transactionLog.lock);
+        transactionLog.flusherRunning = 0;
+        pthread_cond_signal(&transactionLog.wake);
+        pthread_mutex_unlock(&transactionLog.lock);
+        pthread_join(transactionLog.flusher, NULL);
+    }
+    closeTransactionIds();
+    if (transactionLog.fd >= 0) close(transactionLog.fd);
+    transactionLog.fd = -1;
+    
+    free(transactionLog.buffer);
+    transactionLog.buffer = NULL;
+    free(transactionLog.inFlight);
+    transactionLog.inFlight = NULL;
+    transactionLog.inFlightCount = 0;
+    transactionLog.inFlightCapacity = 0;
+    transactionLog.bufferedRecords = 0;
+    transactionLog.bufferCapacity = 0;
+    transactionLog.deferLinks = 0;
+}
+
+// Batch mode: collect appended records in memory and write them in large blocks
+int enableLogBuffering(int capacity) {
+    transactionLog.buffer = malloc(capacity * sizeof(LogRecord));
+    if (transactionLog.buffer == NULL) return 0;
+    transactionLog.bufferCapacity = capacity;
+    transactionLog.bufferedRecords = 0;
+    transactionLog.deferLinks = 1;
+    return 1;
+}
+
+// Hands buffered records to the OS in one write
+int flushLogBufferLocked() {
+    if (transactionLog.bufferedRecords == 0) return 1;
+    
+    long firstRecord = transactionLog.recordCount - transactionLog.bufferedRecords;
+    off_t offset = logOffset(firstRecord);
+    size_t length = transactionLog.bufferedRecords * sizeof(LogRecord);
+    size_t written = 0;
+    struct timespec start;
+    startMetric(&start);
+    
+    while (written < length) {
+        ssize_t result = writeAt(transactionLog.fd, (const char *)transactionLog.buffer + written,
+                                 length - written, offset + written);
+        if (result <= 0) return 0;
+        written += result;
+    }
+    stopMetric(METRIC_LOG_WRITE, &start);
+    transactionLog.bufferedRecords = 0;
+    return 1;
+}
+
+int flushTransactionLog() {
+    pthread_mutex_lock(&transactionLog.lock);
+    int success = flushLogBufferLocked();
+    pthread_mutex_unlock(&transactionLog.lock);
+    return success;
+}
+
+// Writes the records at the end of the log; they only count once committed
+int appendTransactions(LogRecord *records, int count, long *firstRecord) {
+    lockSharedLog();
+    pthread_mutex_lock(&transactionLog.lock);
+    int success = refreshSharedLogLocked() && appendTransactionsLocked(records, count, firstRecord);
+    pthread_mutex_unlock(&transactionLog.lock);
+    unlockSharedLog();
+    return success;
+}
+
+int appendTransactionsLocked(LogRecord *records, int count, long *firstRecord) {
+    // Room to track the append until it settles, so snapshots stop short of it
+    if (transactionLog.inFlightCount == transactionLog.inFlightCapacity) {
+        int capacity = transactionLog.inFlightCapacity > 0 ? transactionLog.inFlightCapacity * 2 : 16;
+        long *grown = realloc(transactionLog.inFlight, capacity * sizeof(long));
+        if (grown == NULL) return 0;
+        transactionLog.inFlight = grown;
+        transactionLog.inFlightCapacity = capacity;
+    }
+    if (!reserveTransactionIdsLocked(count)) return 0;
+    for (int i = 0; i < count; i++) {
+        records[i].transactionId = (int32_t)transactionLog.nextTransactionId++;
+    }
+    
+    // --shared: the next process to append carries on from here
+    int64_t next = transactionLog.nextTransactionId;
+    if (sharedLocks.fd >= 0 &&
+        writeAt(transactionLog.sequenceFd, &next, sizeof(next), sizeof(int64_t)) != sizeof(next)) {
+        return 0;
+    }
+    
+    if (transactionLog.buffer != NULL && count <= transactionLog.bufferCapacity) {
+        if (transactionLog.bufferedRecords + count > transactionLog.bufferCapacity &&
+            !flushLogBufferLocked()) {
+            return 0;
+        }
+        memcpy(transactionLog.buffer + transactionLog.bufferedRecords, records, count * sizeof(LogRecord));
+        transactionLog.bufferedRecords += count;
+        *firstRecord = transactionLog.recordCount;
+        transactionLog.recordCount += count;
+        transactionLog.inFlight[transactionLog.inFlightCount++] = *firstRecord;
+        indexRecordTimesLocked(records, *firstRecord, count);
+        rollUpRecordsLocked(records, count, 1);
+        noteVelocityLocked(records, count, 1);
+        return 1;
+    }
+    if (!flushLogBufferLocked()) return 0;
+    
+    off_t offset = logOffset(transactionLog.recordCount);
+    size_t length = count * sizeof(LogRecord);
+    size_t written = 0;
+    struct timespec start;
+    startMetric(&start);
+    
+    // One write per unit, so a transfer's two records reach the log together
+    while (written < length) {
+        ssize_t result = writeAt(transactionLog.fd, (const char *)records + written,
+                                 length - written, offset + written);
+        if (result <= 0) {
+            if (ftruncate(transactionLog.fd, offset) != 0) {
+                printf("⚠️  Could not remove a partial record from the transaction log.\n");
+            }
+            return 0;
+        }
+        written += result;
+    }
+    stopMetric(METRIC_LOG_WRITE, &start);
+    
+    *firstRecord = transactionLog.recordCount;
+    transactionLog.recordCount += count;
+    transactionLog.inFlight[transactionLog.inFlightCount++] = *firstRecord;
+    indexRecordTimesLocked(records, *firstRecord, count);
+    rollUpRecordsLocked(records, count, 1);
+    noteVelocityLocked(records, count, 1);
+    return 1;
+}
+
+// The append starting at firstRecord has been committed or rolled back
+void settleTransactionsLocked(long firstRecord) {
+    for (int i = 0; i < transactionLog.inFlightCount; i++) {
+        if (transactionLog.inFlight[i] == firstRecord) {
+            transactionLog.inFlight[i] = transactionLog.inFlight[--transactionLog.inFlightCount];
+            return;
+        }
+    }
+}
+
+// Undoes an append whose account change could not be applied. Records
+// still at the end of the log are cut off; if other threads have appended
+// since, they are voided in place instead (account 0, never linked).
+void rollbackTransactions(long firstRecord, int count) {
+    lockSharedLog();
+    pthread_mutex_lock(&transactionLog.lock);
+    refreshSharedLogLocked();
+    unrollRecordsLocked(firstRecord, count);
+    
+    long bufferStart = transactionLog.recordCount - transactionLog.bufferedRecords;
+    if (firstRecord + count == transactionLog.recordCount) {
+        if (firstRecord >= bufferStart) {
+            transactionLog.bufferedRecords -= count;
+            transactionLog.recordCount = firstRecord;
+        } else if (flushLogBufferLocked() &&
+                   ftruncate(transactionLog.fd, logOffset(firstRecord)) == 0) {
+            transactionLog.recordCount = firstRecord;
+        }
+    } else {
+        LogRecord voided;
+        memset(&voided, 0, sizeof(voided));
+        voided.type = TX_VOID;
+        voided.timestamp = currentMicros();
+        voided.description = internDescription("Rolled back");
+        
+        for (long record = firstRecord; record < firstRecord + count; record++) {
+            if (record >= bufferStart) {
+                transactionLog.buffer[record - bufferStart] = voided;
+            } else if (writeAt(transactionLog.fd, &voided, sizeof(LogRecord),
+                               logOffset(record)) != sizeof(LogRecord)) {
+                printf("⚠️  Could not void a rolled back record in the transaction log.\n");
+            }
+        }
+    }
+    settleTransactionsLocked(firstRecord);
+    
+    pthread_mutex_unlock(&transactionLog.lock);
+    unlockSharedLog();
+}
+
+int syncTransactionLogLocked() {
+    if (transactionLog.fd < 0 || transactionLog.pendingRecords == 0) return 1;
+    
+    struct timespec start;
+    startMetric(&start);
+    int success = flushLogBufferLocked() && syncDescriptionTable() && syncDescriptor(transactionLog.fd) == 0;
+    stopMetric(METRIC_LOG_SYNC, &start);
+    if (success) {
+        transactionLog.pendingRecords = 0;
+    } else {
+        printf("⚠️  Failed to flush the transaction log to disk.\n");
+    }
+    return success;
+}
+
+int syncTransactionLog() {
+    pthread_mutex_lock(&transactionLog.lock);
+    int success = syncTransactionLogLocked();
+    pthread_mutex_unlock(&transactionLog.lock);
+    return success;
+}
+
+long microsSince(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_nsec - start->tv_nsec) / 1000;
+}
+
+// Links the committed records into their accounts' history and applies the group-commit policy
+int commitTransactions(const LogRecord *records, int count, long firstRecord) {
+    // --shared: the chain and heads files are rewritten in place by every process
+    lockSharedLog();
+    pthread_mutex_lock(&transactionLog.lock);
+    
+    // The records are safely stored; a broken chain can always be rebuilt from them
+    if (!transactionLog.deferLinks) {
+        // A large unit such as the interest run is linked in one pass
+        int linked = count > 2 && transactionLog.linkedCount == firstRecord &&
+                     flushLogBufferLocked() && linkTransactionRange(firstRecord, count);
+        if (!linked) {
+            // IDs are mapped before the records are linked, so transactions.ids
+            // always covers at least what transactions.heads does
+            int indexed = mapTransactionIds(records, firstRecord, count);
+            for (int i = 0; indexed && i < count; i++) {
+                indexed = linkTransaction(records[i].accountNumber, firstRecord + i);
+            }
+            if (!indexed) {
+                indexed = flushLogBufferLocked() && rebuildTransactionIndex() &&
+                          rebuildTransactionIdMap(firstRecord + count);
+            }
+            if (!indexed) {
+                // Without transactions.heads and with an empty transactions.ids,
+                // the next start rebuilds both from the log
+                remove(TRANSACTIONS_HEADS);
+                if (ftruncate(transactionLog.idMapFd, 0) != 0) remove(TRANSACTIONS_IDS);
+                printf("⚠️  Could not update the transaction history index; it will be rebuilt at the next start.\n");
+            }
+        }
+        if (firstRecord + count > transactionLog.linkedCount) {
+            transactionLog.linkedCount = firstRecord + count;
+        }
+    }
+    settleTransactionsLocked(firstRecord);
+    
+    if (transactionLog.pendingRecords == 0) {
+        clock_gettime(CLOCK_REALTIME, &transactionLog.firstPending);
+    }
+    transactionLog.pendingRecords += count;
+    
+    int success = 1;
+    if (transactionLog.pendingRecords >= transactionLog.groupCommitRecords ||
+        (transactionLog.groupCommitMicros > 0 &&
+         microsSince(&transactionLog.firstPending) >= transactionLog.groupCommitMicros)) {
+        success = syncTransactionLogLocked();
+    } else if (transactionLog.flusherRunning) {
+        pthread_cond_signal(&transactionLog.wake);
+    }
+    
+    pthread_mutex_unlock(&transactionLog.lock);
+    unlockSharedLog();
+    return success;
+}
+
+// Flushes pending records once the oldest of them has waited groupCommitMicros
+void *groupCommitFlusher(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&transactionLog.lock);
+    
+    while (transactionLog.flusherRunning) {
+        if (transactionLog.pendingRecords == 0) {
+            pthread_cond_wait(&transactionLog.wake, &transactionLog.lock);
+            continue;
+        }
+        
+        struct timespec deadline = transactionLog.firstPending;
+        deadline.tv_sec += transactionLog.groupCommitMicros / 1000000;
+        deadline.tv_nsec += (transactionLog.groupCommitMicros % 1000000) * 1000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        
+        pthread_cond_timedwait(&transactionLog.wake, &transactionLog.lock, &deadline);
+        if (transactionLog.pendingRecords > 0 &&
+            microsSince(&transactionLog.firstPending) >= transactionLog.groupCommitMicros) {
+            syncTransactionLogLocked();
+        }
+    }
+    
+    pthread_mutex_unlock(&transactionLog.lock);
+    return NULL;
+}
+
+// Batch mode: brings the per-account chains up to date with every committed record
+int linkDeferredTransactions() {
+    pthread_mutex_lock(&transactionLog.lock);
+    
+    int success = flushLogBufferLocked();
+    long unlinked = transactionLog.recordCount - transactionLog.linkedCount;
+    if (success && unlinked > 0) {
+        success = linkTransactionRange(transactionLog.linkedCount, unlinked) ||
+                  (rebuildTransactionIndex() && rebuildTransactionIdMap(transactionLog.recordCount));
+        if (success) transactionLog.linkedCount = transactionLog.recordCount;
+    }
+    
+    pthread_mutex_unlock(&transactionLog.lock);
+    return success;
+}
+
+// Records an event that changes no account data
+int recordTransaction(LogRecord *record) {
+    long firstRecord;
+    if (!appendTransactions(record, 1, &firstRecord)) return 0;
+    return commitTransactions(record, 1, firstRecord);
+}
+
+int readLogRecord(long recordNumber, LogRecord *record) {
+    return readAt(transactionLog.fd, record, sizeof(LogRecord), logOffset(recordNumber)) == sizeof(LogRecord);
+}
+
+// Transaction ID functions
+
+// Picks up the ID sequence where the last session left it and makes sure
+// transactions.ids covers the linked part of the log; records past
+// linkedCount are mapped when they are linked
+int openTransactionIds(long recordCount) {
+    transactionLog.sequenceFd = openDescriptor(TRANSACTION_SEQUENCE, O_RDWR | O_CREAT, 0644);
+    transactionLog.idMapFd = openDescriptor(TRANSACTIONS_IDS, O_RDWR | O_CREAT, 0644);
+    if (transactionLog.sequenceFd < 0 || transactionLog.idMapFd < 0) return 0;
+    
+    int64_t reserved = 0;
+    if (readAt(transactionLog.sequenceFd, &reserved, sizeof(reserved), 0) != sizeof(reserved)) reserved = 0;
+    
+    long lastRecord, mappedRecord;
+    long lastId = newestTransactionId(recordCount, &lastRecord);
+    long mappedId = newestTransactionId(transactionLog.linkedCount, &mappedRecord);
+    if (lastId < 0 || mappedId < 0) return 0;
+    
+    if (mappedId > 0 && findTransactionRecord(mappedId) != mappedRecord) {
+        printf("🔧 Rebuilding the transaction ID index...\n");
+        if (!rebuildTransactionIdMap(transactionLog.linkedCount)) return 0;
+    }
+    
+    transactionLog.nextTransactionId = reserved > lastId ? reserved : lastId + 1;
+    if (transactionLog.nextTransactionId < 1) transactionLog.nextTransactionId = 1;
+    transactionLog.reservedTransactionId = transactionLog.nextTransactionId;
+    return 1;
+}
+
+// IDs rise with record number, so the newest numbered record among the
+// first recordCount holds the highest ID. Returns 0 if none of the last
+// TRANSACTION_ID_SCAN records has one, or -1 on a read error.
+long newestTransactionId(long recordCount, long *recordNumber) {
+    LogRecord record;
+    for (long last = recordCount - 1; last >= 0 && last >= recordCount - TRANSACTION_ID_SCAN; last--) {
+        if (!readLogRecord(last, &record)) return -1;
+        if (record.accountNumber != 0 && record.transactionId != 0) {
+            *recordNumber = last;
+            return record.transactionId;
+        }
+    }
+    *recordNumber = -1;
+    return 0;
+}
+
+// A clean shutdown gives back the unused part of the reservation, except
+// with --shared, where other processes may still be handing IDs out of it
+void closeTransactionIds() {
+    if (transactionLog.sequenceFd >= 0) {
+        int64_t next = transactionLog.nextTransactionId;
+        if (next > 0 && sharedLocks.fd < 0 && writeAt(transactionLog.sequenceFd, &next, sizeof(next), 0) == sizeof(next)) {
+            syncDescriptor(transactionLog.sequenceFd);
+        }
+        close(transactionLog.sequenceFd);
+    }
+    if (transactionLog.idMapFd >= 0) close(transactionLog.idMapFd);
+    transactionLog.sequenceFd = -1;
+    transactionLog.idMapFd = -1;
+}
+
+// Makes sure count more IDs are covered by the reservation on disk, so
+// none of them can be handed out again after a crash
+int reserveTransactionIdsLocked(int count) {
+    if (transactionLog.nextTransactionId + count <= transactionLog.reservedTransactionId) return 1;
+    if (transactionLog.nextTransactionId + count + TRANSACTION_ID_BLOCK > INT32_MAX) {
+        printf("❌ Transaction IDs are exhausted!\n");
+        return 0;
+    }
+    
+    int64_t reserved = transactionLog.nextTransactionId + count + TRANSACTION_ID_BLOCK;
+    if (writeAt(transactionLog.sequenceFd, &reserved, sizeof(reserved), 0) != sizeof(reserved) ||
+        syncDescriptor(transactionLog.sequenceFd) != 0) {
+        return 0;
+    }
+    transactionLog.reservedTransactionId = reserved;
+    return 1;
+}
+
+// Records where each of a run of log records lives, in one write. The IDs
+// of a run are ascending; gaps left by rolled back records are cleared.
+int mapTransactionIds(const LogRecord *records, long firstRecord, long count) {
+    long firstId = 0, lastId = 0;
+    for (long i = 0; i < count; i++) {
+        if (records[i].accountNumber == 0 || records[i].transactionId <= 0) continue;
+        if (firstId == 0) firstId = records[i].transactionId;
+        lastId = records[i].transactionId;
+    }
+    if (firstId == 0) return 1;
+    if (lastId < firstId) return 0;
+    
+    int64_t *entries = calloc(lastId - firstId + 1, sizeof(int64_t));
+    if (entries == NULL) return 0;
+    for (long i = 0; i < count; i++) {
+        if (records[i].accountNumber == 0 || records[i].transactionId <= 0) continue;
+        entries[records[i].transactionId - firstId] = firstRecord + i + 1;
+    }
+    
+    size_t length = (lastId - firstId + 1) * sizeof(int64_t);
+    int success = writeAt(transactionLog.idMapFd, entries, length, firstId * (off_t)sizeof(int64_t)) == (ssize_t)length;
+    free(entries);
+    return success;
+}
+
+int rebuildTransactionIdMap(long recordCount) {
+    if (ftruncate(transactionLog.idMapFd, 0) != 0) return 0;
+    
+    LogRecord *block = malloc(BATCH_LOG_BUFFER * sizeof(LogRecord));
+    int success = block != NULL;
+    for (long first = 0; success && first < recordCount; first += BATCH_LOG_BUFFER) {
+        long blockRecords = recordCount - first < BATCH_LOG_BUFFER ? recordCount - first : BATCH_LOG_BUFFER;
+        size_t length = blockRecords * sizeof(LogRecord);
+        success = readAt(transactionLog.fd, block, length, logOffset(first)) == (ssize_t)length &&
+                  mapTransactionIds(block, first, blockRecords);
+    }
+    free(block);
+    return success;
+}
+
+// Returns the record number holding the transaction, or -1 if there is none
+long findTransactionRecord(long transactionId) {
+    int64_t entry = 0;
+    LogRecord record;
+    if (transactionId <= 0 ||
+        readAt(transactionLog.idMapFd, &entry, sizeof(entry), transactionId * (off_t)sizeof(int64_t)) != sizeof(entry) ||
+        entry <= 0 || entry > transactionLog.recordCount) {
+        return -1;
+    }
+    
+    // Trust the entry only if the record it points at agrees
+    if (!readLogRecord(entry - 1, &record) || record.transactionId != transactionId || record.accountNumber == 0) {
+        return -1;
+    }
+    return entry - 1;
+}
+
+int findTransactionById(long transactionId, Transaction *transaction) {
+    if (!refreshSharedLog()) return 0;
+    long recordNumber = findTransactionRecord(transactionId);
+    LogRecord record;
+    if (recordNumber < 0 || !readLogRecord(recordNumber, &record)) return 0;
+    renderTransaction(&record, transaction);
+    return 1;
+}
+
+// Redoes the newest logged state of every account; returns how many needed repair
+long reconcileAccountsWithLog() {
+    StoreScan scan;
+    int mapped = accountMap.records != NULL;
+    if (!mapped) {
+        // Repairs go straight to the files, so cached copies would be stale
+        if (!flushAccountCache(1) || !openStoreScan(&scan, "rb+")) return -1;
+    }
+    
+    BankAccount account;
+    LogRecord newest;
+    IndexSlot head;
+    long repaired = 0, recordNumber;
+    
+    for (long record = 0; ; record++) {
+        if (!mapped) {
+            if (!nextStoreRecord(&scan, &account, &recordNumber)) break;
+        } else {
+            if (record >= accountMap.recordCount) break;
+            account = accountMap.records[record];
+        }
+        
+        if (!indexLookup(TRANSACTIONS_HEADS, account.accountNumber, &head) ||
+            !readLogRecord(head.value, &newest)) {
+            continue;
+        }
+        
+        int closed = newest.type == TX_ACCOUNT_CLOSURE;
+        if (account.balance == newest.balanceAfter && !(closed && account.isActive)) continue;
+        
+        account.balance = newest.balanceAfter;
+        if (closed) account.isActive = 0;
+        if (!mapped) {
+            rewriteStoreRecord(&scan, &account);
+        } else {
+            accountMap.records[record] = account;
+            syncMappedAccount(record);
+        }
+        repaired++;
+    }
+    
+    if (!mapped && !closeStoreScan(&scan)) return -1;
+    return repaired;
+}
+
+// Checkpoint functions
+
+uint64_t checkpointChecksum(uint64_t hash, const CheckpointEntry *entries, long count) {
+    const unsigned char *bytes = (const unsigned char *)entries;
+    for (size_t i = 0; i < count * sizeof(CheckpointEntry); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Writes accounts.ckpt for the current end of the log, with one entry per
+// store record in shard order. The log and the account files are forced to
+// disk first, so a checkpoint never claims more than has survived.
+// Postings must be kept out while it runs: the caller holds
+// accountStoreLock exclusively, or is the only thread.
+int writeCheckpoint() {
+    if (!linkDeferredTransactions() || !syncTransactionLog() || !flushAccountCache(0)) return 0;
+    
+    pthread_mutex_lock(&transactionLog.lock);
+    long position = transactionLog.recordCount;
+    pthread_mutex_unlock(&transactionLog.lock);
+    
+    StoreScan scan;
+    int mapped = accountMap.records != NULL;
+    long accountCount = accountMap.recordCount;
+    if (mapped) {
+        if (syncMapping(accountMap.records, accountCount * sizeof(BankAccount)) != 0) return 0;
+    } else {
+        accountCount = storeRecordCount();
+        if (accountCount < 0 || !syncAccountStore() || !openStoreScan(&scan, "rb")) return 0;
+    }
+    
+    CheckpointHeader header = { CHECKPOINT_MAGIC, CHECKPOINT_VERSION, position, accountCount,
+                                14695981039346656037ULL };
+    FILE *output = openFile(CHECKPOINT_TEMP, "wb");
+    BankAccount *block = malloc(ACCOUNT_MAP_CHUNK * sizeof(BankAccount));
+    CheckpointEntry *entries = malloc(ACCOUNT_MAP_CHUNK * sizeof(CheckpointEntry));
+    int success = output != NULL && block != NULL && entries != NULL &&
+                  writeRecords(&header, sizeof(header), 1, output) == 1;
+    
+    for (long first = 0; success && first < accountCount; first += ACCOUNT_MAP_CHUNK) {
+        long count = accountCount - first < ACCOUNT_MAP_CHUNK ? accountCount - first : ACCOUNT_MAP_CHUNK;
+        const BankAccount *accounts = mapped ? accountMap.records + first : block;
+        long recordNumber;
+        for (long i = 0; !mapped && success && i < count; i++) {
+            success = nextStoreRecord(&scan, &block[i], &recordNumber);
+        }
+        if (!success) break;
+        for (long i = 0; i < count; i++) {
+            entries[i].accountNumber = accounts[i].accountNumber;
+            entries[i].isActive = accounts[i].isActive;
+            entries[i].balance = accounts[i].balance;
+        }
+        header.checksum = checkpointChecksum(header.checksum, entries, count);
+        success = (long)writeRecords(entries, sizeof(CheckpointEntry), count, output) == count;
+    }
+    free(block);
+    free(entries);
+    if (!mapped) closeStoreScan(&scan);
+    
+    if (output != NULL) {
+        success = success && fseek(output, 0, SEEK_SET) == 0 && writeRecords(&header, sizeof(header), 1, output) == 1 &&
+                  fflush(output) == 0 && syncDescriptor(fileno(output)) == 0;
+        success = (fclose(output) == 0) && success;
+    }
+    
+    // The rename replaces the previous checkpoint only once the new one is complete
+    if (!success || rename(CHECKPOINT_TEMP, ACCOUNTS_CHECKPOINT) != 0) {
+        remove(CHECKPOINT_TEMP);
+        return 0;
+    }
+    pthread_mutex_lock(&transactionLog.lock);
+    checkpointPosition = position;
+    pthread_mutex_unlock(&transactionLog.lock);
+    
+    // The time index and the rollups are only summaries: if they cannot be
+    // saved, the next start reads a longer tail of the log to catch up
+    writeTimeIndex();
+    writeRollups();
+    return 1;
+}
+
+// Called between postings; takes a checkpoint once checkpointInterval
+// records have been committed since the last one
+int checkpointIfDue() {
+    if (checkpointInterval <= 0) return 1;
+    
+    pthread_mutex_lock(&transactionLog.lock);
+    int due = transactionLog.recordCount - checkpointPosition >= checkpointInterval;
+    pthread_mutex_unlock(&transactionLog.lock);
+    if (!due) return 1;
+    
+    // Another thread may have taken it while this one waited for the lock
+    lockAccountStore(1);
+    int success = transactionLog.recordCount - checkpointPosition < checkpointInterval || writeCheckpoint();
+    unlockAccountStore(1);
+    return success;
+}
+
+// Reads and checks accounts.ckpt; with entries NULL only the header is read
+int loadCheckpoint(CheckpointHeader *header, CheckpointEntry **entries) {
+    FILE *file = openFile(ACCOUNTS_CHECKPOINT, "rb");
+    if (file == NULL) return 0;
+    
+    int valid = readRecords(header, sizeof(CheckpointHeader), 1, file) == 1 &&
+                header->magic == CHECKPOINT_MAGIC && header->version == CHECKPOINT_VERSION &&
+                header->logPosition >= 0 && header->accountCount >= 0;
+    if (valid && entries != NULL) {
+        long count = header->accountCount;
+        *entries = malloc((count > 0 ? count : 1) * sizeof(CheckpointEntry));
+        valid = *entries != NULL && (long)readRecords(*entries, sizeof(CheckpointEntry), count, file) == count &&
+                checkpointChecksum(14695981039346656037ULL, *entries, count) == header->checksum;
+        if (!valid) {
+            free(*entries);
+            *entries = NULL;
+        }
+    }
+    fclose(file);
+    return valid;
+}
+
+// Time Index Functions
+
+int growTimeIndexLocked(long blockCount) {
+    if (blockCount > timeIndex.capacity) {
+        long capacity = timeIndex.capacity > 0 ? timeIndex.capacity : 64;
+        while (capacity < blockCount) capacity *= 2;
+        TimeBlock *grown = realloc(timeIndex.blocks, capacity * sizeof(TimeBlock));
+        if (grown == NULL) return 0;
+        timeIndex.blocks = grown;
+        timeIndex.capacity = capacity;
+    }
+    while (timeIndex.blockCount < blockCount) {
+        timeIndex.blocks[timeIndex.blockCount].earliest = INT64_MAX;
+        timeIndex.blocks[timeIndex.blockCount].latest = INT64_MIN;
+        timeIndex.blockCount++;
+    }
+    return 1;
+}
+
+// Widens the blocks holding records [firstRecord, firstRecord + count)
+void indexRecordTimesLocked(const LogRecord *records, long firstRecord, long count) {
+    if (count <= 0 || !timeIndex.valid) return;
+    if (!growTimeIndexLocked((firstRecord + count - 1) / TIME_INDEX_BLOCK + 1)) {
+        timeIndex.valid = 0;
+        return;
+    }
+    for (long i = 0; i < count; i++) {
+        TimeBlock *block = &timeIndex.blocks[(firstRecord + i) / TIME_INDEX_BLOCK];
+        if (records[i].timestamp < block->earliest) block->earliest = records[i].timestamp;
+        if (records[i].timestamp > block->latest) block->latest = records[i].timestamp;
+    }
+    if (firstRecord + count > timeIndex.recordCount) timeIndex.recordCount = firstRecord + count;
+}
+
+// Loads transactions.time and brings it up to date with the log. Only the
+// records written since it was last saved are read; without a usable file
+// the whole log is scanned once. A file covering more than the log (the
+// log was cut short after a crash) is kept: its extra width is harmless.
+int loadTimeIndex(long transactionCount) {
+    pthread_mutex_lock(&transactionLog.lock);
+    freeTimeIndex();
+    
+    TimeIndexHeader header;
+    FILE *file = openFile(TRANSACTIONS_TIME, "rb");
+    if (file != NULL) {
+        long blockCount = 0;
+        int usable = readRecords(&header, sizeof(header), 1, file) == 1 && header.magic == TIME_INDEX_MAGIC &&
+                     header.version == TIME_INDEX_VERSION && header.recordCount >= 0;
+        if (usable) {
+            long covered = header.recordCount < transactionCount ? header.recordCount : transactionCount;
+            blockCount = (covered + TIME_INDEX_BLOCK - 1) / TIME_INDEX_BLOCK;
+            usable = growTimeIndexLocked(blockCount) &&
+                     (long)readRecords(timeIndex.blocks, sizeof(TimeBlock), blockCount, file) == blockCount;
+            timeIndex.recordCount = covered;
+        }
+        if (!usable) {
+            timeIndex.blockCount = 0;
+            timeIndex.recordCount = 0;
+        }
+        fclose(file);
+    }
+    
+    LogRecord *block = malloc(TIME_INDEX_BLOCK * sizeof(LogRecord));
+    int success = block != NULL;
+    for (long first = timeIndex.recordCount; success && first < transactionCount; first += TIME_INDEX_BLOCK) {
+        long count = transactionCount - first < TIME_INDEX_BLOCK ? transactionCount - first : TIME_INDEX_BLOCK;
+        size_t length = count * sizeof(LogRecord);
+        success = readAt(transactionLog.fd, block, length, logOffset(first)) == (ssize_t)length;
+        if (success) indexRecordTimesLocked(block, first, count);
+    }
+    free(block);
+    success = success && timeIndex.valid;
+    pthread_mutex_unlock(&transactionLog.lock);
+    return success;
+}
+
+// Saves the time index through a temporary file, so a crash leaves either
+// the old file or the new one. Called with every checkpoint.
+int writeTimeIndex() {
+    pthread_mutex_lock(&transactionLog.lock);
+    if (!timeIndex.valid) {
+        pthread_mutex_unlock(&transactionLog.lock);
+        remove(TRANSACTIONS_TIME);
+        return 0;
+    }
+    
+    TimeIndexHeader header = { TIME_INDEX_MAGIC, TIME_INDEX_VERSION, timeIndex.recordCount };
+    long blockCount = (timeIndex.recordCount + TIME_INDEX_BLOCK - 1) / TIME_INDEX_BLOCK;
+    FILE *file = openFile(TIME_INDEX_TEMP, "wb");
+    int success = file != NULL && writeRecords(&header, sizeof(header), 1, file) == 1 &&
+                  (long)writeRecords(timeIndex.blocks, sizeof(TimeBlock), blockCount, file) == blockCount &&
+                  fflush(file) == 0 && syncDescriptor(fileno(file)) == 0;
+    if (file != NULL) success = (fclose(file) == 0) && success;
+    pthread_mutex_unlock(&transactionLog.lock);
+    
+    if (!success || rename(TIME_INDEX_TEMP, TRANSACTIONS_TIME) != 0) {
+        remove(TIME_INDEX_TEMP);
+        return 0;
+    }
+    return 1;
+}
+
+void freeTimeIndex() {
+    free(timeIndex.blocks);
+    timeIndex.blocks = NULL;
+    timeIndex.blockCount = 0;
+    timeIndex.capacity = 0;
+    timeIndex.recordCount = 0;
+    timeIndex.valid = 1;
+}
+
+// Rollup Functions
+
+// The local day (YYYYMMDD) a record falls on; records mostly arrive in
+// time order, so the last day's bounds usually answer without localtime_r
+int rollupDayLocked(int64_t timestamp) {
+    if (timestamp >= rollups.dayStart && timestamp < rollups.dayEnd) return rollups.currentDay;
+    
+    time_t seconds = (time_t)(timestamp / 1000000);
+    struct tm t;
+    localtime_r(&seconds, &t);
+    int day = (t.tm_year + 1900) * 10000 + (t.tm_mon + 1) * 100 + t.tm_mday;
+    
+    t.tm_hour = 0;
+    t.tm_min = 0;
+    t.tm_sec = 0;
+    t.tm_isdst = -1;
+    time_t start = mktime(&t);
+    t.tm_mday++;
+    t.tm_isdst = -1;
+    time_t end = mktime(&t);
+    
+    rollups.dayStart = (int64_t)start * 1000000;
+    rollups.dayEnd = (int64_t)end * 1000000;
+    rollups.currentDay = day;
+    return day;
+}
+
+// Finds a day's totals, adding an empty entry if create is set; NULL if
+// there is none or the table cannot grow
+DayRollup *findDayRollupLocked(int day, int create) {
+    if (create && (rollups.dayCount + 1) * 2 > rollups.dayBuckets) {
+        long bucketCount = indexBucketCount(rollups.dayCount + 1, 0);
+        DayRollup *grown = calloc(bucketCount, sizeof(DayRollup));
+        if (grown == NULL) return NULL;
+        for (long i = 0; i < rollups.dayBuckets; i++) {
+            if (rollups.days[i].day == 0) continue;
+            long bucket = indexBucket(rollups.days[i].day, bucketCount);
+            while (grown[bucket].day != 0) bucket = (bucket + 1) & (bucketCount - 1);
+            grown[bucket] = rollups.days[i];
+        }
+        free(rollups.days);
+        rollups.days = grown;
+        rollups.dayBuckets = bucketCount;
+    }
+    if (rollups.dayBuckets == 0) return NULL;
+    
+    long bucket = indexBucket(day, rollups.dayBuckets);
+    while (rollups.days[bucket].day != day) {
+        if (rollups.days[bucket].day == 0) {
+            if (!create) return NULL;
+            rollups.days[bucket].day = day;
+            rollups.dayCount++;
+            break;
+        }
+        bucket = (bucket + 1) & (rollups.dayBuckets - 1);
+    }
+    return &rollups.days[bucket];
+}
+
+long monthRollupBucket(int accountNumber, int month, long bucketCount) {
+    return indexBucket((int)((uint32_t)accountNumber * 16777619u ^ (uint32_t)month), bucketCount);
+}
+
+// Finds an account's totals for a month, as findDayRollupLocked does for days
+MonthRollup *findMonthRollupLocked(int accountNumber, int month, int create) {
+    if (create && (rollups.monthCount + 1) * 2 > rollups.monthBuckets) {
+        long bucketCount = indexBucketCount(rollups.monthCount + 1, 0);
+        MonthRollup *grown = calloc(bucketCount, sizeof(MonthRollup));
+        if (grown == NULL) return NULL;
+        for (long i = 0; i < rollups.monthBuckets; i++) {
+            const MonthRollup *entry = &rollups.months[i];
+            if (entry->accountNumber == 0) continue;
+            long bucket = monthRollupBucket(entry->accountNumber, entry->month, bucketCount);
+            while (grown[bucket].accountNumber != 0) bucket = (bucket + 1) & (bucketCount - 1);
+            grown[bucket] = *entry;
+        }
+        free(rollups.months);
+        rollups.months = grown;
+        rollups.monthBuckets = bucketCount;
+    }
+    if (rollups.monthBuckets == 0) return NULL;
+    
+    long bucket = monthRollupBucket(accountNumber, month, rollups.monthBuckets);
+    while (rollups.months[bucket].accountNumber != accountNumber || rollups.months[bucket].month != month) {
+        if (rollups.months[bucket].accountNumber == 0) {
+            if (!create) return NULL;
+            rollups.months[bucket].accountNumber = accountNumber;
+            rollups.months[bucket].month = month;
+            rollups.monthCount++;
+            break;
+        }
+        bucket = (bucket + 1) & (rollups.monthBuckets - 1);
+    }
+    return &rollups.months[bucket];
+}
+
+// Adds records to the totals (sign 1) or takes them out again (sign -1);
+// voided records never count
+void rollUpRecordsLocked(const LogRecord *records, long count, int sign) {
+    for (long i = 0; rollups.valid && i < count; i++) {
+        const LogRecord *record = &records[i];
+        if (record->type == TX_VOID || record->type >= TX_TYPES) continue;
+        
+        int day = rollupDayLocked(record->timestamp);
+        DayRollup *daily = findDayRollupLocked(day, 1);
+        MonthRollup *monthly = record->accountNumber != 0 ?
+                               findMonthRollupLocked(record->accountNumber, day / 100, 1) : NULL;
+        if (daily == NULL || (record->accountNumber != 0 && monthly == NULL)) {
+            rollups.valid = 0;
+            return;
+        }
+        daily->counts[record->type] += sign;
+        daily->amounts[record->type] += sign * record->amount;
+        if (monthly == NULL) continue;
+        
+        int64_t change = record->balanceAfter - balanceBefore(record);
+        if (change > 0) monthly->moneyIn += sign * change;
+        else monthly->moneyOut -= sign * change;
+        monthly->records += sign;
+    }
+}
+
+// Takes an append that is being rolled back out of the totals and the
+// velocity counters, reading its records back from the log buffer or the file
+void unrollRecordsLocked(long firstRecord, long count) {
+    long bufferStart = transactionLog.recordCount - transactionLog.bufferedRecords;
+    LogRecord block[64];
+    
+    for (long first = firstRecord; first < firstRecord + count; first += 64) {
+        long blockRecords = firstRecord + count - first < 64 ? firstRecord + count - first : 64;
+        for (long i = 0; i < blockRecords; i++) {
+            long record = first + i;
+            if (record >= bufferStart) {
+                block[i] = transactionLog.buffer[record - bufferStart];
+            } else if (readAt(transactionLog.fd, &block[i], sizeof(LogRecord), logOffset(record)) !=
+                       sizeof(LogRecord)) {
+                rollups.valid = 0;
+                return;
+            }
+        }
+        rollUpRecordsLocked(block, blockRecords, -1);
+        noteVelocityLocked(block, blockRecords, -1);
+    }
+}
+
+// Loads transactions.rollup and brings it up to date with the log. Only the
+// records written since it was last saved are read. Without a usable file,
+// or with one covering more than the log (the log was cut short after a
+// crash), the totals are rebuilt from the whole log.
+int loadRollups(long transactionCount) {
+    pthread_mutex_lock(&transactionLog.lock);
+    freeRollups();
+    
+    RollupHeader header;
+    long covered = 0;
+    FILE *file = openFile(TRANSACTIONS_ROLLUP, "rb");
+    if (file != NULL) {
+        int usable = readRecords(&header, sizeof(header), 1, file) == 1 && header.magic == ROLLUP_MAGIC &&
+                     header.version == ROLLUP_VERSION && header.recordCount >= 0 &&
+                     header.recordCount <= transactionCount && header.dayCount >= 0 && header.monthCount >= 0;
+        DayRollup *days = NULL;
+        MonthRollup *months = NULL;
+        if (usable) {
+            days = malloc((header.dayCount > 0 ? header.dayCount : 1) * sizeof(DayRollup));
+            months = malloc((header.monthCount > 0 ? header.monthCount : 1) * sizeof(MonthRollup));
+        }
+        usable = days != NULL && months != NULL &&
+                 (long)readRecords(days, sizeof(DayRollup), header.dayCount, file) == header.dayCount &&
+                 (long)readRecords(months, sizeof(MonthRollup), header.monthCount, file) == header.monthCount;
+        
+        for (long i = 0; usable && i < header.dayCount; i++) {
+            DayRollup *slot = days[i].day != 0 ? findDayRollupLocked(days[i].day, 1) : NULL;
+            usable = slot != NULL;
+            if (usable) *slot = days[i];
+        }
+        for (long i = 0; usable && i < header.monthCount; i++) {
+            MonthRollup *slot = months[i].accountNumber != 0 ?
+                                findMonthRollupLocked(months[i].accountNumber, months[i].month, 1) : NULL;
+            usable = slot != NULL;
+            if (usable) *slot = months[i];
+        }
+        free(days);
+        free(months);
+        fclose(file);
+        
+        if (usable) covered = header.recordCount;
+        else freeRollups();
+    }
+    
+    LogRecord *block = malloc(TIME_INDEX_BLOCK * sizeof(LogRecord));
+    int success = block != NULL;
+    for (long first = covered; success && first < transactionCount; first += TIME_INDEX_BLOCK) {
+        long count = transactionCount - first < TIME_INDEX_BLOCK ? transactionCount - first : TIME_INDEX_BLOCK;
+        size_t length = count * sizeof(LogRecord);
+        success = readAt(transactionLog.fd, block, length, logOffset(first)) == (ssize_t)length;
+        if (success) rollUpRecordsLocked(block, count, 1);
+    }
+    free(block);
+    success = success && rollups.valid;
+    if (!success) rollups.valid = 0;
+    pthread_mutex_unlock(&transactionLog.lock);
+    return success;
+}
+
+// Saves the rollups through a temporary file, so a crash leaves either the
+// old file or the new one. Called with every checkpoint, while no append
+// is in flight, so the totals cover exactly the records in the log.
+int writeRollups() {
+    pthread_mutex_lock(&transactionLog.lock);
+    if (!rollups.valid) {
+        pthread_mutex_unlock(&transactionLog.lock);
+        remove(TRANSACTIONS_ROLLUP);
+        return 0;
+    }
+    
+    RollupHeader header = { ROLLUP_MAGIC, ROLLUP_VERSION, transactionLog.recordCount,
+                            rollups.dayCount, rollups.monthCount };
+    FILE *file = openFile(ROLLUP_TEMP, "wb");
+    if (file != NULL) setvbuf(file, NULL, _IOFBF, 1 << 20);
+    int success = file != NULL && writeRecords(&header, sizeof(header), 1, file) == 1;
+    for (long i = 0; success && i < rollups.dayBuckets; i++) {
+        if (rollups.days[i].day != 0) success = writeRecords(&rollups.days[i], sizeof(DayRollup), 1, file) == 1;
+    }
+    for (long i = 0; success && i < rollups.monthBuckets; i++) {
+        if (rollups.months[i].accountNumber != 0) {
+            success = writeRecords(&rollups.months[i], sizeof(MonthRollup), 1, file) == 1;
+        }
+    }
+    success = success && fflush(file) == 0 && syncDescriptor(fileno(file)) == 0;
+    if (file != NULL) success = (fclose(file) == 0) && success;
+    pthread_mutex_unlock(&transactionLog.lock);
+    
+    if (!success || rename(ROLLUP_TEMP, TRANSACTIONS_ROLLUP) != 0) {
+        remove(ROLLUP_TEMP);
+        return 0;
+    }
+    return 1;
+}
+
+void freeRollups() {
+    free(rollups.days);
+    free(rollups.months);
+    rollups.days = NULL;
+    rollups.months = NULL;
+    rollups.dayBuckets = 0;
+    rollups.dayCount = 0;
+    rollups.monthBuckets = 0;
+    rollups.monthCount = 0;
+    rollups.dayStart = 0;
+    rollups.dayEnd = 0;
+    rollups.currentDay = 0;
+    rollups.valid = 1;
+}
+
+// Copies one day's totals. Returns 1, 0 if nothing was logged that day,
+// or -1 if the totals are unavailable.
+int readDayRollup(int day, DayRollup *totals) {
+    refreshSharedLog();
+    pthread_mutex_lock(&transactionLog.lock);
+    const DayRollup *found = rollups.valid ? findDayRollupLocked(day, 0) : NULL;
+    int result = rollups.valid ? found != NULL : -1;
+    if (found != NULL) *totals = *found;
+    pthread_mutex_unlock(&transactionLog.lock);
+    return result;
+}
+
+// The same for one account's month
+int readMonthRollup(int accountNumber, int month, MonthRollup *totals) {
+    refreshSharedLog();
+    pthread_mutex_lock(&transactionLog.lock);
+    const MonthRollup *found = rollups.valid ? findMonthRollupLocked(accountNumber, month, 0) : NULL;
+    int result = rollups.valid ? found != NULL : -1;
+    if (found != NULL) *totals = *found;
+    pthread_mutex_unlock(&transactionLog.lock);
+    return result;
+}
+
+// Velocity Limit Functions
+
+// Length of one bucket of the amount window, or of the transfer hour
+int64_t velocitySlotMicros(int transfers) {
+    int64_t window = transfers ? 60 : velocityLimits.windowMinutes;
+    return window * 60 * 1000000 / VELOCITY_SLOTS;
+}
+
+// Moves both rings forward to the given slots, emptying the buckets they
+// pass over; a ring idle for a whole window is simply cleared
+void advanceVelocityEntry(VelocityEntry *entry, int64_t amountSlot, int64_t transferSlot) {
+    if (amountSlot - entry->amountSlot >= VELOCITY_SLOTS) {
+        memset(entry->amounts, 0, sizeof(entry->amounts));
+        entry->amountTotal = 0;
+    } else {
+        for (int64_t slot = entry->amountSlot + 1; slot <= amountSlot; slot++) {
+            entry->amountTotal -= entry->amounts[slot % VELOCITY_SLOTS];
+            entry->amounts[slot % VELOCITY_SLOTS] = 0;
+        }
+    }
+    if (amountSlot > entry->amountSlot) entry->amountSlot = amountSlot;
+    
+    if (transferSlot - entry->transferSlot >= VELOCITY_SLOTS) {
+        memset(entry->transfers, 0, sizeof(entry->transfers));
+        entry->transferTotal = 0;
+    } else {
+        for (int64_t slot = entry->transferSlot + 1; slot <= transferSlot; slot++) {
+            entry->transferTotal -= entry->transfers[slot % VELOCITY_SLOTS];
+            entry->transfers[slot % VELOCITY_SLOTS] = 0;
+        }
+    }
+    if (transferSlot > entry->transferSlot) entry->transferSlot = transferSlot;
+}
+
+// Finds an account's counters, adding empty ones if create is set; NULL if
+// there are none or the table cannot grow. Accounts with nothing left in
+// either window are dropped whenever the table is rebuilt, and it is sized
+// for twice the survivors, so rebuilds stay rare however long the process runs.
+VelocityEntry *findVelocityEntryLocked(int accountNumber, int create) {
+    if (create && (velocityLimits.entryCount + 1) * 2 > velocityLimits.bucketCount) {
+        int64_t now = currentMicros();
+        int64_t amountSlot = now / velocitySlotMicros(0);
+        int64_t transferSlot = now / velocitySlotMicros(1);
+        long live = 0;
+        for (long i = 0; i < velocityLimits.bucketCount; i++) {
+            const VelocityEntry *entry = &velocityLimits.entries[i];
+            if (entry->accountNumber != 0 && (entry->amountSlot > amountSlot - VELOCITY_SLOTS ||
+                                              entry->transferSlot > transferSlot - VELOCITY_SLOTS)) {
+                live++;
+            }
+        }
+        
+        long bucketCount = indexBucketCount((live + 1) * 2, 0);
+        VelocityEntry *grown = calloc(bucketCount, sizeof(VelocityEntry));
+        if (grown == NULL) return NULL;
+        for (long i = 0; i < velocityLimits.bucketCount; i++) {
+            const VelocityEntry *entry = &velocityLimits.entries[i];
+            if (entry->accountNumber == 0 || (entry->amountSlot <= amountSlot - VELOCITY_SLOTS &&
+                                              entry->transferSlot <= transferSlot - VELOCITY_SLOTS)) {
+                continue;
+            }
+            long bucket = indexBucket(entry->accountNumber, bucketCount);
+            while (grown[bucket].accountNumber != 0) bucket = (bucket + 1) & (bucketCount - 1);
+            grown[bucket] = *entry;
+        }
+        free(velocityLimits.entries);
+        velocityLimits.entries = grown;
+        velocityLimits.bucketCount = bucketCount;
+        velocityLimits.entryCount = live;
+    }
+    if (velocityLimits.bucketCount == 0) return NULL;
+    
+    long bucket = indexBucket(accountNumber, velocityLimits.bucketCount);
+    while (velocityLimits.entries[bucket].accountNumber != accountNumber) {
+        if (velocityLimits.entries[bucket].accountNumber == 0) {
+            if (!create) return NULL;
+            velocityLimits.entries[bucket].accountNumber = accountNumber;
+            velocityLimits.entryCount++;
+            break;
+        }
+        bucket = (bucket + 1) & (velocityLimits.bucketCount - 1);
+    }
+    return &velocityLimits.entries[bucket];
+}
+
+// Counts withdrawals and sent transfers against their account's limits
+// (sign 1) or takes them out again (sign -1), in the bucket of each
+// record's own timestamp. A record older than its ring's oldest bucket
+// has already slid out of the window and is left alone. Called with
+// transactionLog.lock held.
+void noteVelocityLocked(const LogRecord *records, long count, int sign) {
+    if (velocityLimits.amountLimit == 0 && velocityLimits.transferLimit == 0) return;
+    int64_t amountMicros = velocitySlotMicros(0);
+    int64_t transferMicros = velocitySlotMicros(1);
+    
+    pthread_mutex_lock(&velocityLimits.lock);
+    for (long i = 0; velocityLimits.valid && i < count; i++) {
+        const LogRecord *record = &records[i];
+        if ((record->type != TX_WITHDRAWAL && record->type != TX_TRANSFER_SENT) || record->accountNumber == 0) {
+            continue;
+        }
+        VelocityEntry *entry = findVelocityEntryLocked(record->accountNumber, sign > 0);
+        if (entry == NULL) {
+            if (sign < 0) continue;
+            printf("⚠️  Out of memory for the velocity limits; they are off for the rest of this session.\n");
+            velocityLimits.valid = 0;
+            break;
+        }
+        
+        int64_t amountSlot = record->timestamp / amountMicros;
+        int64_t transferSlot = record->timestamp / transferMicros;
+        if (sign > 0) advanceVelocityEntry(entry, amountSlot, transferSlot);
+        if (amountSlot <= entry->amountSlot && amountSlot > entry->amountSlot - VELOCITY_SLOTS) {
+            entry->amounts[amountSlot % VELOCITY_SLOTS] += sign * record->amount;
+            entry->amountTotal += sign * record->amount;
+        }
+        if (record->type == TX_TRANSFER_SENT && transferSlot <= entry->transferSlot &&
+            transferSlot > entry->transferSlot - VELOCITY_SLOTS) {
+            entry->transfers[transferSlot % VELOCITY_SLOTS] += sign;
+            entry->transferTotal += sign;
+        }
+    }
+    pthread_mutex_unlock(&velocityLimits.lock);
+}
+
+// Rebuilds the counters from the tail of the log. The time index says
+// which blocks hold records young enough to matter, so a restart reads
+// about one window of history, not the whole log.
+int loadVelocity(long transactionCount) {
+    pthread_mutex_lock(&transactionLog.lock);
+    freeVelocity();
+    if (velocityLimits.amountLimit == 0 && velocityLimits.transferLimit == 0) {
+        pthread_mutex_unlock(&transactionLog.lock);
+        return 1;
+    }
+    
+    int windowMinutes = velocityLimits.windowMinutes > 60 ? velocityLimits.windowMinutes : 60;
+    int64_t cutoff = currentMicros() - (int64_t)windowMinutes * 60 * 1000000;
+    long first = 0;
+    if (timeIndex.valid) {
+        long block = 0;
+        while (block < timeIndex.blockCount && timeIndex.blocks[block].latest < cutoff) block++;
+        first = block * TIME_INDEX_BLOCK;
+    }
+    
+    LogRecord *block = malloc(TIME_INDEX_BLOCK * sizeof(LogRecord));
+    int success = block != NULL;
+    for (; success && first < transactionCount; first += TIME_INDEX_BLOCK) {
+        long count = transactionCount - first < TIME_INDEX_BLOCK ? transactionCount - first : TIME_INDEX_BLOCK;
+        size_t length = count * sizeof(LogRecord);
+        success = readAt(transactionLog.fd, block, length, logOffset(first)) == (ssize_t)length;
+        if (success) noteVelocityLocked(block, count, 1);
+    }
+    free(block);
+    success = success && velocityLimits.valid;
+    if (!success) velocityLimits.valid = 0;
+    pthread_mutex_unlock(&transactionLog.lock);
+    return success;
+}
+
+void freeVelocity() {
+    free(velocityLimits.entries);
+    velocityLimits.entries = NULL;
+    velocityLimits.bucketCount = 0;
+    velocityLimits.entryCount = 0;
+    velocityLimits.valid = 1;
+}
+
+// Bulk runs post far faster than any customer, so they skip the limits
+// unless they were asked for on the command line
+void disableVelocityLimits() {
+    if (velocityLimits.set) return;
+    velocityLimits.amountLimit = 0;
+    velocityLimits.transferLimit = 0;
+}
+
+// Whether an account may send amountCents more, as a withdrawal or (with
+// transfer set) a transfer, within its limits. One probe of the table, so
+// the answer takes microseconds. The caller holds the account's locks, so
+// nothing else can debit it between this check and the append.
+PostResult checkVelocity(int accountNumber, long amountCents, int transfer) {
+    if (velocityLimits.amountLimit == 0 && velocityLimits.transferLimit == 0) return POST_OK;
+    struct timespec start;
+    startMetric(&start);
+    
+    // --shared: other processes' postings count as well
+    refreshSharedLog();
+    pthread_mutex_lock(&velocityLimits.lock);
+    int64_t sent = 0;
+    int transfers = 0;
+    VelocityEntry *entry = velocityLimits.valid ? findVelocityEntryLocked(accountNumber, 0) : NULL;
+    if (entry != NULL) {
+        int64_t now = currentMicros();
+        advanceVelocityEntry(entry, now / velocitySlotMicros(0), now / velocitySlotMicros(1));
+        sent = entry->amountTotal;
+        transfers = entry->transferTotal;
+    }
+    int enforced = velocityLimits.valid;
+    pthread_mutex_unlock(&velocityLimits.lock);
+    
+    PostResult result = POST_OK;
+    if (enforced && velocityLimits.amountLimit > 0 && sent + amountCents > velocityLimits.amountLimit) {
+        result = POST_VELOCITY_LIMIT;
+    }
+    if (enforced && transfer && velocityLimits.transferLimit > 0 && transfers >= velocityLimits.transferLimit) {
+        result = POST_VELOCITY_LIMIT;
+    }
+    stopMetric(METRIC_VELOCITY_CHECK, &start);
+    return result;
+}
+
+void showVelocityLimits() {
+    if (velocityLimits.amountLimit > 0) {
+        printf("   Limit: K%.2f out of the account per %d minutes\n",
+               centsToFloat(velocityLimits.amountLimit), velocityLimits.windowMinutes);
+    }
+    if (velocityLimits.transferLimit > 0) {
+        printf("   Limit: %d transfers per hour\n", velocityLimits.transferLimit);
+    }
+}
+
+// Log replay functions
+
+// The balance an account had before the record, worked back from the
+// amount; records that move no money leave it unchanged
+int64_t balanceBefore(const LogRecord *record) {
+    switch (record->type) {
+        case TX_DEPOSIT:
+        case TX_TRANSFER_RECEIVED:
+        case TX_INTEREST:
+            return record->balanceAfter - record->amount;
+        case TX_WITHDRAWAL:
+        case TX_TRANSFER_SENT:
+            return record->balanceAfter + record->amount;
+        case TX_ACCOUNT_CREATION:
+            return 0;
+        default:
+            return record->balanceAfter;
+    }
+}
+
+int initReplayTable(ReplayTable *table, long expectedAccounts) {
+    table->bucketCount = indexBucketCount(expectedAccounts, REPLAY_MIN_SLOTS);
+    table->entryCount = 0;
+    table->slots = calloc(table->bucketCount, sizeof(AccountReplay));
+    return table->slots != NULL;
+}
+
+// Finds an account's replay state; with create, adds it if it is new.
+// Returns NULL if the account is not there, or the table cannot grow.
+AccountReplay *replayEntry(ReplayTable *table, int accountNumber, int create) {
+    long bucket = indexBucket(accountNumber, table->bucketCount);
+    while (table->slots[bucket].accountNumber != 0 && table->slots[bucket].accountNumber != accountNumber) {
+        bucket = (bucket + 1) & (table->bucketCount - 1);
+    }
+    if (table->slots[bucket].accountNumber != 0 || !create) {
+        return table->slots[bucket].accountNumber != 0 ? &table->slots[bucket] : NULL;
+    }
+    
+    // Keep the table at most half full as new accounts show up
+    if ((table->entryCount + 1) * 2 > table->bucketCount) {
+        long bucketCount = table->bucketCount * 2;
+        AccountReplay *grown = calloc(bucketCount, sizeof(AccountReplay));
+        if (grown == NULL) return NULL;
+        for (long i = 0; i < table->bucketCount; i++) {
+            if (table->slots[i].accountNumber == 0) continue;
+            long target = indexBucket(table->slots[i].accountNumber, bucketCount);
+            while (grown[target].accountNumber != 0) target = (target + 1) & (bucketCount - 1);
+            grown[target] = table->slots[i];
+        }
+        free(table->slots);
+        table->slots = grown;
+        table->bucketCount = bucketCount;
+        return replayEntry(table, accountNumber, create);
+    }
+    
+    AccountReplay *state = &table->slots[bucket];
+    state->accountNumber = accountNumber;
+    state->closed = -1;
+    table->entryCount++;
+    return state;
+}
+
+void replayRecord(AccountReplay *state, const LogRecord *record) {
+    int64_t before = balanceBefore(record);
+    if (state->records == 0) {
+        state->openingBalance = before;
+        state->opened = record->type == TX_ACCOUNT_CREATION;
+    } else if (record->type != TX_ACCOUNT_CREATION && before != state->balance) {
+        state->breaks++;
+    }
+    
+    state->balance = record->balanceAfter;
+    if (record->type == TX_ACCOUNT_CREATION) state->closed = 0;
+    if (record->type == TX_ACCOUNT_CLOSURE) state->closed = 1;
+    state->records++;
+}
+
+// Replays log records [firstRecord, firstRecord + recordCount) into table
+int replayLogRange(ReplayTable *table, long firstRecord, long recordCount) {
+    LogRecord *block = malloc(BATCH_LOG_BUFFER * sizeof(LogRecord));
+    int success = block != NULL;
+    
+    for (long first = firstRecord; success && first < firstRecord + recordCount; first += BATCH_LOG_BUFFER) {
+        long blockRecords = firstRecord + recordCount - first;
+        if (blockRecords > BATCH_LOG_BUFFER) blockRecords = BATCH_LOG_BUFFER;
+        size_t length = blockRecords * sizeof(LogRecord);
+        success = readAt(transactionLog.fd, block, length, logOffset(first)) == (ssize_t)length;
+        
+        for (long i = 0; success && i < blockRecords; i++) {
+            if (block[i].accountNumber == 0 || block[i].type == TX_VOID) continue;
+            AccountReplay *state = replayEntry(table, block[i].accountNumber, 1);
+            success = state != NULL;
+            if (success) replayRecord(state, &block[i]);
+        }
+    }
+    free(block);
+    return success;
+}
+
+// Recovery after an unclean shutdown: loads the checkpoint, replays only
+// the records written after it, and puts every account back to the state
+// the two give together. The log itself is only read from the checkpoint
+// position on, so the work grows with the tail, not the whole history.
+// Returns the number of accounts repaired, -1 on error, or -2 if there is
+// no usable checkpoint.
+long replayLogTail() {
+    CheckpointHeader header;
+    CheckpointEntry *entries = NULL;
+    long recordCount = transactionLog.recordCount;
+    if (!loadCheckpoint(&header, &entries)) return -2;
+    if (header.logPosition > recordCount) {
+        free(entries);
+        return -2;
+    }
+    
+    ReplayTable table;
+    long tailRecords = recordCount - header.logPosition;
+    int success = initReplayTable(&table, 0) && replayLogRange(&table, header.logPosition, tailRecords);
+    
+    StoreScan scan = { NULL, 0, NULL, 0, 0 };
+    int mapped = accountMap.records != NULL;
+    if (success && !mapped) {
+        // Repairs go straight to the files, so cached copies would be stale
+        success = flushAccountCache(1) && openStoreScan(&scan, "rb+");
+    }
+    
+    // The entries run shard after shard, each shard as it was at the
+    // checkpoint; accounts added since then are only at the end of a shard
+    long shardStarts[MAX_SHARDS + 1] = { 0 };
+    for (long i = 0; i < header.accountCount; i++) {
+        shardStarts[shardOfAccount(&shardMap, entries[i].accountNumber) + 1]++;
+    }
+    for (int shard = 0; shard < shardMap.shardCount; shard++) shardStarts[shard + 1] += shardStarts[shard];
+    
+    BankAccount account;
+    long repaired = 0, breaks = 0, recordNumber;
+    for (long record = 0; success; record++) {
+        long entry = record;
+        if (!mapped) {
+            if (!nextStoreRecord(&scan, &account, &recordNumber)) break;
+            int shard = recordShard(recordNumber);
+            entry = shardStarts[shard] + recordInShard(recordNumber);
+            if (entry >= shardStarts[shard + 1]) entry = header.accountCount;
+        } else {
+            if (record >= accountMap.recordCount) break;
+            account = accountMap.records[record];
+        }
+        
+        const CheckpointEntry *saved = entry < header.accountCount &&
+                                       entries[entry].accountNumber == account.accountNumber ?
+                                       &entries[entry] : NULL;
+        AccountReplay *state = replayEntry(&table, account.accountNumber, 0);
+        long balance;
+        int closed;
+        
+        if (state != NULL) {
+            // The tail must pick up where the checkpoint left the account
+            breaks += state->breaks;
+            if (saved != NULL && !state->opened && saved->balance != state->openingBalance) breaks++;
+            balance = state->balance;
+            closed = state->closed == 1;
+        } else if (saved != NULL) {
+            balance = saved->balance;
+            closed = !saved->isActive;
+        } else {
+            continue;
+        }
+        
+        if (account.balance == balance && !(closed && account.isActive)) continue;
+        account.balance = balance;
+        if (closed) account.isActive = 0;
+        if (!mapped) {
+            success = rewriteStoreRecord(&scan, &account);
+        } else {
+            accountMap.records[record] = account;
+            syncMappedAccount(record);
+        }
+        repaired++;
+    }
+    
+    if (!mapped && !closeStoreScan(&scan)) success = 0;
+    free(table.slots);
+    free(entries);
+    if (!success) return -1;
+    
+    if (tailRecords > 0) {
+        printf("🔧 Replayed %ld transaction(s) written after the last checkpoint.\n", tailRecords);
+    }
+    if (breaks > 0) {
+        printf("⚠️  %ld transaction(s) do not follow on from the balance before them; run --verify for details.\n",
+               breaks);
+    }
+    return repaired;
+}
+
+void *verifyShardWorker(void *arg) {
+    VerifyShard *shard = arg;
+    shard->failed = !initReplayTable(&shard->table, 0) ||
+                    !replayLogRange(&shard->table, shard->firstRecord, shard->recordCount);
+    return NULL;
+}
+
+// Compares one stored account with the balance and state rebuilt from the log
+void checkAccountAgainstLog(ReplayTable *ledger, const BankAccount *account, long *mismatched, long *unlogged) {
+    AccountReplay *state = replayEntry(ledger, account->accountNumber, 0);
+    if (state == NULL) {
+        if (++*unlogged <= 10) printf("  account %d has no transactions in the log\n", account->accountNumber);
+        return;
+    }
+    state->matched = 1;
+    
+    int closed = state->closed == 1;
+    if (account->balance != state->balance || closed == account->isActive) {
+        if (++*mismatched <= 10) {
+            printf("  account %d: accounts.db K%.2f%s, log K%.2f%s\n", account->accountNumber,
+                   centsToFloat(account->balance), account->isActive ? "" : " (closed)",
+                   centsToFloat(state->balance), closed ? " (closed)" : "");
+        }
+    }
+}
+
+// Verification mode: rebuilds every balance from the whole log and compares
+// the result with accounts.db. The log is split into record ranges replayed
+// on separate threads; the ranges are then merged in log order, checking
+// that each one picks up every account where the range before left it.
+// Returns 1 if the log is consistent and accounts.db agrees with it.
+int verifyLedger() {
+    lockAccountStore(1);
+    
+    long recordCount = transactionLog.recordCount;
+    int threadCount = jobThreadCount(recordCount);
+    VerifyShard *shards = calloc(threadCount, sizeof(VerifyShard));
+    ReplayTable ledger = { NULL, 0, 0 };
+    int success = flushTransactionLog() && flushAccountCache(0) && shards != NULL;
+    
+    struct timespec start;
+    clock_gettime(CLOCK_REALTIME, &start);
+    int started = 0;
+    
+    for (int i = 0; success && i < threadCount; i++) {
+        shards[i].firstRecord = recordCount * i / threadCount;
+        shards[i].recordCount = recordCount * (i + 1) / threadCount - shards[i].firstRecord;
+        if (pthread_create(&shards[i].thread, NULL, verifyShardWorker, &shards[i]) != 0) {
+            success = 0;
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(shards[i].thread, NULL);
+        success = success && !shards[i].failed;
+    }
+    
+    // Merge the ranges in log order
+    long breaks = 0;
+    success = success && initReplayTable(&ledger, 0);
+    for (int i = 0; success && i < threadCount; i++) {
+        const ReplayTable *table = &shards[i].table;
+        for (long slot = 0; success && slot < table->bucketCount; slot++) {
+            const AccountReplay *range = &table->slots[slot];
+            if (range->accountNumber == 0) continue;
+            
+            AccountReplay *state = replayEntry(&ledger, range->accountNumber, 1);
+            success = state != NULL;
+            if (!success) break;
+            if (state->records == 0) {
+                *state = *range;
+                continue;
+            }
+            if (!range->opened && range->openingBalance != state->balance) state->breaks++;
+            state->breaks += range->breaks;
+            state->balance = range->balance;
+            if (range->closed >= 0) state->closed = range->closed;
+            state->records += range->records;
+        }
+    }
+    
+    // Compare every account with the rebuilt balances
+    long accountCount = 0, mismatched = 0, unlogged = 0, orphaned = 0;
+    StoreScan scan;
+    int mapped = accountMap.records != NULL;
+    if (success && !mapped) success = openStoreScan(&scan, "rb");
+    
+    BankAccount account;
+    long recordNumber;
+    for (long record = 0; success; record++) {
+        if (!mapped) {
+            if (!nextStoreRecord(&scan, &account, &recordNumber)) break;
+        } else {
+            if (record >= accountMap.recordCount) break;
+            account = accountMap.records[record];
+        }
+        accountCount++;
+        checkAccountAgainstLog(&ledger, &account, &mismatched, &unlogged);
+    }
+    if (success && !mapped) success = closeStoreScan(&scan);
+    
+    // Archived accounts must be closed in the log too; a copy also still in
+    // accounts.db (from an interrupted compaction) was checked above
+    long archivedCount = 0;
+    FILE *archive = success ? openFile(ACCOUNTS_ARCHIVE, "rb") : NULL;
+    if (archive != NULL) setvbuf(archive, NULL, _IOFBF, 1 << 20);
+    while (archive != NULL && readRecords(&account, sizeof(BankAccount), 1, archive) == 1) {
+        AccountReplay *state = replayEntry(&ledger, account.accountNumber, 0);
+        if (account.accountNumber == 0 || (state != NULL && state->matched)) continue;
+        accountCount++;
+        archivedCount++;
+        checkAccountAgainstLog(&ledger, &account, &mismatched, &unlogged);
+    }
+    if (archive != NULL) fclose(archive);
+    
+    for (long slot = 0; success && slot < ledger.bucketCount; slot++) {
+        const AccountReplay *state = &ledger.slots[slot];
+        if (state->accountNumber == 0) continue;
+        breaks += state->breaks;
+        if (state->breaks > 0 && breaks - state->breaks < 10) {
+            printf("  account %d: %ld transaction(s) do not follow on from the balance before them\n",
+                   state->accountNumber, state->breaks);
+        }
+        if (!state->matched) orphaned++;
+    }
+    
+    double seconds = microsSince(&start) / 1e6;
+    for (int i = 0; shards != NULL && i < threadCount; i++) free(shards[i].table.slots);
+    free(shards);
+    free(ledger.slots);
+    unlockAccountStore(1);
+    
+    if (!success) {
+        printf("❌ The transaction log could not be verified!\n");
+        return 0;
+    }
+    
+    printf("🔍 Replayed %ld transaction(s) on %d thread(s) in %.2f s (%.0f records/s)\n",
+           recordCount, threadCount, seconds, seconds > 0 ? recordCount / seconds : 0.0);
+    if (checkpointPosition >= 0) {
+        printf("Newest checkpoint: at transaction %ld of %ld\n", checkpointPosition, recordCount);
+    } else {
+        printf("Newest checkpoint: none\n");
+    }
+    if (archivedCount > 0) {
+        printf("Archived accounts: %ld (in %s)\n", archivedCount, ACCOUNTS_ARCHIVE);
+    }
+    if (orphaned > 0) {
+        printf("⚠️  %ld account(s) in the log are not in accounts.db (creation interrupted)\n", orphaned);
+    }
+    if (mismatched == 0 && unlogged == 0 && breaks == 0) {
+        printf("✅ All %ld account(s) agree with the transaction log.\n", accountCount);
+        return 1;
+    }
+    printf("❌ %ld of %ld account(s) disagree with the log, %ld have no history, "
+           "and %ld transaction(s) break the balance chain.\n", mismatched, accountCount, unlogged, breaks);
+    return 0;
+}
+
+// Positions a cursor at the oldest (or newest) record of an account's
+// history, skipping offset records; an account without history yields
+// an empty cursor
+int openHistoryCursor(HistoryCursor *cursor, int accountNumber, long offset, int newestFirst, int pageSize) {
+    IndexSlot head;
+    cursor->accountNumber = accountNumber;
+    cursor->newestFirst = newestFirst;
+    cursor->nextRecord = -1;
+    cursor->endRecord = -1;
+    cursor->chainFd = -1;
+    cursor->pageSize = pageSize;
+    cursor->page = malloc(pageSize * sizeof(Transaction));
+    if (cursor->page == NULL) return 0;
+    
+    if (!indexLookup(TRANSACTIONS_HEADS, accountNumber, &head)) return 1;
+    
+    cursor->chainFd = openDescriptor(TRANSACTIONS_CHAIN, O_RDONLY, 0);
+    if (cursor->chainFd < 0) {
+        closeHistoryCursor(cursor);
+        return 0;
+    }
+    cursor->nextRecord = newestFirst ? head.value : head.aux;
+    
+    while (offset-- > 0 && cursor->nextRecord >= 0) {
+        if (!advanceHistoryCursor(cursor)) {
+            closeHistoryCursor(cursor);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Moves to the following record of the same account
+int advanceHistoryCursor(HistoryCursor *cursor) {
+    TransactionLink link;
+    if (readAt(cursor->chainFd, &link, sizeof(link),
+               cursor->nextRecord * (off_t)sizeof(TransactionLink)) != sizeof(link)) {
+        return 0;
+    }
+    cursor->nextRecord = cursor->newestFirst ? link.prev : link.next;
+    return 1;
+}
+
+// Renders up to pageSize records into cursor->page; returns how many, 0 at
+// the end of the history and -1 on a read error
+int nextHistoryBatch(HistoryCursor *cursor) {
+    struct timespec start;
+    startMetric(&start);
+    LogRecord record;
+    int count = 0;
+    
+    while (count < cursor->pageSize && cursor->nextRecord >= 0 &&
+           (cursor->endRecord < 0 || cursor->nextRecord < cursor->endRecord)) {
+        if (!readLogRecord(cursor->nextRecord, &record) || !advanceHistoryCursor(cursor)) {
+            count = -1;
+            break;
+        }
+        renderTransaction(&record, &cursor->page[count++]);
+    }
+    stopMetric(METRIC_HISTORY_PAGE, &start);
+    return count;
+}
+
+void closeHistoryCursor(HistoryCursor *cursor) {
+    if (cursor->chainFd >= 0) close(cursor->chainFd);
+    cursor->chainFd = -1;
+    cursor->nextRecord = -1;
+    free(cursor->page);
+    cursor->page = NULL;
+}
+
+int openRangeCursor(RangeCursor *cursor, int accountNumber, int64_t from, int64_t to, int pageSize) {
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->accountNumber = accountNumber;
+    cursor->from = from;
+    cursor->to = to;
+    cursor->pageSize = pageSize;
+    cursor->page = malloc(pageSize * sizeof(Transaction));
+    cursor->records = malloc(TIME_INDEX_BLOCK * sizeof(LogRecord));
+    
+    // Batch mode may still hold records in memory
+    if (cursor->page == NULL || cursor->records == NULL || !flushTransactionLog()) {
+        closeRangeCursor(cursor);
+        return 0;
+    }
+    
+    lockSharedLog();
+    pthread_mutex_lock(&transactionLog.lock);
+    int refreshed = refreshSharedLogLocked();
+    cursor->logRecords = transactionLog.recordCount;
+    long blockCount = (cursor->logRecords + TIME_INDEX_BLOCK - 1) / TIME_INDEX_BLOCK;
+    cursor->blocks = malloc((blockCount > 0 ? blockCount : 1) * sizeof(long));
+    for (long block = 0; cursor->blocks != NULL && block < blockCount; block++) {
+        // Without a usable index every block is a candidate
+        if (!timeIndex.valid || block >= timeIndex.blockCount ||
+            (timeIndex.blocks[block].latest >= from && timeIndex.blocks[block].earliest < to)) {
+            cursor->blocks[cursor->blockCount++] = block;
+        }
+    }
+    pthread_mutex_unlock(&transactionLog.lock);
+    unlockSharedLog();
+    
+    if (cursor->blocks == NULL || !refreshed) {
+        closeRangeCursor(cursor);
+        return 0;
+    }
+    return 1;
+}
+
+// Renders up to pageSize matches into cursor->page; returns how many, 0 at
+// the end of the range and -1 on a read error
+int nextRangeBatch(RangeCursor *cursor) {
+    int count = 0;
+    
+    while (count < cursor->pageSize) {
+        if (cursor->nextRecord == cursor->loadedRecords) {
+            if (cursor->nextBlock == cursor->blockCount) break;
+            long first = cursor->blocks[cursor->nextBlock++] * TIME_INDEX_BLOCK;
+            long records = cursor->logRecords - first < TIME_INDEX_BLOCK ? cursor->logRecords - first : TIME_INDEX_BLOCK;
+            size_t length = records * sizeof(LogRecord);
+            if (readAt(transactionLog.fd, cursor->records, length, logOffset(first)) != (ssize_t)length) return -1;
+            cursor->loadedRecords = (int)records;
+            cursor->nextRecord = 0;
+            cursor->recordsRead += records;
+            continue;
+        }
+        
+        // Voided records belong to account 0 and never match
+        const LogRecord *record = &cursor->records[cursor->nextRecord++];
+        if (record->accountNumber == 0 || record->timestamp < cursor->from || record->timestamp >= cursor->to) continue;
+        if (cursor->accountNumber != 0 && record->accountNumber != cursor->accountNumber) continue;
+        renderTransaction(record, &cursor->page[count++]);
+    }
+    return count;
+}
+
+void closeRangeCursor(RangeCursor *cursor) {
+    free(cursor->blocks);
+    free(cursor->records);
+    free(cursor->page);
+    cursor->blocks = NULL;
+    cursor->records = NULL;
+    cursor->page = NULL;
+    cursor->blockCount = 0;
+    cursor->nextBlock = 0;
+}
+
+// Stops the query at endRecord, such as a snapshot position
+void limitRangeCursor(RangeCursor *cursor, long endRecord) {
+    if (endRecord < cursor->logRecords) cursor->logRecords = endRecord;
+    while (cursor->blockCount > 0 && cursor->blocks[cursor->blockCount - 1] * TIME_INDEX_BLOCK >= cursor->logRecords) {
+        cursor->blockCount--;
+    }
+}
+
+// Snapshot Functions
+
+// Pins the newest position no in-flight posting can land below. With
+// --shared the other processes' postings are not tracked here, so the
+// store lock is taken once to wait them out; the read itself holds nothing.
+void openSnapshot(Snapshot *snapshot) {
+    if (sharedLocks.fd >= 0) lockAccountStore(1);
+    pthread_mutex_lock(&transactionLog.lock);
+    
+    long position = transactionLog.recordCount;
+    for (int i = 0; i < transactionLog.inFlightCount; i++) {
+        if (transactionLog.inFlight[i] < position) position = transactionLog.inFlight[i];
+    }
+    // Batch mode links late; the chains must cover everything below the position
+    if (position > transactionLog.linkedCount) position = transactionLog.linkedCount;
+    
+    pthread_mutex_unlock(&transactionLog.lock);
+    if (sharedLocks.fd >= 0) unlockAccountStore(1);
+    
+    snapshot->logPosition = position;
+    snapshot->chainFd = -1;
+}
+
+// Reads an account as it stood at the snapshot: names and credentials from
+// the store, balance and status from its newest record below the position.
+// Returns 0 if the account has no history there, e.g. it was opened later.
+int snapshotAccount(Snapshot *snapshot, int accountNumber, BankAccount *account) {
+    IndexSlot head;
+    if (!findAccountByNumber(accountNumber, account) || !indexLookup(TRANSACTIONS_HEADS, accountNumber, &head)) {
+        return 0;
+    }
+    if (snapshot->chainFd < 0) snapshot->chainFd = openDescriptor(TRANSACTIONS_CHAIN, O_RDONLY, 0);
+    if (snapshot->chainFd < 0) return 0;
+    
+    // Step back over whatever was posted after the snapshot
+    long recordNumber = head.value;
+    TransactionLink link;
+    while (recordNumber >= snapshot->logPosition) {
+        if (readAt(snapshot->chainFd, &link, sizeof(link), recordNumber * (off_t)sizeof(TransactionLink)) != sizeof(link)) {
+            return 0;
+        }
+        recordNumber = link.prev;
+    }
+    
+    LogRecord record;
+    if (recordNumber < 0 || !readLogRecord(recordNumber, &record)) return 0;
+    account->balance = record.balanceAfter;
+    account->isActive = record.type != TX_ACCOUNT_CLOSURE;
+    return 1;
+}
+
+void closeSnapshot(Snapshot *snapshot) {
+    if (snapshot->chainFd >= 0) close(snapshot->chainFd);
+    snapshot->chainFd = -1;
+}
+
+// Reads YYYY-MM-DD as local midnight in epoch microseconds, or -1 if it is
+// not a date. dayOffset moves that many days on, for the exclusive end of a
+// period.
+int64_t parseDate(const char *text, int dayOffset) {
+    int year, month, day;
+    char extra;
+    if (sscanf(text, "%d-%d-%d%c", &year, &month, &day, &extra) != 3 ||
+        year < 1970 || month < 1 || month > 12 || day < 1 || day > 31) {
+        return -1;
+    }
+    
+    struct tm t;
+    memset(&t, 0, sizeof(t));
+    t.tm_year = year - 1900;
+    t.tm_mon = month - 1;
+    t.tm_mday = day + dayOffset;
+    t.tm_isdst = -1;
+    time_t seconds = mktime(&t);
+    return seconds == (time_t)-1 ? -1 : (int64_t)seconds * 1000000;
+}
+
+// Asks for a period of whole days. Returns 1 with [from, to) and a label
+// set, 0 if the start date is left blank and -1 for an invalid period.
+int readPeriod(int64_t *from, int64_t *to, char *label, int labelSize) {
+    char fromText[32], toText[32];
+    
+    safeInputString(fromText, sizeof(fromText), "From date (YYYY-MM-DD, blank for the whole history): ");
+    if (fromText[0] == 0) return 0;
+    safeInputString(toText, sizeof(toText), "To date (YYYY-MM-DD, blank for the same day): ");
+    if (toText[0] == 0) strcpy(toText, fromText);
+    
+    *from = parseDate(fromText, 0);
+    *to = parseDate(toText, 1);
+    if (*from < 0 || *to < 0 || *to <= *from) {
+        printf("❌ Invalid period! Enter dates as YYYY-MM-DD, the end not before the start.\n");
+        return -1;
+    }
+    snprintf(label, labelSize, "%s to %s", fromText, toText);
+    return 1;
+}
+
+// Prints a range query one screen at a time
+void showRangeResults(RangeCursor *cursor) {
+    int count = nextRangeBatch(cursor);
+    if (count == 0) {
+        printf("No transactions found in this period.\n");
+    } else if (count > 0) {
+        printf("ID       | Account    | Date       | Type            | Amount    | Balance   | Description\n");
+        printf("---------+------------+-----------+-----------------+-----------+-----------+----------------\n");
+    }
+    
+    while (count > 0) {
+        for (int i = 0; i < count; i++) {
+            printf("%-8d | %-10d | %s | %-15s | K%8.2f | K%8.2f | %s\n",
+                   cursor->page[i].transactionId,
+                   cursor->page[i].accountNumber,
+                   cursor->page[i].timestamp,
+                   cursor->page[i].type,
+                   centsToFloat(cursor->page[i].amount),
+                   centsToFloat(cursor->page[i].balanceAfter),
+                   cursor->page[i].description);
+        }
+        if (cursor->nextBlock == cursor->blockCount && cursor->nextRecord == cursor->loadedRecords) break;
+        
+        char answer[8];
+        safeInputString(answer, sizeof(answer), "-- Press Enter for more transactions, or q to stop: ");
+        if (tolower((unsigned char)answer[0]) == 'q') break;
+        count = nextRangeBatch(cursor);
+    }
+    if (count < 0) printf("❌ Failed to read the transaction log!\n");
+    
+    printf("(%ld of %ld log records read)\n", cursor->recordsRead, cursor->logRecords);
+}
+
+// Enhanced Transfer Function with Rollback
+int transferFundsWithRollback(int fromAccount, int toAccount, long amountCents) {
+    if (accountMap.records != NULL) {
+        long fromRecord, toRecord;
+        BankAccount *fromAcc = mappedAccount(fromAccount, &fromRecord);
+        BankAccount *toAcc = mappedAccount(toAccount, &toRecord);
+        if (fromAcc == NULL || toAcc == NULL || fromAcc->balance < amountCents) return 0;
+        
+        // Both records live in memory, so the pair of updates cannot fail halfway
+        fromAcc->balance -= amountCents;
+        toAcc->balance += amountCents;
+        syncMappedAccount(fromRecord);
+        syncMappedAccount(toRecord);
+        return 1;
+    }
+    
+    BankAccount accounts[2];
+    long recordNumbers[2];
+    
+    if (!loadAccount(fromAccount, &accounts[0], &recordNumbers[0]) ||
+        !loadAccount(toAccount, &accounts[1], &recordNumbers[1]) ||
+        accounts[0].balance < amountCents) {
+        return 0;
+    }
+    
+    accounts[0].balance -= amountCents;
+    accounts[1].balance += amountCents;
+    return storeAccounts(accounts, recordNumbers, 2, 0);
+}
+
+// Account Management Functions
+int closeAccount(int accountNumber) {
+    if (accountMap.records != NULL) {
+        long recordNumber;
+        BankAccount *account = mappedAccount(accountNumber, &recordNumber);
+        if (account == NULL) return 0;
+        account->isActive = 0;
+        syncMappedAccount(recordNumber);
+        return 1;
+    }
+    
+    BankAccount account;
+    long recordNumber;
+    if (!loadAccount(accountNumber, &account, &recordNumber)) return 0;
+    
+    // Write the closure through, then drop the account from the cache
+    account.isActive = 0;
+    int closed = storeAccounts(&account, &recordNumber, 1, 1);
+    cacheInvalidate(accountNumber);
+    return closed;
+}
+
+// Credits one month of interest to the account and fills in its log record; returns 0 if nothing was due
+int creditInterest(BankAccount *account, float interestRate, int64_t timestamp, uint32_t description,
+                   LogRecord *record) {
+    if (!account->isActive || account->balance <= 0) return 0;
+    
+    float interest = centsToFloat(account->balance) * interestRate;
+    long interestCents = floatToCents(interest);
+    account->balance += interestCents;
+    
+    memset(record, 0, sizeof(LogRecord));
+    record->accountNumber = account->accountNumber;
+    record->type = TX_INTEREST;
+    record->amount = interestCents;
+    record->balanceAfter = account->balance;
+    record->timestamp = timestamp;
+    record->description = description;
+    return 1;
+}
+
+// Works out the interest for one account range without touching the store;
+// balances only change once every record is in the log
+void *interestShardWorker(void *arg) {
+    InterestShard *shard = arg;
+    
+    for (long i = 0; i < shard->accountCount; i++) {
+        long position = shard->firstAccount + i;
+        BankAccount account = shard->accounts[position];
+        if (creditInterest(&account, shard->interestRate, shard->timestamp, shard->description,
+                           &shard->records[shard->credited])) {
+            shard->positions[shard->credited++] = position;
+        }
+        if ((i + 1) % 1024 == 0) atomic_fetch_add(shard->progress, 1024);
+    }
+    atomic_fetch_add(shard->progress, shard->accountCount % 1024);
+    return NULL;
+}
+
+int jobThreadCount(long accountCount) {
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > JOB_MAX_THREADS) threads = JOB_MAX_THREADS;
+    if (threads > accountCount / JOB_MIN_SHARD) threads = accountCount / JOB_MIN_SHARD;
+    return threads < 1 ? 1 : (int)threads;
+}
+
+// Month-end job: shards the accounts across threads (one per shard file
+// when the store is sharded), appends every INTEREST record in one write,
+// then stores all new balances in bulk. Returns the number of accounts
+// credited, or -1 if nothing could be applied.
+long applyMonthlyInterest() {
+    float interestRate = 0.015;
+    int64_t timestamp = currentMicros();
+    uint32_t description = internDescription("Monthly interest credit");
+    
+    // Postings must not change balances between the calculation and the write-back
+    lockAccountStore(1);
+    
+    BankAccount *accounts = accountMap.records;
+    long accountCount = accountMap.recordCount;
+    long starts[MAX_SHARDS + 1];
+    int mapped = accounts != NULL;
+    
+    if (!mapped) {
+        // The store is read and rewritten directly, one thread per shard file
+        accountCount = flushAccountCache(1) ? loadAccountStore(&accounts, starts) : -1;
+        if (accountCount < 0) {
+            unlockAccountStore(1);
+            return -1;
+        }
+    }
+    
+    int sharded = !mapped && shardMap.shardCount > 1;
+    int threadCount = sharded ? shardMap.shardCount : jobThreadCount(accountCount);
+    InterestShard *shards = calloc(threadCount, sizeof(InterestShard));
+    LogRecord *records = malloc((accountCount > 0 ? accountCount : 1) * sizeof(LogRecord));
+    long *positions = malloc((accountCount > 0 ? accountCount : 1) * sizeof(long));
+    atomic_long progress = 0;
+    long credited = -1;
+    
+    struct timespec start;
+    clock_gettime(CLOCK_REALTIME, &start);
+    int started = 0;
+    
+    if (shards != NULL && records != NULL && positions != NULL) {
+        for (int i = 0; i < threadCount; i++) {
+            InterestShard *shard = &shards[i];
+            shard->accounts = accounts;
+            shard->firstAccount = sharded ? starts[i] : accountCount * i / threadCount;
+            shard->accountCount = (sharded ? starts[i + 1] : accountCount * (i + 1) / threadCount) -
+                                  shard->firstAccount;
+            shard->interestRate = interestRate;
+            shard->timestamp = timestamp;
+            shard->description = description;
+            shard->records = records + shard->firstAccount;
+            shard->positions = positions + shard->firstAccount;
+            shard->progress = &progress;
+            if (pthread_create(&shard->thread, NULL, interestShardWorker, shard) != 0) break;
+            started++;
+        }
+        
+        // Report progress until every shard has finished
+        while (started == threadCount && atomic_load(&progress) < accountCount) {
+            printf("\r⏳ Applying interest: %ld/%ld accounts", atomic_load(&progress), accountCount);
+            fflush(stdout);
+            struct timespec pause = {0, 100000000};
+            nanosleep(&pause, NULL);
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(shards[i].thread, NULL);
+        }
+        if (accountCount >= JOB_MIN_SHARD) {
+            printf("\r⏳ Applying interest: %ld/%ld accounts\n", atomic_load(&progress), accountCount);
+        }
+    }
+    
+    if (started == threadCount && started > 0) {
+        // Close the gaps between the shards so the log gets a single run
+        credited = 0;
+        for (int i = 0; i < threadCount; i++) {
+            memmove(records + credited, shards[i].records, shards[i].credited * sizeof(LogRecord));
+            memmove(positions + credited, shards[i].positions, shards[i].credited * sizeof(long));
+            credited += shards[i].credited;
+        }
+        
+        long firstRecord;
+        if (credited > 0 && !appendTransactions(records, (int)credited, &firstRecord)) {
+            credited = -1;
+        } else if (credited > 0) {
+            for (long i = 0; i < credited; i++) {
+                accounts[positions[i]].balance = records[i].balanceAfter;
+            }
+            
+            int stored = 1;
+            if (!mapped) {
+                stored = transferAccountStore(accounts, starts, 1);
+            } else {
+                msync(accounts, accountCount * sizeof(BankAccount), MS_ASYNC);
+            }
+            
+            if (stored) {
+                if (!commitTransactions(records, (int)credited, firstRecord)) {
+                    printf("⚠️  Interest was credited, but the log could not be saved to disk.\n");
+                }
+            } else {
+                // Startup reconciliation repairs any balances that did reach the store
+                rollbackTransactions(firstRecord, (int)credited);
+                credited = -1;
+            }
+        }
+    }
+    
+    double seconds = microsSince(&start) / 1e6;
+    if (credited >= 0) {
+        printf("📈 Processed %ld accounts on %d thread(s) in %.2f s (%.0f accounts/s)\n",
+               accountCount, threadCount, seconds, seconds > 0 ? accountCount / seconds : 0.0);
+    }
+    
+    free(shards);
+    free(records);
+    free(positions);
+    if (!mapped) free(accounts);
+    unlockAccountStore(1);
+    return credited;
+}
+
+void generateAccountStatement() {
+    printHeader("ACCOUNT STATEMENT");
+    
+    int64_t from, to;
+    char period[80];
+    int ranged = readPeriod(&from, &to, period, sizeof(period));
+    if (ranged < 0) return;
+    
+    char filename[100];
+    snprintf(filename, sizeof(filename), "statement_%d.txt", currentUser.accountNumber);
+    
+    FILE* file = openFile(filename, "w");
+    if (!file) {
+        printf("❌ Failed to create statement file!\n");
+        return;
+    }
+    
+    // The balance and the lines are read as of one snapshot, so they agree
+    // even while other terminals keep posting to the account
+    Snapshot snapshot;
+    openSnapshot(&snapshot);
+    BankAccount account = currentUser;
+    snapshotAccount(&snapshot, currentUser.accountNumber, &account);
+    
+    char timestamp[20];
+    getCurrentTimestamp(timestamp);
+    writeStatementHeader(file, &account, timestamp, ranged ? period : NULL);
+    
+    HistoryCursor cursor;
+    RangeCursor range;
+    
+    if (ranged) {
+        // A period reads only the part of the log it covers
+        if (openRangeCursor(&range, currentUser.accountNumber, from, to, STATEMENT_PAGE_SIZE)) {
+            limitRangeCursor(&range, snapshot.logPosition);
+            int count;
+            while ((count = nextRangeBatch(&range)) > 0) {
+                for (int i = 0; i < count; i++) {
+                    writeStatementLine(file, range.page[i].timestamp, range.page[i].type,
+                                       range.page[i].amount, range.page[i].balanceAfter);
+                }
+            }
+            if (count < 0) fprintf(file, "(history incomplete: read error)\n");
+            
+            closeRangeCursor(&range);
+        } else {
+            fprintf(file, "(history unavailable)\n");
+        }
+    } else if (openHistoryCursor(&cursor, currentUser.accountNumber, 0, 0, STATEMENT_PAGE_SIZE)) {
+        // Stream the history oldest first, one page of records at a time
+        cursor.endRecord = snapshot.logPosition;
+        int count;
+        while ((count = nextHistoryBatch(&cursor)) > 0) {
+            for (int i = 0; i < count; i++) {
+                writeStatementLine(file, cursor.page[i].timestamp, cursor.page[i].type,
+                                   cursor.page[i].amount, cursor.page[i].balanceAfter);
+            }
+        }
+        if (count < 0) fprintf(file, "(history incomplete: read error)\n");
+        
+        closeHistoryCursor(&cursor);
+    } else {
+        fprintf(file, "(history unavailable)\n");
+    }
+    
+    fprintf(file, "============================================\n");
+    fclose(file);
+    closeSnapshot(&snapshot);
+    
+    printf("✅ Account statement generated: %s\n", filename);
+}
+
+// period is NULL for a statement of the whole history
+void writeStatementHeader(FILE *file, const BankAccount *account, const char *statementDate, const char *period) {
+    fprintf(file, "============================================\n");
+    fprintf(file, "           BANK ACCOUNT STATEMENT\n");
+    fprintf(file, "============================================\n");
+    fprintf(file, "Account Holder: %s\n", account->fullName);
+    fprintf(file, "Account Number: %d\n", account->accountNumber);
+    fprintf(file, "Statement Date: %s\n", statementDate);
+    if (period != NULL) fprintf(file, "Period: %s\n", period);
+    fprintf(file, "Current Balance: K%.2f\n", centsToFloat(account->balance));
+    fprintf(file, "============================================\n");
+    fprintf(file, "Transaction History:\n");
+    fprintf(file, "Date       | Type            | Amount    | Balance\n");
+    fprintf(file, "-----------+-----------------+-----------+-----------\n");
+}
+
+void writeStatementLine(FILE *file, const char *timestamp, const char *type, long amount, long balanceAfter) {
+    fprintf(file, "%s | %-15s | K%8.2f | K%8.2f\n",
+            timestamp, type, centsToFloat(amount), centsToFloat(balanceAfter));
+}
+
+// Bulk Statement Functions
+int addStatementEntry(StatementShard *shard, long position, const LogRecord *record) {
+    if (shard->entryCount == shard->entryCapacity) {
+        long capacity = shard->entryCapacity > 0 ? shard->entryCapacity * 2 : BATCH_LOG_BUFFER;
+        StatementEntry *grown = realloc(shard->entries, capacity * sizeof(StatementEntry));
+        if (grown == NULL) return 0;
+        shard->entries = grown;
+        shard->entryCapacity = capacity;
+    }
+    shard->entries[shard->entryCount].position = position;
+    shard->entries[shard->entryCount].record = *record;
+    shard->entryCount++;
+    return 1;
+}
+
+// Writes statements/statement_<n>.txt from records already in log order
+int writeBulkStatement(const BankAccount *account, const char *statementDate,
+                       const LogRecord *records, long count, char *buffer) {
+    char path[64];
+    snprintf(path, sizeof(path), "%s/statement_%d.txt", STATEMENTS_DIR, account->accountNumber);
+    FILE *file = openFile(path, "w");
+    if (file == NULL) return 0;
+    setvbuf(file, buffer, _IOFBF, STATEMENT_WRITE_BUFFER);
+    
+    writeStatementHeader(file, account, statementDate, NULL);
+    
+    // Consecutive records mostly fall in the same minute; format each minute once
+    char timestamp[20];
+    int64_t cachedMinute = -1;
+    for (long i = 0; i < count; i++) {
+        int64_t minute = records[i].timestamp / 60000000;
+        if (minute != cachedMinute) {
+            formatTimestamp(records[i].timestamp, timestamp);
+            cachedMinute = minute;
+        }
+        writeStatementLine(file, timestamp, transactionTypeNames[records[i].type < TX_TYPES ? records[i].type : TX_OTHER],
+                           records[i].amount, records[i].balanceAfter);
+    }
+    
+    fprintf(file, "============================================\n");
+    return fclose(file) == 0;
+}
+
+// Groups the shard's records by account with a counting sort, which keeps
+// log order within each account, then writes one statement per account
+void *statementShardWorker(void *arg) {
+    StatementShard *shard = arg;
+    long accountSlots = (shard->accountCount - shard->worker + shard->workerCount - 1) / shard->workerCount;
+    
+    long *starts = calloc(accountSlots + 1, sizeof(long));
+    long *next = malloc((accountSlots > 0 ? accountSlots : 1) * sizeof(long));
+    LogRecord *sorted = malloc((shard->entryCount > 0 ? shard->entryCount : 1) * sizeof(LogRecord));
+    char *buffer = malloc(STATEMENT_WRITE_BUFFER);
+    if (starts == NULL || next == NULL || sorted == NULL || buffer == NULL) {
+        shard->failed = 1;
+    } else {
+        for (long i = 0; i < shard->entryCount; i++) {
+            starts[shard->entries[i].position / shard->workerCount + 1]++;
+        }
+        for (long slot = 0; slot < accountSlots; slot++) {
+            starts[slot + 1] += starts[slot];
+            next[slot] = starts[slot];
+        }
+        for (long i = 0; i < shard->entryCount; i++) {
+            sorted[next[shard->entries[i].position / shard->workerCount]++] = shard->entries[i].record;
+        }
+        free(shard->entries);
+        shard->entries = NULL;
+        
+        for (long slot = 0; slot < accountSlots; slot++) {
+            const BankAccount *account = &shard->accounts[shard->worker + slot * shard->workerCount];
+            if (account->accountNumber == 0) continue;
+            if (!writeBulkStatement(account, shard->statementDate, sorted + starts[slot],
+                                    starts[slot + 1] - starts[slot], buffer)) {
+                shard->failed = 1;
+                continue;
+            }
+            shard->statements++;
+        }
+    }
+    
+    free(starts);
+    free(next);
+    free(sorted);
+    free(buffer);
+    return NULL;
+}
+
+// Month-end job: writes a statement for every account into statements/.
+// transactions.db is read once, front to back, and each record is routed
+// to the worker that owns its account; the workers then render in parallel.
+// Returns the number of statements written, or -1 if the job failed.
+long generateAllStatements() {
+    struct timespec start;
+    clock_gettime(CLOCK_REALTIME, &start);
+    
+    char statementDate[20];
+    getCurrentTimestamp(statementDate);
+    if (mkdir(STATEMENTS_DIR, 0755) != 0 && access(STATEMENTS_DIR, W_OK) != 0) return -1;
+    
+    // Pin a snapshot first: statements cover the log up to its position, and
+    // each balance is taken from the last record listed, so postings carry
+    // on while the accounts are copied and the log is read
+    Snapshot snapshot;
+    int loaded = flushTransactionLog();
+    openSnapshot(&snapshot);
+    long recordCount = snapshot.logPosition;
+    
+    // Only names and account numbers are needed from the copy; a shared lock
+    // keeps compaction from replacing the account files under it
+    lockAccountStore(0);
+    long accountCount = 0;
+    BankAccount *accounts = NULL;
+    
+    if (loaded && accountMap.records != NULL) {
+        accountCount = accountMap.recordCount;
+        accounts = malloc((accountCount > 0 ? accountCount : 1) * sizeof(BankAccount));
+        loaded = accounts != NULL;
+        if (loaded) memcpy(accounts, accountMap.records, accountCount * sizeof(BankAccount));
+    } else if (loaded) {
+        long starts[MAX_SHARDS + 1];
+        accountCount = flushAccountCache(0) ? loadAccountStore(&accounts, starts) : -1;
+        loaded = accountCount >= 0;
+        if (!loaded) accountCount = 0;
+    }
+    unlockAccountStore(0);
+    
+    // Account number -> snapshot position
+    long bucketCount = indexBucketCount(accountCount, 0);
+    IndexSlot *slots = calloc(bucketCount, sizeof(IndexSlot));
+    int workerCount = jobThreadCount(accountCount);
+    StatementShard *shards = calloc(workerCount, sizeof(StatementShard));
+    LogRecord *block = malloc(BATCH_LOG_BUFFER * sizeof(LogRecord));
+    char *logged = calloc(accountCount > 0 ? accountCount : 1, 1);
+    int success = loaded && slots != NULL && shards != NULL && block != NULL && logged != NULL;
+    
+    long entryCount = 0;
+    for (long position = 0; success && position < accountCount; position++) {
+        IndexSlot entry = { accounts[position].accountNumber, position, 0 };
+        indexPut(slots, bucketCount, &entry, &entryCount);
+    }
+    
+    for (long first = 0; success && first < recordCount; first += BATCH_LOG_BUFFER) {
+        long blockRecords = recordCount - first < BATCH_LOG_BUFFER ? recordCount - first : BATCH_LOG_BUFFER;
+        size_t length = blockRecords * sizeof(LogRecord);
+        if (readAt(transactionLog.fd, block, length, logOffset(first)) != (ssize_t)length) {
+            success = 0;
+            break;
+        }
+        for (long i = 0; success && i < blockRecords; i++) {
+            if (block[i].accountNumber == 0) continue;  // voided record
+            
+            long bucket = indexBucket(block[i].accountNumber, bucketCount);
+            while (slots[bucket].key != 0 && slots[bucket].key != block[i].accountNumber) {
+                bucket = (bucket + 1) & (bucketCount - 1);
+            }
+            if (slots[bucket].key == 0) continue;
+            
+            long position = slots[bucket].value;
+            accounts[position].balance = block[i].balanceAfter;
+            accounts[position].isActive = block[i].type != TX_ACCOUNT_CLOSURE;
+            logged[position] = 1;
+            success = addStatementEntry(&shards[position % workerCount], position, &block[i]);
+        }
+    }
+    free(block);
+    free(slots);
+    
+    // An account with history but none below the snapshot was opened after
+    // it; dropping its number leaves an empty slot, which gets no statement
+    for (long position = 0; success && position < accountCount; position++) {
+        IndexSlot head;
+        if (!logged[position] && indexLookup(TRANSACTIONS_HEADS, accounts[position].accountNumber, &head)) {
+            accounts[position].accountNumber = 0;
+        }
+    }
+    free(logged);
+    closeSnapshot(&snapshot);
+    
+    int started = 0;
+    for (int i = 0; success && i < workerCount; i++) {
+        shards[i].worker = i;
+        shards[i].workerCount = workerCount;
+        shards[i].accounts = accounts;
+        shards[i].accountCount = accountCount;
+        shards[i].statementDate = statementDate;
+        if (pthread_create(&shards[i].thread, NULL, statementShardWorker, &shards[i]) != 0) {
+            success = 0;
+            break;
+        }
+        started++;
+    }
+    
+    long statements = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(shards[i].thread, NULL);
+        statements += shards[i].statements;
+        if (shards[i].failed) success = 0;
+    }
+    
+    double seconds = microsSince(&start) / 1e6;
+    if (started > 0) {
+        printf("📈 Wrote %ld statement(s) covering %ld transaction(s) on %d thread(s) in %.2f s\n",
+               statements, recordCount, started, seconds);
+    }
+    
+    for (int i = 0; shards != NULL && i < workerCount; i++) {
+        free(shards[i].entries);
+    }
+    free(shards);
+    free(accounts);
+    return success ? statements : -1;
+}
+
+// Account Compaction Functions
+
+// Carries the entries of accounts archived by earlier compactions over to the new index
+int copyArchivedEntries(CompactionJob *job) {
+    FILE *file = openFile(ACCOUNTS_INDEX, "rb");
+    if (file == NULL) return 0;
+    
+    IndexHeader header;
+    IndexSlot slot;
+    int success = readIndexHeader(file, &header);
+    for (long i = 0; success && i < header.bucketCount; i++) {
+        success = readRecords(&slot, sizeof(IndexSlot), 1, file) == 1;
+        if (success && slot.key != 0 && slot.value < 0) {
+            success = indexAdd(&job->slots, &job->bucketCount, &job->entryCount, slot.key, slot.value);
+        }
+    }
+    fclose(file);
+    return success;
+}
+
+// Copies records out of the live store; the caller holds accountStoreLock
+int readStoreRecords(FILE *store, long firstRecord, long count, BankAccount *accounts) {
+    if (store == NULL) {
+        memcpy(accounts, accountMap.records + firstRecord, count * sizeof(BankAccount));
+        return 1;
+    }
+    
+    // The seek drops anything stdio buffered, so the read sees the file as it is now
+    fseek(store, firstRecord * (long)sizeof(BankAccount), SEEK_SET);
+    return (long)readRecords(accounts, sizeof(BankAccount), count, store) == count;
+}
+
+// Appends an account to its new shard file, or to the archive if it is
+// closed, and indexes it there; the files must be positioned at their end
+int placeCompactedAccount(CompactionJob *job, const BankAccount *account) {
+    if (account->accountNumber == 0) return 1;
+    
+    long value;
+    if (account->isActive) {
+        int shard = shardOfAccount(&shardMap, account->accountNumber);
+        if (writeRecords(account, sizeof(BankAccount), 1, job->outputs[shard]) != 1) return 0;
+        value = shardRecord(shard, job->liveCounts[shard]++);
+        job->liveCount++;
+    } else {
+        if (writeRecords(account, sizeof(BankAccount), 1, job->archive) != 1) return 0;
+        value = -(++job->archiveCount);
+    }
+    return indexAdd(&job->slots, &job->bucketCount, &job->entryCount, account->accountNumber, value);
+}
+
+// Replaces the copy of an account that was already placed, then returns to the end of its file
+int rewriteCompactedAccount(CompactionJob *job, long value, const BankAccount *account) {
+    FILE *file = value >= 0 ? job->outputs[recordShard(value)] : job->archive;
+    long record = value >= 0 ? recordInShard(value) : -value - 1;
+    long end = value >= 0 ? job->liveCounts[recordShard(value)] : job->archiveCount;
+    
+    return fseek(file, record * (long)sizeof(BankAccount), SEEK_SET) == 0 &&
+           writeRecords(account, sizeof(BankAccount), 1, file) == 1 &&
+           fseek(file, end * (long)sizeof(BankAccount), SEEK_SET) == 0;
+}
+
+// Every account named in a range of the log, sorted and listed once
+long *collectChangedAccounts(long firstRecord, long recordCount, long *accountCount) {
+    LogRecord *block = malloc(BATCH_LOG_BUFFER * sizeof(LogRecord));
+    long *accounts = malloc((recordCount > 0 ? recordCount : 1) * sizeof(long));
+    int success = block != NULL && accounts != NULL;
+    long count = 0;
+    
+    for (long first = firstRecord; success && first < firstRecord + recordCount; first += BATCH_LOG_BUFFER) {
+        long blockRecords = firstRecord + recordCount - first;
+        if (blockRecords > BATCH_LOG_BUFFER) blockRecords = BATCH_LOG_BUFFER;
+        size_t length = blockRecords * sizeof(LogRecord);
+        success = readAt(transactionLog.fd, block, length, logOffset(first)) == (ssize_t)length;
+        
+        for (long i = 0; success && i < blockRecords; i++) {
+            if (block[i].accountNumber != 0) accounts[count++] = block[i].accountNumber;
+        }
+    }
+    free(block);
+    if (!success) {
+        free(accounts);
+        return NULL;
+    }
+    
+    qsort(accounts, count, sizeof(long), compareLongs);
+    long unique = 0;
+    for (long i = 0; i < count; i++) {
+        if (unique == 0 || accounts[unique - 1] != accounts[i]) accounts[unique++] = accounts[i];
+    }
+    *accountCount = unique;
+    return accounts;
+}
+
+// Online compaction: rewrites each account file without its closed
+// accounts, which are appended to accounts.archive, so scans, checkpoints
+// and the mapping grow with the live accounts only. The bulk copy runs one
+// chunk at a time under the shared store lock, so postings carry on
+// alongside it. A short exclusive pause then copies again every account the
+// log shows was changed meanwhile, renames the new files and index into
+// place and checkpoints. Returns the number of accounts archived, or -1 on error.
+long compactAccounts() {
+    struct timespec start, pauseStart;
+    clock_gettime(CLOCK_REALTIME, &start);
+    
+    CompactionJob job;
+    memset(&job, 0, sizeof(job));
+    BankAccount *block = malloc(ACCOUNT_MAP_CHUNK * sizeof(BankAccount));
+    FILE *stores[MAX_SHARDS] = { NULL };
+    long copyCounts[MAX_SHARDS] = { 0 };
+    int shardCount = shardMap.shardCount;
+    
+    // Start from a point where the store holds every committed change;
+    // changes made during the copy are found in the log from here on
+    lockAccountStore(1);
+    int mapped = accountMap.records != NULL;
+    int success = block != NULL && flushTransactionLog() && flushAccountCache(0);
+    pthread_mutex_lock(&transactionLog.lock);
+    long startPosition = transactionLog.recordCount;
+    pthread_mutex_unlock(&transactionLog.lock);
+    long copyCount = accountMap.recordCount;
+    copyCounts[0] = copyCount;
+    if (success && !mapped) {
+        copyCount = 0;
+        for (int shard = 0; success && shard < shardCount; shard++) {
+            stores[shard] = openShardFile(shard, "rb");
+            success = stores[shard] != NULL;
+            if (success) {
+                fseek(stores[shard], 0, SEEK_END);
+                copyCounts[shard] = ftell(stores[shard]) / sizeof(BankAccount);
+                copyCount += copyCounts[shard];
+            }
+        }
+    }
+    unlockAccountStore(1);
+    
+    if (success) {
+        FILE *archive = openFile(ACCOUNTS_ARCHIVE, "ab");
+        success = archive != NULL && fclose(archive) == 0;
+    }
+    char paths[MAX_SHARDS][64], temps[MAX_SHARDS][72];
+    for (int shard = 0; success && shard < shardCount; shard++) {
+        shardFilePath(&shardMap, shard, paths[shard], sizeof(paths[shard]));
+        snprintf(temps[shard], sizeof(temps[shard]), "%s.tmp", paths[shard]);
+        job.outputs[shard] = openFile(temps[shard], "wb");
+        success = job.outputs[shard] != NULL;
+    }
+    job.archive = success ? openFile(ACCOUNTS_ARCHIVE, "rb+") : NULL;
+    success = job.archive != NULL;
+    
+    long archiveStart = 0;
+    if (success) {
+        fseek(job.archive, 0, SEEK_END);
+        archiveStart = job.archiveCount = ftell(job.archive) / sizeof(BankAccount);
+        fseek(job.archive, archiveStart * (long)sizeof(BankAccount), SEEK_SET);
+        job.bucketCount = indexBucketCount(copyCount, 0);
+        job.slots = calloc(job.bucketCount, sizeof(IndexSlot));
+        success = job.slots != NULL;
+    }
+    
+    // Only adding an account rewrites accounts.idx, and archived entries never change
+    lockAccountStore(0);
+    success = success && copyArchivedEntries(&job);
+    unlockAccountStore(0);
+    
+    for (int shard = 0; shard < shardCount; shard++) {
+        for (long first = 0; success && first < copyCounts[shard]; first += ACCOUNT_MAP_CHUNK) {
+            long count = copyCounts[shard] - first < ACCOUNT_MAP_CHUNK ? copyCounts[shard] - first : ACCOUNT_MAP_CHUNK;
+            lockAccountStore(0);
+            success = readStoreRecords(stores[shard], first, count, block);
+            unlockAccountStore(0);
+            for (long i = 0; success && i < count; i++) {
+                success = placeCompactedAccount(&job, &block[i]);
+            }
+        }
+    }
+    double copySeconds = microsSince(&start) / 1e6;
+    
+    long *changed = NULL;
+    long changedCount = 0, pauseMicros = 0;
+    int swapped = 0, renamed = 0;
+    if (success && job.archiveCount > archiveStart) {
+        lockAccountStore(1);
+        clock_gettime(CLOCK_REALTIME, &pauseStart);
+        
+        // Record numbers are about to change, so nothing may stay cached
+        success = flushTransactionLog() && flushAccountCache(1);
+        pthread_mutex_lock(&transactionLog.lock);
+        long endPosition = transactionLog.recordCount;
+        pthread_mutex_unlock(&transactionLog.lock);
+        changed = success ? collectChangedAccounts(startPosition, endPosition - startPosition, &changedCount) : NULL;
+        success = changed != NULL;
+        
+        // Accounts added during the copy are in the log too, so they are placed here
+        for (long i = 0; success && i < changedCount; i++) {
+            BankAccount account;
+            long recordNumber;
+            if (mapped) {
+                BankAccount *current = mappedAccount((int)changed[i], &recordNumber);
+                if (current == NULL) continue;
+                account = *current;
+            } else if (!readIndexedAccount((int)changed[i], &recordNumber, &account)) {
+                continue;
+            }
+            
+            const IndexSlot *slot = indexFind(job.slots, job.bucketCount, account.accountNumber);
+            success = slot != NULL ? rewriteCompactedAccount(&job, slot->value, &account)
+                                   : placeCompactedAccount(&job, &account);
+        }
+        
+        for (int shard = 0; success && shard < shardCount; shard++) {
+            success = fflush(job.outputs[shard]) == 0 && syncDescriptor(fileno(job.outputs[shard])) == 0;
+        }
+        success = success && fflush(job.archive) == 0 && syncDescriptor(fileno(job.archive)) == 0 &&
+                  writeIndexFile(INDEX_COMPACT, job.slots, job.bucketCount, job.entryCount, job.liveCount);
+        
+        if (success) {
+            long oldCount = accountMap.recordCount;
+            int direct = directIndex.fd >= 0;
+            closeDirectIndex();
+            if (mapped) {
+                unmapAccountIndex();
+                unmapAccountStore();
+            }
+            
+            // With no index at all, a start after a crash between the
+            // renames rebuilds one from the store and the archive; a shard
+            // not yet renamed still holds its archived accounts, and its
+            // copies take precedence over the archive's
+            remove(ACCOUNTS_DIRECT);
+            remove(ACCOUNTS_INDEX);
+            while (renamed < shardCount && rename(temps[renamed], paths[renamed]) == 0) renamed++;
+            swapped = renamed == shardCount;
+            if (!swapped || rename(INDEX_COMPACT, ACCOUNTS_INDEX) != 0) {
+                success = rebuildAccountIndex() && swapped;
+            }
+            if (mapped && (!mapAccountStore(swapped ? job.liveCount : oldCount) || !mapAccountIndex())) {
+                printf("❌ accounts.db could not be mapped again; restart the program.\n");
+                success = 0;
+            }
+            
+            // Until it is rebuilt, lookups go through accounts.idx
+            if (direct && swapped && !openDirectIndex(job.liveCount)) {
+                printf("⚠️  Could not rebuild %s; lookups will use the hash index.\n", ACCOUNTS_DIRECT);
+            }
+            success = success && writeCheckpoint();
+        }
+        
+        pauseMicros = microsSince(&pauseStart);
+        unlockAccountStore(1);
+    }
+    
+    for (int shard = 0; shard < shardCount; shard++) {
+        if (stores[shard] != NULL) fclose(stores[shard]);
+        if (job.outputs[shard] != NULL) fclose(job.outputs[shard]);
+        if (shard >= renamed && job.outputs[shard] != NULL) remove(temps[shard]);
+    }
+    if (job.archive != NULL) {
+        // Until a shard is swapped, the records just archived are still in the store
+        if (renamed == 0 && (fflush(job.archive) != 0 ||
+                         ftruncate(fileno(job.archive), archiveStart * (off_t)sizeof(BankAccount)) != 0)) {
+            printf("⚠️  Could not trim %s; its extra records are harmless.\n", ACCOUNTS_ARCHIVE);
+        }
+        fclose(job.archive);
+    }
+    remove(INDEX_COMPACT);
+    free(job.slots);
+    free(block);
+    free(changed);
+    
+    if (!success) {
+        printf("❌ Compaction failed!%s\n", renamed > 0 ? "" : " The account files were left unchanged.");
+        return -1;
+    }
+    
+    long archived = job.archiveCount - archiveStart;
+    if (archived > 0) {
+        printf("🗜️  Copied %ld record(s) in %.2f s; the account files now hold %ld record(s)\n",
+               copyCount, copySeconds, job.liveCount);
+        printf("⏱️  Postings paused for %.1f ms to recopy %ld account(s) changed during the copy\n",
+               pauseMicros / 1000.0, changedCount);
+    }
+    return archived;
+}
+
+int compareAccountNumbers(const void *a, const void *b) {
+    int x = ((const BankAccount *)a)->accountNumber, y = ((const BankAccount *)b)->accountNumber;
+    return (x > y) - (x < y);
+}
+
+// Offline reshard: rewrites the store as shardCount files split at the
+// account numbers that give each about the same number of accounts. The
+// files are written under a new generation, so the live ones stay intact
+// until accounts.shards (or, going back to one shard, accounts.db) is
+// replaced. Returns the number of accounts written, or -1 on error.
+long reshardAccounts(int shardCount) {
+    lockAccountStore(1);
+    
+    // Record numbers are about to change, so nothing may stay cached
+    long starts[MAX_SHARDS + 1];
+    BankAccount *accounts = NULL;
+    long count = flushTransactionLog() && flushAccountCache(1) ? loadAccountStore(&accounts, starts) : -1;
+    if (count < 0) {
+        unlockAccountStore(1);
+        printf("❌ Could not read the account files!\n");
+        return -1;
+    }
+    
+    long live = 0;
+    for (long i = 0; i < count; i++) {
+        if (accounts[i].accountNumber != 0) accounts[live++] = accounts[i];
+    }
+    qsort(accounts, live, sizeof(BankAccount), compareAccountNumbers);
+    
+    // Too few accounts to split evenly: divide the number range instead
+    ShardMap map = { SHARD_MAP_MAGIC, SHARD_MAP_VERSION, shardCount > 1 ? shardMap.generation + 1 : 0,
+                     shardCount, { 0 } };
+    for (int shard = 1; shard < shardCount; shard++) {
+        map.firstAccount[shard] = live >= shardCount ? accounts[live * shard / shardCount].accountNumber :
+                                  (int)(10000 + (INT32_MAX - 10000L) / shardCount * shard);
+    }
+    
+    long newStarts[MAX_SHARDS + 1] = { 0 };
+    for (long i = 0; i < live; i++) newStarts[shardOfAccount(&map, accounts[i].accountNumber) + 1]++;
+    for (int shard = 0; shard < shardCount; shard++) newStarts[shard + 1] += newStarts[shard];
+    
+    int success = 1;
+    for (int shard = 0; success && shard < shardCount; shard++) {
+        char path[64];
+        shardFilePath(&map, shard, path, sizeof(path));
+        FILE *file = openFile(shardCount > 1 ? path : ACCOUNTS_COMPACT, "wb");
+        long records = newStarts[shard + 1] - newStarts[shard];
+        success = file != NULL &&
+                  (long)writeRecords(accounts + newStarts[shard], sizeof(BankAccount), records, file) == records &&
+                  fflush(file) == 0 && syncDescriptor(fileno(file)) == 0;
+        if (file != NULL) success = (fclose(file) == 0) && success;
+    }
+    if (shardCount > 1 && success) {
+        FILE *file = openFile(SHARD_MAP_TEMP, "wb");
+        success = file != NULL && writeRecords(&map, sizeof(ShardMap), 1, file) == 1 &&
+                  fflush(file) == 0 && syncDescriptor(fileno(file)) == 0;
+        if (file != NULL) success = (fclose(file) == 0) && success;
+    }
+    
+    // Replacing the map (or accounts.db) switches layouts in one rename.
+    // The indexes go first, so a start after a crash rebuilds them from
+    // whichever layout is then live.
+    int direct = directIndex.fd >= 0;
+    if (success) {
+        closeDirectIndex();
+        remove(ACCOUNTS_DIRECT);
+        remove(ACCOUNTS_INDEX);
+        if (shardCount > 1) {
+            success = rename(SHARD_MAP_TEMP, ACCOUNTS_SHARD_MAP) == 0;
+        } else {
+            success = rename(ACCOUNTS_COMPACT, ACCOUNTS_DB) == 0;
+            if (success) remove(ACCOUNTS_SHARD_MAP);
+        }
+    }
+    
+    ShardMap old = shardMap;
+    if (success) {
+        shardMap = map;
+        // The old layout's files are unused now, unless both layouts are the one accounts.db
+        for (int shard = 0; (old.shardCount > 1 || shardCount > 1) && shard < old.shardCount; shard++) {
+            char path[64];
+            shardFilePath(&old, shard, path, sizeof(path));
+            remove(path);
+        }
+    } else {
+        for (int shard = 0; shard < shardCount; shard++) {
+            char path[64];
+            shardFilePath(&map, shard, path, sizeof(path));
+            remove(shardCount > 1 ? path : ACCOUNTS_COMPACT);
+        }
+        remove(SHARD_MAP_TEMP);
+    }
+    
+    success = rebuildAccountIndex() && success;
+    if (direct && !openDirectIndex(storeRecordCount())) {
+        printf("⚠️  Could not rebuild %s; lookups will use the hash index.\n", ACCOUNTS_DIRECT);
+    }
+    success = success && writeCheckpoint();
+    unlockAccountStore(1);
+    
+    if (success) {
+        for (int shard = 0; shard < shardCount; shard++) {
+            char path[64];
+            shardFilePath(&map, shard, path, sizeof(path));
+            printf("  %-20s accounts from %-10d %ld record(s)\n", path,
+                   shard == 0 ? 0 : map.firstAccount[shard], newStarts[shard + 1] - newStarts[shard]);
+        }
+    }
+    free(accounts);
+    return success ? live : -1;
+}
+
+// Ledger Posting Functions
+void fillTransaction(LogRecord *record, int accountNumber, TransactionType type,
+                     long amountCents, long balanceAfter, const char *description) {
+    memset(record, 0, sizeof(LogRecord));
+    record->accountNumber = accountNumber;
+    record->type = type;
+    record->amount = amountCents;
+    record->balanceAfter = balanceAfter;
+    record->timestamp = currentMicros();
+    record->description = internDescription(description);
+}
+
+const char *postResultMessage(PostResult result) {
+    switch (result) {
+        case POST_OK: return "ok";
+        case POST_BAD_FORMAT: return "malformed line";
+        case POST_INVALID_AMOUNT: return "invalid amount";
+        case POST_LIMIT_EXCEEDED: return "amount exceeds transaction limit";
+        case POST_INVALID_DETAILS: return "invalid account details";
+        case POST_NO_ACCOUNT: return "account not found";
+        case POST_ACCOUNT_CLOSED: return "account is closed";
+        case POST_ACCOUNT_EXISTS: return "account already exists";
+        case POST_SAME_ACCOUNT: return "cannot transfer to the same account";
+        case POST_INSUFFICIENT_FUNDS: return "insufficient funds";
+        case POST_VELOCITY_LIMIT: return "velocity limit reached";
+        case POST_BALANCE_REMAINING: return "account still has a balance";
+        case POST_STORAGE_ERROR: return "storage error";
+        case POST_NOT_DURABLE: return "applied, but not saved to disk";
+    }
+    return "unknown error";
+}
+
+// Whether the posting changed the ledger, saved to disk or not
+int postApplied(PostResult result) {
+    return result == POST_OK || result == POST_NOT_DURABLE;
+}
+
+// Looks up an open account that can take part in a posting
+PostResult findOpenAccount(int accountNumber, BankAccount *account) {
+    if (!findAccountByNumber(accountNumber, account)) return POST_NO_ACCOUNT;
+    if (!account->isActive) return POST_ACCOUNT_CLOSED;
+    return POST_OK;
+}
+
+PostResult checkAmount(long amountCents) {
+    if (amountCents <= 0) return POST_INVALID_AMOUNT;
+    if (amountCents > MAX_TRANSACTION_CENTS) return POST_LIMIT_EXCEEDED;
+    return POST_OK;
+}
+
+// Each post function times one posting; the execute functions do the work.
+// With --shared they also hold the accounts' locks against other processes.
+PostResult postDeposit(int accountNumber, long amountCents, long *balanceAfter) {
+    struct timespec start;
+    startMetric(&start);
+    lockSharedAccounts(accountNumber, accountNumber);
+    PostResult result = executeDeposit(accountNumber, amountCents, balanceAfter);
+    unlockSharedAccounts(accountNumber, accountNumber);
+    stopMetric(METRIC_DEPOSIT, &start);
+    return result;
+}
+
+PostResult postWithdrawal(int accountNumber, long amountCents, long *balanceAfter) {
+    struct timespec start;
+    startMetric(&start);
+    lockSharedAccounts(accountNumber, accountNumber);
+    PostResult result = executeWithdrawal(accountNumber, amountCents, balanceAfter);
+    unlockSharedAccounts(accountNumber, accountNumber);
+    stopMetric(METRIC_WITHDRAWAL, &start);
+    return result;
+}
+
+PostResult postTransfer(int fromAccount, int toAccount, long amountCents, long *balanceAfter) {
+    struct timespec start;
+    startMetric(&start);
+    lockSharedAccounts(fromAccount, toAccount);
+    PostResult result = executeTransfer(fromAccount, toAccount, amountCents, balanceAfter);
+    unlockSharedAccounts(fromAccount, toAccount);
+    stopMetric(METRIC_TRANSFER, &start);
+    return result;
+}
+
+PostResult postOpenAccount(const BankAccount *account) {
+    struct timespec start;
+    startMetric(&start);
+    lockSharedStore(1);
+    PostResult result = executeOpenAccount(account);
+    unlockSharedStore(1);
+    stopMetric(METRIC_OPEN_ACCOUNT, &start);
+    return result;
+}
+
+PostResult postCloseAccount(int accountNumber) {
+    struct timespec start;
+    startMetric(&start);
+    lockSharedAccounts(accountNumber, accountNumber);
+    PostResult result = executeCloseAccount(accountNumber);
+    unlockSharedAccounts(accountNumber, accountNumber);
+    stopMetric(METRIC_CLOSE_ACCOUNT, &start);
+    return result;
+}
+
+PostResult executeDeposit(int accountNumber, long amountCents, long *balanceAfter) {
+    BankAccount account;
+    PostResult result = checkAmount(amountCents);
+    if (result == POST_OK) result = findOpenAccount(accountNumber, &account);
+    if (result != POST_OK) return result;
+    
+    long newBalanceCents = account.balance + amountCents;
+    LogRecord transaction;
+    fillTransaction(&transaction, accountNumber, TX_DEPOSIT, amountCents, newBalanceCents, "Cash deposit");
+    
+    long firstRecord;
+    if (!appendTransactions(&transaction, 1, &firstRecord)) return POST_STORAGE_ERROR;
+    if (!updateAccountBalance(accountNumber, newBalanceCents)) {
+        rollbackTransactions(firstRecord, 1);
+        return POST_STORAGE_ERROR;
+    }
+    *balanceAfter = newBalanceCents;
+    return commitTransactions(&transaction, 1, firstRecord) ? POST_OK : POST_NOT_DURABLE;
+}
+
+PostResult executeWithdrawal(int accountNumber, long amountCents, long *balanceAfter) {
+    BankAccount account;
+    PostResult result = checkAmount(amountCents);
+    if (result == POST_OK) result = findOpenAccount(accountNumber, &account);
+    if (result != POST_OK) return result;
+    if (amountCents > account.balance) return POST_INSUFFICIENT_FUNDS;
+    result = checkVelocity(accountNumber, amountCents, 0);
+    if (result != POST_OK) return result;
+    
+    long newBalanceCents = account.balance - amountCents;
+    LogRecord transaction;
+    fillTransaction(&transaction, accountNumber, TX_WITHDRAWAL, amountCents, newBalanceCents, "Cash withdrawal");
+    
+    long firstRecord;
+    if (!appendTransactions(&transaction, 1, &firstRecord)) return POST_STORAGE_ERROR;
+    if (!updateAccountBalance(accountNumber, newBalanceCents)) {
+        rollbackTransactions(firstRecord, 1);
+        return POST_STORAGE_ERROR;
+    }
+    *balanceAfter = newBalanceCents;
+    return commitTransactions(&transaction, 1, firstRecord) ? POST_OK : POST_NOT_DURABLE;
+}
+
+PostResult executeTransfer(int fromAccount, int toAccount, long amountCents, long *balanceAfter) {
+    BankAccount sender, receiver;
+    if (fromAccount == toAccount) return POST_SAME_ACCOUNT;
+    
+    PostResult result = checkAmount(amountCents);
+    if (result == POST_OK) result = findOpenAccount(fromAccount, &sender);
+    if (result == POST_OK) result = findOpenAccount(toAccount, &receiver);
+    if (result != POST_OK) return result;
+    if (amountCents > sender.balance) return POST_INSUFFICIENT_FUNDS;
+    result = checkVelocity(fromAccount, amountCents, 1);
+    if (result != POST_OK) return result;
+    
+    char description[MAX_DESCRIPTION_LENGTH];
+    LogRecord transactions[2];
+    
+    snprintf(description, sizeof(description), "Transfer to account %d (%s)", toAccount, receiver.fullName);
+    fillTransaction(&transactions[0], fromAccount, TX_TRANSFER_SENT, amountCents,
+                    sender.balance - amountCents, description);
+    snprintf(description, sizeof(description), "Transfer from account %d (%s)", fromAccount, sender.fullName);
+    fillTransaction(&transactions[1], toAccount, TX_TRANSFER_RECEIVED, amountCents,
+                    receiver.balance + amountCents, description);
+    
+    // Both halves are logged in one append so recovery never sees only one of them
+    long firstRecord;
+    if (!appendTransactions(transactions, 2, &firstRecord)) return POST_STORAGE_ERROR;
+    if (!transferFundsWithRollback(fromAccount, toAccount, amountCents)) {
+        rollbackTransactions(firstRecord, 2);
+        return POST_STORAGE_ERROR;
+    }
+    *balanceAfter = sender.balance - amountCents;
+    return commitTransactions(transactions, 2, firstRecord) ? POST_OK : POST_NOT_DURABLE;
+}
+
+PostResult executeOpenAccount(const BankAccount *account) {
+    BankAccount existing;
+    if (findAccountByNumber(account->accountNumber, &existing)) return POST_ACCOUNT_EXISTS;
+    
+    LogRecord transaction;
+    fillTransaction(&transaction, account->accountNumber, TX_ACCOUNT_CREATION, account->balance,
+                    account->balance, "Account created with initial deposit");
+    
+    // Recovery can only repair accounts it finds in the log, so the
+    // creation record must reach the file before the account does
+    long firstRecord;
+    if (!appendTransactions(&transaction, 1, &firstRecord)) return POST_STORAGE_ERROR;
+    if (!flushTransactionLog() || !createAccount(account)) {
+        rollbackTransactions(firstRecord, 1);
+        return POST_STORAGE_ERROR;
+    }
+    return commitTransactions(&transaction, 1, firstRecord) ? POST_OK : POST_NOT_DURABLE;
+}
+
+PostResult executeCloseAccount(int accountNumber) {
+    BankAccount account;
+    PostResult result = findOpenAccount(accountNumber, &account);
+    if (result != POST_OK) return result;
+    if (account.balance > 0) return POST_BALANCE_REMAINING;
+    
+    LogRecord transaction;
+    fillTransaction(&transaction, accountNumber, TX_ACCOUNT_CLOSURE, 0, 0, "Account closed permanently");
+    
+    long firstRecord;
+    if (!appendTransactions(&transaction, 1, &firstRecord)) return POST_STORAGE_ERROR;
+    if (!closeAccount(accountNumber)) {
+        rollbackTransactions(firstRecord, 1);
+        return POST_STORAGE_ERROR;
+    }
+    return commitTransactions(&transaction, 1, firstRecord) ? POST_OK : POST_NOT_DURABLE;
+}
+
+// Concurrent Engine Functions
+void initAccountStripes() {
+    if (accountStripesReady) return;
+    for (int i = 0; i < LOCK_STRIPES; i++) {
+        pthread_mutex_init(&accountStripes[i], NULL);
+    }
+    accountStripesReady = 1;
+}
+
+int accountStripe(int accountNumber) {
+    return (int)(((uint32_t)accountNumber * 2654435761u) % LOCK_STRIPES);
+}
+
+// Locks the stripes of one or two accounts in ascending stripe order
+void lockAccounts(int firstAccount, int secondAccount) {
+    int first = accountStripe(firstAccount);
+    int second = accountStripe(secondAccount);
+    
+    if (first > second) {
+        int swap = first;
+        first = second;
+        second = swap;
+    }
+    pthread_mutex_lock(&accountStripes[first]);
+    if (second != first) pthread_mutex_lock(&accountStripes[second]);
+}
+
+void unlockAccounts(int firstAccount, int secondAccount) {
+    int first = accountStripe(firstAccount);
+    int second = accountStripe(secondAccount);
+    
+    if (second != first) pthread_mutex_unlock(&accountStripes[second]);
+    pthread_mutex_unlock(&accountStripes[first]);
+}
+
+// Shared Access Functions
+
+// Opens accounts.lock and joins the session. Returns 1 if no other process
+// has the database open (this one recovers it if needed), 0 if this one
+// joins running processes, or -1 on error.
+int openSharedLocks() {
+    sharedLocks.fd = openDescriptor(ACCOUNTS_LOCK, O_RDWR | O_CREAT, 0644);
+    if (sharedLocks.fd < 0) return -1;
+    if (lockByte(LOCK_SESSION_BYTE, F_WRLCK, 0)) return 1;
+    
+    // Waits while a first process is still starting up; if every other
+    // process has gone by then, the upgrade succeeds and this one is first
+    if (!lockByte(LOCK_SESSION_BYTE, F_RDLCK, 1)) {
+        closeSharedLocks();
+        return -1;
+    }
+    return lockByte(LOCK_SESSION_BYTE, F_WRLCK, 0) ? 1 : 0;
+}
+
+// Closing the descriptor releases every lock the process still holds
+void closeSharedLocks() {
+    if (sharedLocks.fd >= 0) close(sharedLocks.fd);
+    sharedLocks.fd = -1;
+    sharedLocks.storeHolders = 0;
+    sharedLocks.logHolders = 0;
+}
+
+// accounts.lock also counts the processes in the session. Each adds itself
+// when it joins and takes itself off when it closes the database, so the
+// last one out can tell whether any left without closing it. Read and
+// written with the store lock held exclusively.
+long readProcessCount() {
+    int64_t count = 0;
+    if (readAt(sharedLocks.fd, &count, sizeof(count), LOCK_COUNT_OFFSET) != sizeof(count)) return 0;
+    return count;
+}
+
+void writeProcessCount(long count) {
+    int64_t value = count;
+    if (writeAt(sharedLocks.fd, &value, sizeof(value), LOCK_COUNT_OFFSET) != sizeof(value)) {
+        printf("⚠️  Could not update the process count in %s.\n", ACCOUNTS_LOCK);
+    }
+}
+
+// Sets a lock of type F_RDLCK, F_WRLCK or F_UNLCK on one byte of
+// accounts.lock; without wait, returns 0 at once if another process holds it
+int lockByte(off_t offset, short type, int wait) {
+    struct flock region;
+    memset(&region, 0, sizeof(region));
+    region.l_type = type;
+    region.l_whence = SEEK_SET;
+    region.l_start = offset;
+    region.l_len = 1;
+    
+    while (fcntl(sharedLocks.fd, wait ? F_SETLKW : F_SETLK, &region) != 0) {
+        if (errno != EINTR) return 0;
+    }
+    return 1;
+}
+
+// Exclusive holders also hold accountStoreLock exclusively, so no other
+// thread of this process can share the byte with them
+void lockSharedStore(int exclusive) {
+    if (sharedLocks.fd < 0) return;
+    pthread_mutex_lock(&sharedLocks.storeLock);
+    if (exclusive || sharedLocks.storeHolders++ == 0) {
+        lockByte(LOCK_STORE_BYTE, exclusive ? F_WRLCK : F_RDLCK, 1);
+    }
+    pthread_mutex_unlock(&sharedLocks.storeLock);
+}
+
+void unlockSharedStore(int exclusive) {
+    if (sharedLocks.fd < 0) return;
+    pthread_mutex_lock(&sharedLocks.storeLock);
+    if (exclusive || --sharedLocks.storeHolders == 0) lockByte(LOCK_STORE_BYTE, F_UNLCK, 0);
+    pthread_mutex_unlock(&sharedLocks.storeLock);
+}
+
+// Held around every change to the log and the files appended or rewritten
+// with it; it may be taken again by a thread that already holds it
+void lockSharedLog() {
+    if (sharedLocks.fd < 0) return;
+    pthread_mutex_lock(&sharedLocks.logLock);
+    if (sharedLocks.logHolders++ == 0) lockByte(LOCK_LOG_BYTE, F_WRLCK, 1);
+    pthread_mutex_unlock(&sharedLocks.logLock);
 }
 
-int updateAccountPassword(int accountNumber, const char *newPassword) {
-    FILE *file = fopen(ACCOUNTS_DB, "rb+");
-    if (file == NULL) return 0;
+void unlockSharedLog() {
+    if (sharedLocks.fd < 0) return;
+    pthread_mutex_lock(&sharedLocks.logLock);
+    if (--sharedLocks.logHolders == 0) lockByte(LOCK_LOG_BYTE, F_UNLCK, 0);
+    pthread_mutex_unlock(&sharedLocks.logLock);
+}
+
+// Locks one or two accounts against the other processes, lower number
+// first, under the shared store lock. Postings read the accounts only once
+// they hold these, so a balance is never changed from a stale copy.
+void lockSharedAccounts(int firstAccount, int secondAccount) {
+    if (sharedLocks.fd < 0) return;
+    uint32_t low = (uint32_t)firstAccount < (uint32_t)secondAccount ? firstAccount : secondAccount;
+    uint32_t high = (uint32_t)firstAccount < (uint32_t)secondAccount ? secondAccount : firstAccount;
+    
+    lockSharedStore(0);
+    lockByte(LOCK_ACCOUNT_BASE + (off_t)low, F_WRLCK, 1);
+    if (high != low) lockByte(LOCK_ACCOUNT_BASE + (off_t)high, F_WRLCK, 1);
+}
+
+void unlockSharedAccounts(int firstAccount, int secondAccount) {
+    if (sharedLocks.fd < 0) return;
+    lockByte(LOCK_ACCOUNT_BASE + (off_t)(uint32_t)firstAccount, F_UNLCK, 0);
+    if (secondAccount != firstAccount) lockByte(LOCK_ACCOUNT_BASE + (off_t)(uint32_t)secondAccount, F_UNLCK, 0);
+    unlockSharedStore(0);
+}
+
+// Takes in the records other processes have appended since this one last
+// looked. Each process links and maps its own records, so here only the
+// record count, the time index, the rollups, the velocity counters and the
+// ID sequence move forward. Called with the log lock held, so no record is
+// half written.
+int refreshSharedLogLocked() {
+    if (sharedLocks.fd < 0) return 1;
+    
+    struct stat info;
+    if (fstat(transactionLog.fd, &info) != 0) return 0;
+    long recordCount = logRecordCount(info.st_size);
+    
+    LogRecord block[64];
+    for (long first = transactionLog.recordCount; first < recordCount; first += 64) {
+        long count = recordCount - first < 64 ? recordCount - first : 64;
+        size_t length = count * sizeof(LogRecord);
+        if (readAt(transactionLog.fd, block, length, logOffset(first)) != (ssize_t)length) return 0;
+        indexRecordTimesLocked(block, first, count);
+        rollUpRecordsLocked(block, count, 1);
+        noteVelocityLocked(block, count, 1);
+    }
+    transactionLog.recordCount = recordCount;
+    transactionLog.linkedCount = recordCount;
+    
+    // [0] is the reservation, [1] the next ID handed out by any process
+    int64_t sequence[2];
+    if (readAt(transactionLog.sequenceFd, sequence, sizeof(sequence), 0) == sizeof(sequence)) {
+        if (sequence[0] > transactionLog.reservedTransactionId) transactionLog.reservedTransactionId = sequence[0];
+        if (sequence[1] > transactionLog.nextTransactionId) transactionLog.nextTransactionId = sequence[1];
+    }
+    return 1;
+}
+
+int refreshSharedLog() {
+    if (sharedLocks.fd < 0) return 1;
+    lockSharedLog();
+    pthread_mutex_lock(&transactionLog.lock);
+    int success = refreshSharedLogLocked();
+    pthread_mutex_unlock(&transactionLog.lock);
+    unlockSharedLog();
+    return success;
+}
+
+// accountStoreLock plus, with --shared, the store lock of every process.
+// An exclusive holder sees the log as the other processes left it.
+void lockAccountStore(int exclusive) {
+    if (exclusive) {
+        pthread_rwlock_wrlock(&accountStoreLock);
+    } else {
+        pthread_rwlock_rdlock(&accountStoreLock);
+    }
+    lockSharedStore(exclusive);
+    if (exclusive && !refreshSharedLog()) {
+        printf("⚠️  Could not read the transactions added by other processes.\n");
+    }
+}
+
+void unlockAccountStore(int exclusive) {
+    unlockSharedStore(exclusive);
+    pthread_rwlock_unlock(&accountStoreLock);
+}
+
+// Thread-safe wrappers around the posting functions; the stripe lock makes
+// each read-check-append-apply-commit sequence atomic for its accounts.
+// Once the locks are released, a wrapper takes a checkpoint if one is due.
+PostResult engineDeposit(int accountNumber, long amountCents, long *balanceAfter) {
+    pthread_rwlock_rdlock(&accountStoreLock);
+    lockAccounts(accountNumber, accountNumber);
+    PostResult result = postDeposit(accountNumber, amountCents, balanceAfter);
+    unlockAccounts(accountNumber, accountNumber);
+    pthread_rwlock_unlock(&accountStoreLock);
+    checkpointIfDue();
+    return result;
+}
+
+PostResult engineWithdrawal(int accountNumber, long amountCents, long *balanceAfter) {
+    pthread_rwlock_rdlock(&accountStoreLock);
+    lockAccounts(accountNumber, accountNumber);
+    PostResult result = postWithdrawal(accountNumber, amountCents, balanceAfter);
+    unlockAccounts(accountNumber, accountNumber);
+    pthread_rwlock_unlock(&accountStoreLock);
+    checkpointIfDue();
+    return result;
+}
+
+PostResult engineTransfer(int fromAccount, int toAccount, long amountCents, long *balanceAfter) {
+    pthread_rwlock_rdlock(&accountStoreLock);
+    lockAccounts(fromAccount, toAccount);
+    PostResult result = postTransfer(fromAccount, toAccount, amountCents, balanceAfter);
+    unlockAccounts(fromAccount, toAccount);
+    pthread_rwlock_unlock(&accountStoreLock);
+    checkpointIfDue();
+    return result;
+}
+
+PostResult engineOpenAccount(const BankAccount *account) {
+    pthread_rwlock_wrlock(&accountStoreLock);
+    PostResult result = postOpenAccount(account);
+    pthread_rwlock_unlock(&accountStoreLock);
+    checkpointIfDue();
+    return result;
+}
+
+PostResult engineCloseAccount(int accountNumber) {
+    pthread_rwlock_rdlock(&accountStoreLock);
+    lockAccounts(accountNumber, accountNumber);
+    PostResult result = postCloseAccount(accountNumber);
+    unlockAccounts(accountNumber, accountNumber);
+    pthread_rwlock_unlock(&accountStoreLock);
+    checkpointIfDue();
+    return result;
+}
+
+// Read-side wrappers: the stripe lock keeps the account's record and
+// history stable while they are read
+int engineAuthenticate(int accountNumber, const char *password, BankAccount *account) {
+    pthread_rwlock_rdlock(&accountStoreLock);
+    lockAccounts(accountNumber, accountNumber);
+    int authenticated = authenticateUser(accountNumber, password, account);
+    unlockAccounts(accountNumber, accountNumber);
+    pthread_rwlock_unlock(&accountStoreLock);
+    return authenticated;
+}
+
+// Renders the newest page of an account's history into cursor->page and
+// returns how many transactions it holds, or -1 on error. The caller
+// closes the cursor either way.
+int engineReadHistory(int accountNumber, HistoryCursor *cursor) {
+    pthread_rwlock_rdlock(&accountStoreLock);
+    lockAccounts(accountNumber, accountNumber);
+    int count = -1;
+    if (openHistoryCursor(cursor, accountNumber, 0, 1, HISTORY_PAGE_SIZE)) {
+        count = nextHistoryBatch(cursor);
+    }
+    unlockAccounts(accountNumber, accountNumber);
+    pthread_rwlock_unlock(&accountStoreLock);
+    return count;
+}
+
+// Deletes every file the database keeps in the current directory
+void removeDatabaseFiles() {
+    const char *files[] = {
+        ACCOUNTS_DB, ACCOUNTS_INDEX, TRANSACTIONS_DB, TRANSACTIONS_CHAIN,
+        TRANSACTIONS_HEADS, TRANSACTIONS_DESCRIPTIONS, TRANSACTIONS_LEGACY, TRANSACTIONS_IDS,
+        TRANSACTION_SEQUENCE, RECOVERY_MARKER, ACCOUNTS_CHECKPOINT, CHECKPOINT_TEMP,
+        TRANSACTIONS_TIME, TIME_INDEX_TEMP, ACCOUNTS_ARCHIVE, ACCOUNTS_COMPACT, INDEX_COMPACT,
+        ACCOUNTS_DIRECT, ACCOUNTS_LOCK, ACCOUNTS_SHARD_MAP, SHARD_MAP_TEMP, TRANSACTIONS_ROLLUP, ROLLUP_TEMP
+    };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        remove(files[i]);
+    }
+    for (int shard = 0; shardMap.shardCount > 1 && shard < shardMap.shardCount; shard++) {
+        char path[64];
+        shardFilePath(&shardMap, shard, path, sizeof(path));
+        remove(path);
+    }
+}
+
+long totalAccountBalances() {
+    long total = 0;
+    for (long record = 0; record < accountMap.recordCount; record++) {
+        total += accountMap.records[record].balance;
+    }
+    return total;
+}
+
+void *stressWorker(void *arg) {
+    StressWorker *worker = arg;
+    long balanceAfter;
+    
+    for (long i = 0; i < worker->operations; i++) {
+        int account = STRESS_FIRST_ACCOUNT + rand_r(&worker->seed) % STRESS_ACCOUNTS;
+        int other = STRESS_FIRST_ACCOUNT + rand_r(&worker->seed) % STRESS_ACCOUNTS;
+        long amountCents = 1 + rand_r(&worker->seed) % 5000;
+        int choice = rand_r(&worker->seed) % 10;
+        PostResult result;
+        
+        if (choice == 0) {
+            result = engineDeposit(account, amountCents, &balanceAfter);
+            if (postApplied(result)) worker->netDepositCents += amountCents;
+        } else if (choice == 1) {
+            result = engineWithdrawal(account, amountCents, &balanceAfter);
+            if (postApplied(result)) worker->netDepositCents -= amountCents;
+        } else {
+            if (other == account) other = STRESS_FIRST_ACCOUNT + (other - STRESS_FIRST_ACCOUNT + 1) % STRESS_ACCOUNTS;
+            result = engineTransfer(account, other, amountCents, &balanceAfter);
+        }
+        
+        if (postApplied(result)) {
+            worker->applied++;
+        } else {
+            worker->rejected++;
+        }
+    }
+    return NULL;
+}
+
+// Runs random deposits, withdrawals and transfers on many threads against a
+// scratch database and checks that no money was created or lost
+int runStressTest(int threadCount, long operationCount) {
+    char originalDirectory[4096];
+    char directory[] = "/tmp/bank_stress_XXXXXX";
+    if (getcwd(originalDirectory, sizeof(originalDirectory)) == NULL ||
+        mkdtemp(directory) == NULL || chdir(directory) != 0) {
+        printf("❌ Cannot create a scratch directory for the stress test!\n");
+        return 0;
+    }
+    
+    useMappedStorage = 1;
+    transactionLog.groupCommitRecords = BATCH_GROUP_COMMIT;
+    int success = initializeDatabase() && enableLogBuffering(BATCH_LOG_BUFFER);
+    accountMap.deferSync = 1;
     
     BankAccount account;
-    long position;
-    int found = 0;
+    memset(&account, 0, sizeof(account));
+    for (int i = 0; success && i < STRESS_ACCOUNTS; i++) {
+        snprintf(account.fullName, MAX_NAME_LENGTH, "Stress Account %d", i);
+        account.accountNumber = STRESS_FIRST_ACCOUNT + i;
+        generateSalt(account.salt, 16);
+        hashPassword("stress1234", account.salt, account.passwordHash);
+        account.balance = STRESS_OPENING_BALANCE;
+        account.isActive = 1;
+        account.dateCreated = time(NULL);
+        success = engineOpenAccount(&account) == POST_OK;
+    }
     
-    while (fread(&account, sizeof(BankAccount), 1, file)) {
-        position = ftell(file) - sizeof(BankAccount);
-        
-        if (account.accountNumber == accountNumber) {
-            char newSalt[17];
-            char newHash[65];
-            generateSalt(newSalt, 16);
-            hashPassword(newPassword, newSalt, newHash);
-            
-            strcpy(account.passwordHash, newHash);
-            strcpy(account.salt, newSalt);
-            fseek(file, position, SEEK_SET);
-            fwrite(&account, sizeof(BankAccount), 1, file);
-            found = 1;
-            break;
+    StressWorker *workers = calloc(threadCount, sizeof(StressWorker));
+    success = success && workers != NULL;
+    long openingTotal = success ? totalAccountBalances() : 0;
+    
+    struct timespec start;
+    clock_gettime(CLOCK_REALTIME, &start);
+    int started = 0;
+    for (int i = 0; success && i < threadCount; i++) {
+        workers[i].seed = (unsigned int)time(NULL) + i * 7919;
+        workers[i].operations = operationCount / threadCount + (i < operationCount % threadCount);
+        if (pthread_create(&workers[i].thread, NULL, stressWorker, &workers[i]) != 0) {
+            success = 0;
+        } else {
+            started++;
         }
     }
     
-    fclose(file);
-    return found;
+    long applied = 0, rejected = 0, netDeposits = 0;
+    for (int i = 0; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+        applied += workers[i].applied;
+        rejected += workers[i].rejected;
+        netDeposits += workers[i].netDepositCents;
+    }
+    double seconds = microsSince(&start) / 1e6;
+    
+    if (success) {
+        success = linkDeferredTransactions() && syncTransactionLog();
+        long closingTotal = totalAccountBalances();
+        long mismatched = reconcileAccountsWithLog();
+        
+        printHeader("STRESS TEST");
+        printf("Threads:        %d\n", threadCount);
+        printf("Operations:     %ld applied, %ld rejected\n", applied, rejected);
+        printf("Throughput:     %.0f ops/s (%.2f s)\n", seconds > 0 ? (applied + rejected) / seconds : 0.0, seconds);
+        printf("Opening total:  K%.2f\n", openingTotal / 100.0);
+        printf("Net deposits:   K%.2f\n", netDeposits / 100.0);
+        printf("Closing total:  K%.2f\n", closingTotal / 100.0);
+        printf("Log mismatches: %ld\n", mismatched);
+        
+        success = success && closingTotal == openingTotal + netDeposits && mismatched == 0;
+        printf("%s\n", success ? "✅ PASS: no money created or lost" : "❌ FAIL: balances do not add up");
+        printf("============================================\n");
+    } else {
+        printf("❌ Stress test setup failed!\n");
+    }
+    
+    free(workers);
+    accountMap.deferSync = 0;
+    closeDatabase();
+    removeDatabaseFiles();
+    if (chdir(originalDirectory) != 0 || rmdir(directory) != 0) {
+        printf("⚠️  Could not remove scratch directory %s\n", directory);
+    }
+    return success;
 }
 
-int recordTransaction(const Transaction *transaction) {
-    FILE *file = fopen(TRANSACTIONS_DB, "ab");
-    if (file == NULL) return 0;
+// Storage Benchmark Functions
+
+int compareLongs(const void *a, const void *b) {
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+long nanosSince(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000L + (now.tv_nsec - start->tv_nsec);
+}
+
+// Sleeps until a CLOCK_MONOTONIC time. Returns 0, or an error number
+// (EINTR if a signal cut the sleep short).
+int sleepUntil(const struct timespec *deadline) {
+#ifdef __APPLE__
+    // macOS has no clock_nanosleep, so sleep for the time that is left
+    long nanos = -nanosSince(deadline);
+    if (nanos <= 0) return 0;
+    struct timespec left = { nanos / 1000000000L, nanos % 1000000000L };
+    return nanosleep(&left, NULL) == 0 ? 0 : errno;
+#else
+    return clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, deadline, NULL);
+#endif
+}
+
+// Writes accounts.db, transactions.db, transactions.desc and
+// transactions.ids directly: one creation record per account, then deposits
+// to random accounts until the log holds transactionCount records. The
+// other indexes are left for initializeDatabase to build. balances
+// receives every account's balance.
+int createBenchDatabase(long accountCount, long transactionCount, long *balances) {
+    if (!openDescriptionTable()) return 0;
+    uint32_t created = internDescription("Account created with initial deposit");
+    uint32_t deposited = internDescription("Cash deposit");
+    int success = created != 0 && deposited != 0 && syncDescriptionTable();
+    closeDescriptionTable();
+    
+    FILE *file = success ? openFile(TRANSACTIONS_DB, "wb") : NULL;
+    LogRecord *block = malloc(BATCH_LOG_BUFFER * sizeof(LogRecord));
+    LogHeader header = { LOG_MAGIC, LOG_VERSION, sizeof(LogRecord), 0 };
+    success = file != NULL && block != NULL && writeRecords(&header, sizeof(header), 1, file) == 1;
+    
+    unsigned int seed = BENCH_SEED;
+    int64_t timestamp = currentMicros() - transactionCount * 1000L;
+    for (long first = 0; success && first < transactionCount; first += BATCH_LOG_BUFFER) {
+        long count = transactionCount - first < BATCH_LOG_BUFFER ? transactionCount - first : BATCH_LOG_BUFFER;
+        memset(block, 0, count * sizeof(LogRecord));
+        for (long i = 0; i < count; i++) {
+            long record = first + i;
+            long account = record < accountCount ? record : rand_r(&seed) % accountCount;
+            LogRecord *entry = &block[i];
+            if (record < accountCount) {
+                balances[account] = STRESS_OPENING_BALANCE;
+                entry->type = TX_ACCOUNT_CREATION;
+                entry->amount = STRESS_OPENING_BALANCE;
+                entry->description = created;
+            } else {
+                entry->amount = 1 + rand_r(&seed) % 5000;
+                balances[account] += entry->amount;
+                entry->type = TX_DEPOSIT;
+                entry->description = deposited;
+            }
+            entry->timestamp = timestamp + record * 1000L;
+            entry->balanceAfter = balances[account];
+            entry->transactionId = (int32_t)(record + 1);
+            entry->accountNumber = (int32_t)(BENCH_FIRST_ACCOUNT + account);
+        }
+        success = (long)writeRecords(block, sizeof(LogRecord), count, file) == count;
+    }
+    free(block);
+    if (file != NULL) success = (fclose(file) == 0) && success;
+    
+    // Record n has ID n + 1, so the ID map is simply 0, 1, 2, ...
+    int64_t *ids = malloc(BATCH_LOG_BUFFER * sizeof(int64_t));
+    file = success ? openFile(TRANSACTIONS_IDS, "wb") : NULL;
+    success = file != NULL && ids != NULL;
+    for (long first = 0; success && first <= transactionCount; first += BATCH_LOG_BUFFER) {
+        long count = transactionCount + 1 - first < BATCH_LOG_BUFFER ? transactionCount + 1 - first : BATCH_LOG_BUFFER;
+        for (long i = 0; i < count; i++) ids[i] = first + i;
+        success = (long)writeRecords(ids, sizeof(int64_t), count, file) == count;
+    }
+    free(ids);
+    if (file != NULL) success = (fclose(file) == 0) && success;
+    
+    // Every account shares one password hash; hashing is not what is measured
+    BankAccount *accounts = malloc(ACCOUNT_MAP_CHUNK * sizeof(BankAccount));
+    file = success ? openFile(ACCOUNTS_DB, "wb") : NULL;
+    success = file != NULL && accounts != NULL;
+    if (success) {
+        memset(accounts, 0, ACCOUNT_MAP_CHUNK * sizeof(BankAccount));
+        generateSalt(accounts[0].salt, 16);
+        hashPassword("bench1234", accounts[0].salt, accounts[0].passwordHash);
+        accounts[0].isActive = 1;
+        accounts[0].dateCreated = time(NULL);
+        for (int i = 1; i < ACCOUNT_MAP_CHUNK; i++) accounts[i] = accounts[0];
+    }
+    for (long first = 0; success && first < accountCount; first += ACCOUNT_MAP_CHUNK) {
+        long count = accountCount - first < ACCOUNT_MAP_CHUNK ? accountCount - first : ACCOUNT_MAP_CHUNK;
+        for (long i = 0; i < count; i++) {
+            accounts[i].accountNumber = (int)(BENCH_FIRST_ACCOUNT + first + i);
+            accounts[i].balance = balances[first + i];
+            snprintf(accounts[i].fullName, MAX_NAME_LENGTH, "Bench Account %ld", first + i);
+        }
+        success = (long)writeRecords(accounts, sizeof(BankAccount), count, file) == count;
+    }
+    free(accounts);
+    if (file != NULL) success = (fclose(file) == 0) && success;
+    return success;
+}
+
+// Times operations calls of one storage operation on random accounts.
+// Returns the number of calls that failed, or -1 if none could be made.
+long benchmarkOperation(int operation, long accountCount, long transactionCount, long *balances,
+                        long operations, long *nanos, unsigned int *seed) {
+    BankAccount account;
+    Transaction transaction;
+    HistoryCursor cursor;
+    LogRecord record;
+    struct timespec start;
+    long errors = 0;
+    
+    for (long i = 0; i < operations; i++) {
+        long index = rand_r(seed) % accountCount;
+        long other = (index + 1 + rand_r(seed) % (accountCount > 1 ? accountCount - 1 : 1)) % accountCount;
+        int accountNumber = (int)(BENCH_FIRST_ACCOUNT + index);
+        int otherNumber = (int)(BENCH_FIRST_ACCOUNT + other);
+        long balanceAfter;
+        int ok = 0;
+        
+        if (operation == BENCH_RECORD_TRANSACTION) {
+            fillTransaction(&record, accountNumber, TX_OTHER, 0, balances[index], "Benchmark event");
+        }
+        
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        switch (operation) {
+            case BENCH_FIND_ACCOUNT:
+                ok = findAccountByNumber(accountNumber, &account);
+                break;
+            case BENCH_UPDATE_BALANCE:
+                ok = updateAccountBalance(accountNumber, balances[index]);
+                break;
+            case BENCH_RECORD_TRANSACTION:
+                ok = recordTransaction(&record);
+                break;
+            case BENCH_HISTORY_PAGE:
+                ok = openHistoryCursor(&cursor, accountNumber, 0, 1, HISTORY_PAGE_SIZE);
+                if (ok) {
+                    ok = nextHistoryBatch(&cursor) > 0;
+                    closeHistoryCursor(&cursor);
+                }
+                break;
+            case BENCH_FIND_TRANSACTION:
+                ok = findTransactionById(1 + rand_r(seed) % transactionCount, &transaction);
+                break;
+            case BENCH_TRANSFER:
+                ok = accountCount > 1 && transferFundsWithRollback(accountNumber, otherNumber, 1);
+                break;
+            case BENCH_POST_DEPOSIT:
+                ok = postDeposit(accountNumber, 100, &balanceAfter) == POST_OK;
+                break;
+        }
+        nanos[i] = nanosSince(&start);
+        
+        if (!ok) {
+            errors++;
+        } else if (operation == BENCH_TRANSFER) {
+            balances[index]--;
+            balances[other]++;
+        } else if (operation == BENCH_POST_DEPOSIT) {
+            balances[index] = balanceAfter;
+        }
+    }
+    return errors;
+}
+
+// Builds a scratch database of the given size, times every storage
+// operation on it and prints one CSV line per operation, so that runs can
+// be diffed against a saved baseline. Progress goes to stderr.
+int runBenchmark(long accountCount, long transactionCount, long operations) {
+    char originalDirectory[4096];
+    char directory[] = "/tmp/bank_bench_XXXXXX";
+    if (getcwd(originalDirectory, sizeof(originalDirectory)) == NULL ||
+        mkdtemp(directory) == NULL || chdir(directory) != 0) {
+        printf("❌ Cannot create a scratch directory for the benchmark!\n");
+        return 0;
+    }
     
-    int result = fwrite(transaction, sizeof(Transaction), 1, file);
-    fclose(file);
-    return result == 1;
+    // Every account gets a creation record, so the log holds at least one per account
+    if (transactionCount < accountCount) transactionCount = accountCount;
+    
+    long *balances = malloc(accountCount * sizeof(long));
+    long *nanos = malloc(operations * sizeof(long));
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    
+    fprintf(stderr, "⏳ Generating %ld accounts and %ld transactions...\n", accountCount, transactionCount);
+    int success = balances != NULL && nanos != NULL && createBenchDatabase(accountCount, transactionCount, balances);
+    double generated = nanosSince(&start) / 1e9;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    success = success && initializeDatabase();
+    double opened = nanosSince(&start) / 1e9;
+    if (success) {
+        fprintf(stderr, "Generated in %.2f s; opened and indexed in %.2f s\n", generated, opened);
+    }
+    
+    const char *storage = useMappedStorage ? (useDirectIndex ? "mmap+direct" : "mmap")
+                                           : (useDirectIndex ? "file+direct" : "file");
+    if (success) {
+        printf("operation,storage,cache_size,group_commit,accounts,transactions,operations,errors,"
+               "ops_per_sec,p50_us,p99_us,max_us\n");
+    }
+    
+    unsigned int seed = BENCH_SEED;
+    for (int operation = 0; success && operation < BENCH_OPERATIONS; operation++) {
+        fprintf(stderr, "⏳ %s...\n", benchOperationNames[operation]);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        long errors = benchmarkOperation(operation, accountCount, transactionCount, balances,
+                                         operations, nanos, &seed);
+        double seconds = nanosSince(&start) / 1e9;
+        
+        qsort(nanos, operations, sizeof(long), compareLongs);
+        printf("%s,%s,%d,%d,%ld,%ld,%ld,%ld,%.0f,%.2f,%.2f,%.2f\n", benchOperationNames[operation], storage,
+               useMappedStorage ? 0 : accountCacheSize, transactionLog.groupCommitRecords,
+               accountCount, transactionCount, operations, errors,
+               seconds > 0 ? operations / seconds : 0.0, nanos[operations / 2] / 1e3,
+               nanos[operations * 99 / 100] / 1e3, nanos[operations - 1] / 1e3);
+        fflush(stdout);
+    }
+    if (!success) printf("❌ Benchmark setup failed!\n");
+    
+    free(balances);
+    free(nanos);
+    closeDatabase();
+    removeDatabaseFiles();
+    if (chdir(originalDirectory) != 0 || rmdir(directory) != 0) {
+        printf("⚠️  Could not remove scratch directory %s\n", directory);
+    }
+    return success;
 }
 
-int getAccountTransactions(int accountNumber, Transaction **transactions, int *count) {
-    FILE *file = fopen(TRANSACTIONS_DB, "rb");
-    if (file == NULL) return 0;
+// Load Generator Functions
+
+// Parses a mix such as "10:4:2:3:1": the percentage of sessions that
+// register a new account first, then the relative weights of deposit,
+// withdraw, transfer and history among the actions of a session
+int parseLoadMix(const char *text, LoadConfig *config) {
+    int *weights = config->weights;
+    char extra;
+    
+    if (sscanf(text, "%d:%d:%d:%d:%d%c", &config->registerPercent, &weights[0], &weights[1],
+               &weights[2], &weights[3], &extra) != 5) {
+        return 0;
+    }
+    config->weightTotal = 0;
+    for (int i = 0; i < LOAD_ACTIONS; i++) {
+        if (weights[i] < 0) return 0;
+        config->weightTotal += weights[i];
+    }
+    return config->registerPercent >= 0 && config->registerPercent <= 100 && config->weightTotal > 0;
+}
+
+int addLatencySample(LatencySamples *samples, long nanos) {
+    if (samples->count == samples->capacity) {
+        long capacity = samples->capacity > 0 ? samples->capacity * 2 : 1024;
+        long *grown = realloc(samples->nanos, capacity * sizeof(long));
+        if (grown == NULL) return 0;
+        samples->nanos = grown;
+        samples->capacity = capacity;
+    }
+    samples->nanos[samples->count++] = nanos;
+    return 1;
+}
+
+// Records how long an operation took since start and how it ended
+void timeLoadOperation(LoadClient *client, int type, const struct timespec *start, PostResult result) {
+    LatencySamples *samples = &client->samples[type];
+    
+    if (!addLatencySample(samples, nanosSince(start))) client->failed = 1;
+    if (result == POST_STORAGE_ERROR || result == POST_NOT_DURABLE) {
+        samples->errors++;
+    } else if (result != POST_OK) {
+        samples->rejected++;
+    }
+}
+
+// One scripted customer session. It takes the same steps as a customer at
+// the menus, without the terminal: register (for some sessions), log in,
+// LOAD_ACTIONS_PER_SESSION actions drawn from the mix, then log out.
+void runLoadSession(LoadClient *client) {
+    LoadConfig *config = client->config;
+    BankAccount session;
+    struct timespec start;
+    long balanceAfter;
+    int accountNumber = 0;
     
-    Transaction transaction;
-    int capacity = 10;
-    int size = 0;
+    if (rand_r(&client->seed) % 100 < config->registerPercent) {
+        BankAccount newAccount;
+        memset(&newAccount, 0, sizeof(newAccount));
+        PostResult result = POST_INVALID_DETAILS;
+        
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        newAccount.accountNumber = atomic_fetch_add(&config->nextAccount, 1);
+        snprintf(newAccount.fullName, MAX_NAME_LENGTH, "Load Customer %d", newAccount.accountNumber);
+        if (validateEnhancedPassword(LOAD_PASSWORD)) {
+            generateSalt(newAccount.salt, 16);
+            hashPassword(LOAD_PASSWORD, newAccount.salt, newAccount.passwordHash);
+            newAccount.balance = 10000 + rand_r(&client->seed) % 100000;
+            newAccount.isActive = 1;
+            newAccount.dateCreated = time(NULL);
+            result = engineOpenAccount(&newAccount);
+        }
+        timeLoadOperation(client, LOAD_REGISTER, &start, result);
+        if (postApplied(result)) accountNumber = newAccount.accountNumber;
+    }
     
-    *transactions = malloc(capacity * sizeof(Transaction));
-    if (*transactions == NULL) {
-        fclose(file);
+    // Accounts registered by other clients are fair game too, except the
+    // newest few, which may still be in the middle of being registered
+    int registered = atomic_load(&config->nextAccount) - LOAD_FIRST_ACCOUNT - config->clients;
+    if (registered < LOAD_SEED_ACCOUNTS) registered = LOAD_SEED_ACCOUNTS;
+    if (accountNumber == 0) accountNumber = LOAD_FIRST_ACCOUNT + rand_r(&client->seed) % registered;
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int loggedIn = engineAuthenticate(accountNumber, LOAD_PASSWORD, &session);
+    timeLoadOperation(client, LOAD_LOGIN, &start, loggedIn ? POST_OK : POST_INVALID_DETAILS);
+    if (!loggedIn) return;
+    
+    for (int i = 0; i < LOAD_ACTIONS_PER_SESSION; i++) {
+        int pick = rand_r(&client->seed) % config->weightTotal;
+        int type = LOAD_DEPOSIT;
+        while (pick >= config->weights[type - LOAD_DEPOSIT]) pick -= config->weights[type++ - LOAD_DEPOSIT];
+        long amountCents = 100 + rand_r(&client->seed) % 50000;
+        int toAccount = LOAD_FIRST_ACCOUNT + rand_r(&client->seed) % registered;
+        if (toAccount == accountNumber) toAccount = LOAD_FIRST_ACCOUNT + (toAccount - LOAD_FIRST_ACCOUNT + 1) % registered;
+        PostResult result = POST_OK;
+        
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (type == LOAD_DEPOSIT) {
+            result = engineDeposit(accountNumber, amountCents, &balanceAfter);
+        } else if (type == LOAD_WITHDRAW) {
+            result = engineWithdrawal(accountNumber, amountCents, &balanceAfter);
+        } else if (type == LOAD_TRANSFER) {
+            result = engineTransfer(accountNumber, toAccount, amountCents, &balanceAfter);
+        } else {
+            // Formats the first screen of history as the menu would print it
+            HistoryCursor cursor;
+            char screen[HISTORY_PAGE_SIZE * 256];
+            int used = 0;
+            int count = engineReadHistory(accountNumber, &cursor);
+            
+            for (int t = 0; t < count && used < (int)sizeof(screen); t++) {
+                used += snprintf(screen + used, sizeof(screen) - used, "%-8d | %s | %-15s | K%8.2f | K%8.2f | %s\n",
+                                 cursor.page[t].transactionId, cursor.page[t].timestamp, cursor.page[t].type,
+                                 centsToFloat(cursor.page[t].amount), centsToFloat(cursor.page[t].balanceAfter),
+                                 cursor.page[t].description);
+            }
+            closeHistoryCursor(&cursor);
+            if (count < 0) result = POST_STORAGE_ERROR;
+        }
+        if (postApplied(result) && type != LOAD_HISTORY) session.balance = balanceAfter;
+        timeLoadOperation(client, type, &start, result);
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    memset(&session, 0, sizeof(session));
+    timeLoadOperation(client, LOAD_LOGOUT, &start, POST_OK);
+}
+
+void *loadClientWorker(void *arg) {
+    LoadClient *client = arg;
+    LoadConfig *config = client->config;
+    long interval = config->sessionRate > 0 ? (long)(1e9 * config->clients / config->sessionRate) : 0;
+    long arrival = client->firstArrival;
+    struct timespec sessionStart;
+    
+    while (!client->failed) {
+        if (interval > 0) {
+            // Wait for the scheduled arrival; if the client is running
+            // behind, the delay counts towards the session's latency
+            if (arrival >= config->durationNanos) break;
+            long nanos = config->start.tv_nsec + arrival;
+            sessionStart.tv_sec = config->start.tv_sec + nanos / 1000000000L;
+            sessionStart.tv_nsec = nanos % 1000000000L;
+            int error;
+            while ((error = sleepUntil(&sessionStart)) == EINTR) {}
+            if (error != 0) {
+                client->failed = 1;
+                break;
+            }
+            arrival += interval;
+        } else {
+            if (nanosSince(&config->start) >= config->durationNanos) break;
+            clock_gettime(CLOCK_MONOTONIC, &sessionStart);
+        }
+        runLoadSession(client);
+        timeLoadOperation(client, LOAD_SESSION, &sessionStart, POST_OK);
+    }
+    return NULL;
+}
+
+void printLatencyRow(const char *name, LoadClient *clients, int clientCount, int type, double seconds) {
+    long count = 0, rejected = 0, errors = 0;
+    for (int i = 0; i < clientCount; i++) {
+        count += clients[i].samples[type].count;
+        rejected += clients[i].samples[type].rejected;
+        errors += clients[i].samples[type].errors;
+    }
+    
+    long *nanos = malloc((count > 0 ? count : 1) * sizeof(long));
+    if (count == 0 || nanos == NULL) {
+        printf("%-10s %9ld %10s %9s %9s %9s %9s %9ld %7ld\n", name, count, "-", "-", "-", "-", "-", rejected, errors);
+        free(nanos);
+        return;
+    }
+    long filled = 0;
+    for (int i = 0; i < clientCount; i++) {
+        memcpy(nanos + filled, clients[i].samples[type].nanos, clients[i].samples[type].count * sizeof(long));
+        filled += clients[i].samples[type].count;
+    }
+    qsort(nanos, count, sizeof(long), compareLongs);
+    printf("%-10s %9ld %10.1f %9.1f %9.1f %9.1f %9.1f %9ld %7ld\n", name, count,
+           seconds > 0 ? count / seconds : 0.0, nanos[count / 2] / 1e3, nanos[count * 95 / 100] / 1e3,
+           nanos[count * 99 / 100] / 1e3, nanos[count - 1] / 1e3, rejected, errors);
+    free(nanos);
+}
+
+// Runs scripted customer sessions on clientCount threads against a scratch
+// database for the given number of seconds, then reports the latency of
+// each operation as the customer sees it and the overall throughput
+int runLoadTest(int clientCount, double seconds, double sessionRate, const char *mix) {
+    const char *typeNames[LOAD_TYPES] = {
+        "register", "login", "deposit", "withdraw", "transfer", "history", "logout", "session"
+    };
+    LoadConfig config;
+    memset(&config, 0, sizeof(config));
+    if (!parseLoadMix(mix, &config)) {
+        printf("❌ Invalid load mix '%s'! Expected REGISTER%%:DEPOSIT:WITHDRAW:TRANSFER:HISTORY.\n", mix);
+        return 0;
+    }
+    config.clients = clientCount;
+    config.durationNanos = (long)(seconds * 1e9);
+    config.sessionRate = sessionRate;
+    atomic_init(&config.nextAccount, LOAD_FIRST_ACCOUNT);
+    
+    char originalDirectory[4096];
+    char directory[] = "/tmp/bank_load_XXXXXX";
+    if (getcwd(originalDirectory, sizeof(originalDirectory)) == NULL ||
+        mkdtemp(directory) == NULL || chdir(directory) != 0) {
+        printf("❌ Cannot create a scratch directory for the load test!\n");
         return 0;
     }
     
-    while (fread(&transaction, sizeof(Transaction), 1, file)) {
-        if (transaction.accountNumber == accountNumber) {
-            if (size >= capacity) {
-                capacity *= 2;
-                Transaction *temp = realloc(*transactions, capacity * sizeof(Transaction));
-                if (temp == NULL) {
-                    free(*transactions);
-                    *transactions = NULL;
-                    fclose(file);
-                    return 0;
-                }
-                *transactions = temp;
+    // The seed customers share one log sync; the sessions themselves run
+    // with the storage options given on the command line
+    int groupCommitRecords = transactionLog.groupCommitRecords;
+    transactionLog.groupCommitRecords = BATCH_GROUP_COMMIT;
+    int success = initializeDatabase();
+    
+    BankAccount account;
+    memset(&account, 0, sizeof(account));
+    for (int i = 0; success && i < LOAD_SEED_ACCOUNTS; i++) {
+        account.accountNumber = atomic_fetch_add(&config.nextAccount, 1);
+        snprintf(account.fullName, MAX_NAME_LENGTH, "Load Customer %d", account.accountNumber);
+        generateSalt(account.salt, 16);
+        hashPassword(LOAD_PASSWORD, account.salt, account.passwordHash);
+        account.balance = LOAD_OPENING_BALANCE;
+        account.isActive = 1;
+        account.dateCreated = time(NULL);
+        success = engineOpenAccount(&account) == POST_OK;
+    }
+    success = success && syncTransactionLog();
+    transactionLog.groupCommitRecords = groupCommitRecords;
+    
+    LoadClient *clients = calloc(clientCount, sizeof(LoadClient));
+    success = success && clients != NULL;
+    
+    clock_gettime(CLOCK_MONOTONIC, &config.start);
+    int started = 0;
+    for (int i = 0; success && i < clientCount; i++) {
+        clients[i].config = &config;
+        clients[i].seed = (unsigned int)time(NULL) + i * 7919;
+        // Spread the clients' first arrivals over one interval
+        clients[i].firstArrival = sessionRate > 0 ? (long)(1e9 * i / sessionRate) : 0;
+        if (pthread_create(&clients[i].thread, NULL, loadClientWorker, &clients[i]) != 0) {
+            success = 0;
+        } else {
+            started++;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(clients[i].thread, NULL);
+    }
+    double elapsed = nanosSince(&config.start) / 1e9;
+    
+    if (success) {
+        long sessions = 0, operations = 0, rejected = 0, errors = 0;
+        for (int i = 0; i < clientCount; i++) {
+            if (clients[i].failed) success = 0;
+            sessions += clients[i].samples[LOAD_SESSION].count;
+            for (int type = 0; type < LOAD_SESSION; type++) {
+                operations += clients[i].samples[type].count;
+                rejected += clients[i].samples[type].rejected;
+                errors += clients[i].samples[type].errors;
             }
-            (*transactions)[size++] = transaction;
         }
+        
+        printHeader("LOAD TEST");
+        printf("Clients:     %d\n", clientCount);
+        if (sessionRate > 0) {
+            printf("Arrivals:    %.1f sessions/s, evenly spaced (open loop)\n", sessionRate);
+        } else {
+            printf("Arrivals:    next session as soon as the last one ends (closed loop)\n");
+        }
+        printf("Mix:         %d%% of sessions register; actions deposit %d, withdraw %d, transfer %d, history %d\n",
+               config.registerPercent, config.weights[0], config.weights[1], config.weights[2], config.weights[3]);
+        printf("Storage:     %s%s, group commit %d\n",
+               useMappedStorage ? "mmap" : (accountCacheSize > 0 ? "file I/O with cache" : "file I/O"),
+               useDirectIndex ? ", direct account table" : "", transactionLog.groupCommitRecords);
+        printf("Sessions:    %ld in %.2f s (%.1f sessions/s)\n", sessions, elapsed,
+               elapsed > 0 ? sessions / elapsed : 0.0);
+        printf("Operations:  %ld (%.0f ops/s), %ld rejected, %ld errors\n", operations,
+               elapsed > 0 ? operations / elapsed : 0.0, rejected, errors);
+        printf("\n%-10s %9s %10s %9s %9s %9s %9s %9s %7s\n", "Operation", "Count", "Per sec",
+               "p50 us", "p95 us", "p99 us", "max us", "Rejected", "Errors");
+        for (int type = 0; type < LOAD_TYPES; type++) {
+            printLatencyRow(typeNames[type], clients, clientCount, type, elapsed);
+        }
+        printf("============================================\n");
+        
+        if (metricsEnabled) {
+            writeMetrics(stdout);
+            printf("============================================\n");
+        }
+        success = verifyLedger() && success && errors == 0;
+        printf("%s\n", success ? "✅ PASS: no storage errors and every balance matches the log"
+                               : "❌ FAIL: see the errors above");
+    } else {
+        printf("❌ Load test setup failed!\n");
     }
     
-    fclose(file);
-    *count = size;
+    for (int i = 0; clients != NULL && i < clientCount; i++) {
+        for (int type = 0; type < LOAD_TYPES; type++) free(clients[i].samples[type].nanos);
+    }
+    free(clients);
+    closeDatabase();
+    removeDatabaseFiles();
+    if (chdir(originalDirectory) != 0 || rmdir(directory) != 0) {
+        printf("⚠️  Could not remove scratch directory %s\n", directory);
+    }
+    return success;
+}
+
+// Batch Mode Functions
+
+// Parses "123", "123.4" or "123.45" into cents without going through float
+int parseAmountCents(const char *text, long *cents) {
+    long whole = 0;
+    int fraction = 0, fractionDigits = 0, digits = 0;
+    const char *ptr = text;
+    
+    while (isdigit((unsigned char)*ptr) && digits < 12) {
+        whole = whole * 10 + (*ptr++ - '0');
+        digits++;
+    }
+    if (*ptr == '.') {
+        ptr++;
+        while (isdigit((unsigned char)*ptr) && fractionDigits < 2) {
+            fraction = fraction * 10 + (*ptr++ - '0');
+            fractionDigits++;
+        }
+    }
+    if (*ptr != 0 || (digits == 0 && fractionDigits == 0)) return 0;
+    if (fractionDigits == 1) fraction *= 10;
+    
+    *cents = whole * 100 + fraction;
     return 1;
 }
 
-void freeTransactions(Transaction *transactions) {
-    free(transactions);
+// Splits a CSV line in place; fields cannot contain commas
+int splitBatchLine(char *line, char **fields, int maxFields) {
+    int count = 0;
+    char *start = line;
+    
+    while (count < maxFields) {
+        char *comma = strchr(start, ',');
+        if (comma != NULL) *comma = 0;
+        
+        // Trim surrounding blanks
+        while (*start == ' ' || *start == '\t') start++;
+        char *end = start + strlen(start);
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) *--end = 0;
+        
+        fields[count++] = start;
+        if (comma == NULL) return count;
+        start = comma + 1;
+    }
+    return maxFields + 1;
 }
 
-// Enhanced Transfer Function with Rollback
-int transferFundsWithRollback(int fromAccount, int toAccount, long amountCents) {
-    FILE *file = fopen(ACCOUNTS_DB, "rb+");
-    if (file == NULL) return 0;
+PostResult applyBatchLine(char **fields, int fieldCount, int *operation) {
+    const int fieldCounts[BATCH_OPERATIONS] = { 3, 3, 4, 5, 2 };
+    long amountCents, balanceAfter;
+    int accountNumber;
     
-    BankAccount fromAcc, toAcc;
-    long fromPos = -1, toPos = -1;
-    int fromFound = 0, toFound = 0;
+    *operation = -1;
+    for (int i = 0; i < BATCH_OPERATIONS; i++) {
+        if (strcmp(fields[0], batchOperationNames[i]) == 0) *operation = i;
+    }
+    if (*operation < 0 || fieldCount != fieldCounts[*operation]) return POST_BAD_FORMAT;
     
-    BankAccount acc;
-    long position;
+    char *end;
+    long parsed = strtol(fields[1], &end, 10);
+    if (*end != 0 || parsed < 10000 || parsed > 2147483647L) return POST_INVALID_DETAILS;
+    accountNumber = (int)parsed;
     
-    while (fread(&acc, sizeof(BankAccount), 1, file)) {
-        position = ftell(file) - sizeof(BankAccount);
+    switch (*operation) {
+        case BATCH_DEPOSIT:
+            if (!parseAmountCents(fields[2], &amountCents)) return POST_INVALID_AMOUNT;
+            return postDeposit(accountNumber, amountCents, &balanceAfter);
+            
+        case BATCH_WITHDRAW:
+            if (!parseAmountCents(fields[2], &amountCents)) return POST_INVALID_AMOUNT;
+            return postWithdrawal(accountNumber, amountCents, &balanceAfter);
+            
+        case BATCH_TRANSFER: {
+            long toAccount = strtol(fields[2], &end, 10);
+            if (*end != 0 || toAccount < 10000 || toAccount > 2147483647L) return POST_INVALID_DETAILS;
+            if (!parseAmountCents(fields[3], &amountCents)) return POST_INVALID_AMOUNT;
+            return postTransfer(accountNumber, (int)toAccount, amountCents, &balanceAfter);
+        }
         
-        if (acc.accountNumber == fromAccount) {
-            fromAcc = acc;
-            fromPos = position;
-            fromFound = 1;
-        } else if (acc.accountNumber == toAccount) {
-            toAcc = acc;
-            toPos = position;
-            toFound = 1;
+        case BATCH_OPEN: {
+            BankAccount account;
+            memset(&account, 0, sizeof(account));
+            if (strlen(fields[2]) < 2 || strlen(fields[2]) >= MAX_NAME_LENGTH ||
+                strlen(fields[3]) >= MAX_PASSWORD_LENGTH || !validateEnhancedPassword(fields[3])) {
+                return POST_INVALID_DETAILS;
+            }
+            if (!parseAmountCents(fields[4], &account.balance)) return POST_INVALID_AMOUNT;
+            
+            strcpy(account.fullName, fields[2]);
+            account.accountNumber = accountNumber;
+            generateSalt(account.salt, 16);
+            hashPassword(fields[3], account.salt, account.passwordHash);
+            account.isActive = 1;
+            account.dateCreated = time(NULL);
+            return postOpenAccount(&account);
         }
-        if (fromFound && toFound) break;
+        
+        case BATCH_CLOSE:
+            return postCloseAccount(accountNumber);
     }
-    
-    if (!fromFound || !toFound) {
-        fclose(file);
+    return POST_BAD_FORMAT;
+}
+
+// Posts every line of a settlement file; lines look like
+//   deposit,<account>,<amount>      withdraw,<account>,<amount>
+//   transfer,<from>,<to>,<amount>   close,<account>
+//   open,<account>,<name>,<password>,<initial deposit>
+// Blank lines and lines starting with # are skipped.
+int runBatch(const char *path) {
+    FILE *input = openFile(path, "r");
+    if (input == NULL) {
+        printf("❌ Cannot open batch file %s\n", path);
         return 0;
     }
+    setvbuf(input, NULL, _IOFBF, 1 << 20);
     
-    if (fromAcc.balance < amountCents) {
-        fclose(file);
+    if (!enableLogBuffering(BATCH_LOG_BUFFER)) {
+        fclose(input);
+        printf("❌ Not enough memory for batch mode!\n");
         return 0;
     }
+    accountMap.deferSync = 1;
+    
+    long applied[BATCH_OPERATIONS] = { 0 };
+    long rejected = 0, lineNumber = 0;
+    char line[MAX_BATCH_LINE];
+    char original[MAX_BATCH_LINE];
+    char *fields[6];
+    struct timespec start;
+    clock_gettime(CLOCK_REALTIME, &start);
+    
+    printf("Reject report for %s:\n", path);
+    
+    while (fgets(line, sizeof(line), input) != NULL) {
+        lineNumber++;
+        
+        int tooLong = strchr(line, '\n') == NULL && !feof(input);
+        if (tooLong) {
+            int c;
+            while ((c = fgetc(input)) != '\n' && c != EOF);
+        }
+        line[strcspn(line, "\r\n")] = 0;
+        if (line[0] == 0 || line[0] == '#') continue;
+        strcpy(original, line);
+        
+        int operation = -1;
+        PostResult result = POST_BAD_FORMAT;
+        if (!tooLong) {
+            int fieldCount = splitBatchLine(line, fields, 5);
+            result = applyBatchLine(fields, fieldCount, &operation);
+        }
+        
+        if (postApplied(result)) {
+            applied[operation]++;
+            checkpointIfDue();
+            if (result == POST_NOT_DURABLE) {
+                printf("  line %ld: %s: %s\n", lineNumber, postResultMessage(result), original);
+            }
+        } else {
+            rejected++;
+            printf("  line %ld: %s: %s\n", lineNumber, postResultMessage(result), original);
+        }
+    }
+    fclose(input);
+    
+    int success = linkDeferredTransactions() && syncTransactionLog();
+    accountMap.deferSync = 0;
+    msync(accountMap.records, accountMap.recordCount * sizeof(BankAccount), MS_ASYNC);
+    double seconds = microsSince(&start) / 1e6;
+    long total = rejected;
+    for (int i = 0; i < BATCH_OPERATIONS; i++) total += applied[i];
+    
+    printHeader("BATCH SUMMARY");
+    for (int i = 0; i < BATCH_OPERATIONS; i++) {
+        printf("%-10s %ld applied\n", batchOperationNames[i], applied[i]);
+    }
+    printf("%-10s %ld\n", "rejected", rejected);
+    printf("%-10s %ld operations in %.2f s (%.0f ops/s)\n", "total", total, seconds,
+           seconds > 0 ? total / seconds : 0.0);
+    if (!success) printf("❌ The transaction log could not be flushed to disk!\n");
+    printf("============================================\n");
+    
+    return success;
+}
+
+// Bulk Import and Export Functions
+
+// Checks one line of an import file and fills in entry, splitting the
+// line in place. A line is either a new customer,
+//   <account>,<name>,<password>,<initial balance>
+// or an account as written by --export,
+//   <account>,<name>,<balance>,<active>,<created>,<salt>,<password hash>
+PostResult parseImportLine(char *line, ImportEntry *entry) {
+    char *fields[7];
+    int fieldCount = splitBatchLine(line, fields, 7);
+    if (fieldCount != 4 && fieldCount != 7) return POST_BAD_FORMAT;
+    
+    char *end;
+    long parsed = strtol(fields[0], &end, 10);
+    if (*end != 0 || parsed < 10000 || parsed > 2147483647L) return POST_INVALID_DETAILS;
+    if (strlen(fields[1]) < 2 || strlen(fields[1]) >= MAX_NAME_LENGTH) return POST_INVALID_DETAILS;
+    
+    memset(entry, 0, sizeof(ImportEntry));
+    entry->accountNumber = (int)parsed;
+    entry->name = fields[1];
+    entry->isActive = 1;
+    if (fieldCount == 4) {
+        if (strlen(fields[2]) >= MAX_PASSWORD_LENGTH || !validateEnhancedPassword(fields[2])) {
+            return POST_INVALID_DETAILS;
+        }
+        if (!parseAmountCents(fields[3], &entry->balance)) return POST_INVALID_AMOUNT;
+        entry->secret = fields[2];
+        return POST_OK;
+    }
+    
+    if (!parseAmountCents(fields[2], &entry->balance)) return POST_INVALID_AMOUNT;
+    if (strcmp(fields[3], "1") != 0 && strcmp(fields[3], "0") != 0) return POST_INVALID_DETAILS;
+    long long created = strtoll(fields[4], &end, 10);
+    if (*end != 0 || fields[4][0] == 0 || created < 0 || strlen(fields[5]) != 16 || strlen(fields[6]) != 64) {
+        return POST_INVALID_DETAILS;
+    }
+    entry->exported = 1;
+    entry->isActive = fields[3][0] == '1';
+    entry->dateCreated = created;
+    entry->secret = fields[5];
+    entry->hash = fields[6];
+    return POST_OK;
+}
+
+// Parses one slice of the file, then sorts what it accepted. Line numbers
+// count from the start of the slice until runImport adds the slice's offset.
+void *importParseWorker(void *arg) {
+    ImportSlice *slice = arg;
+    char *line = slice->text, *end = slice->text + slice->length;
+    
+    long capacity = 1;
+    for (char *newline = line; (newline = memchr(newline, '\n', end - newline)) != NULL; newline++) capacity++;
+    slice->entries = malloc(capacity * sizeof(ImportEntry));
+    slice->rejects = malloc(capacity * sizeof(ImportReject));
+    if (slice->entries == NULL || slice->rejects == NULL) {
+        slice->failed = 1;
+        return NULL;
+    }
+    
+    // Only the last slice can end without a newline, and the file buffer
+    // has a spare byte after it
+    while (line < end) {
+        char *newline = memchr(line, '\n', end - line);
+        char *next = newline != NULL ? newline + 1 : end;
+        *(newline != NULL ? newline : end) = 0;
+        line[strcspn(line, "\r")] = 0;
+        slice->lineCount++;
+        
+        if (line[0] != 0 && line[0] != '#') {
+            ImportEntry *entry = &slice->entries[slice->entryCount];
+            PostResult result = parseImportLine(line, entry);
+            if (result == POST_OK) {
+                entry->line = slice->lineCount;
+                slice->entryCount++;
+            } else {
+                slice->rejects[slice->rejectCount].line = slice->lineCount;
+                slice->rejects[slice->rejectCount++].result = result;
+            }
+        }
+        line = next;
+    }
+    
+    qsort(slice->entries, slice->entryCount, sizeof(ImportEntry), compareImportEntries);
+    return NULL;
+}
+
+// Account number order; repeats of a number keep their file order
+int compareImportEntries(const void *a, const void *b) {
+    const ImportEntry *x = a, *y = b;
+    if (x->accountNumber != y->accountNumber) return (x->accountNumber > y->accountNumber) - (x->accountNumber < y->accountNumber);
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+int compareImportRejects(const void *a, const void *b) {
+    long x = ((const ImportReject *)a)->line, y = ((const ImportReject *)b)->line;
+    return (x > y) - (x < y);
+}
+
+int compareInts(const void *a, const void *b) {
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+// Every account number already taken, sorted: those in the store, closed
+// ones included, and those moved to the archive. NULL if a file cannot be read.
+int *collectAccountNumbers(long *count) {
+    long recordCount = storeRecordCount();
+    long archiveCount = 0;
+    FILE *archive = openFile(ACCOUNTS_ARCHIVE, "rb");
+    struct stat info;
+    if (archive != NULL) {
+        setvbuf(archive, NULL, _IOFBF, 1 << 20);
+        if (fstat(fileno(archive), &info) == 0) archiveCount = info.st_size / sizeof(BankAccount);
+    }
     
-    fromAcc.balance -= amountCents;
-    toAcc.balance += amountCents;
-    
-    int success = 1;
+    long capacity = recordCount + archiveCount;
+    int *numbers = recordCount >= 0 ? malloc((capacity > 0 ? capacity : 1) * sizeof(int)) : NULL;
+    StoreScan scan = { NULL, 0, NULL, 0, 0 };
+    int success = numbers != NULL && openStoreScan(&scan, "rb");
+    BankAccount account;
+    long record;
     
-    fseek(file, fromPos, SEEK_SET);
-    if (fwrite(&fromAcc, sizeof(BankAccount), 1, file) != 1) {
-        success = 0;
+    *count = 0;
+    while (success && nextStoreRecord(&scan, &account, &record)) {
+        if (account.accountNumber != 0 && *count < capacity) numbers[(*count)++] = account.accountNumber;
     }
-    
-    fseek(file, toPos, SEEK_SET);
-    if (fwrite(&toAcc, sizeof(BankAccount), 1, file) != 1) {
-        fromAcc.balance += amountCents;
-        fseek(file, fromPos, SEEK_SET);
-        fwrite(&fromAcc, sizeof(BankAccount), 1, file);
-        success = 0;
+    success = closeStoreScan(&scan) && success;
+    while (success && archive != NULL && readRecords(&account, sizeof(BankAccount), 1, archive) == 1) {
+        if (account.accountNumber != 0 && *count < capacity) numbers[(*count)++] = account.accountNumber;
     }
+    if (archive != NULL) fclose(archive);
     
-    fclose(file);
-    return success;
+    if (!success) {
+        free(numbers);
+        return NULL;
+    }
+    qsort(numbers, *count, sizeof(int), compareInts);
+    return numbers;
 }
 
-// Account Management Functions
-int closeAccount(int accountNumber) {
-    FILE *file = fopen(ACCOUNTS_DB, "rb+");
-    if (file == NULL) return 0;
-    
-    BankAccount account;
-    long position;
-    int found = 0;
-    
-    while (fread(&account, sizeof(BankAccount), 1, file)) {
-        position = ftell(file) - sizeof(BankAccount);
-        
-        if (account.accountNumber == accountNumber) {
-            account.isActive = 0;
-            fseek(file, position, SEEK_SET);
-            fwrite(&account, sizeof(BankAccount), 1, file);
-            found = 1;
-            break;
+// Builds the account records for one part of a round: a fresh salt and
+// hash for a password, or the exported ones as they are
+void *importHashWorker(void *arg) {
+    ImportHasher *hasher = arg;
+    
+    for (long i = 0; i < hasher->count; i++) {
+        const ImportEntry *entry = hasher->entries[i];
+        BankAccount *account = &hasher->accounts[i];
+        memset(account, 0, sizeof(BankAccount));
+        strcpy(account->fullName, entry->name);
+        account->accountNumber = entry->accountNumber;
+        account->balance = entry->balance;
+        account->isActive = entry->isActive;
+        if (entry->exported) {
+            account->dateCreated = (time_t)entry->dateCreated;
+            strcpy(account->salt, entry->secret);
+            strcpy(account->passwordHash, entry->hash);
+        } else {
+            account->dateCreated = hasher->created;
+            generateSaltSeeded(account->salt, 16, &hasher->seed);
+            hashPassword(entry->secret, account->salt, account->passwordHash);
         }
     }
-    
-    fclose(file);
-    return found;
+    return NULL;
 }
 
-void applyMonthlyInterest() {
-    float interestRate = 0.015;
-    
-    FILE *file = fopen(ACCOUNTS_DB, "rb+");
-    if (file == NULL) return;
-    
-    BankAccount account;
-    long position;
-    
-    while (fread(&account, sizeof(BankAccount), 1, file)) {
-        position = ftell(file) - sizeof(BankAccount);
+// Appends the accepted accounts to the store, IMPORT_WRITE_BATCH at a
+// time. Each round is built on several threads and then written with one
+// call per shard file it touches: the accounts are in number order and
+// shards are number ranges, so each shard's share of a round is one run.
+int writeImportedAccounts(const ImportEntry **accepted, long count, const int *fds, const long *originalCounts) {
+    int threadCount = jobThreadCount(count < IMPORT_WRITE_BATCH ? count : IMPORT_WRITE_BATCH);
+    ImportHasher hashers[JOB_MAX_THREADS];
+    BankAccount *accounts = malloc(IMPORT_WRITE_BATCH * sizeof(BankAccount));
+    long written[MAX_SHARDS] = { 0 };
+    time_t created = time(NULL);
+    int success = accounts != NULL;
+    
+    for (long first = 0; success && first < count; first += IMPORT_WRITE_BATCH) {
+        long roundCount = count - first < IMPORT_WRITE_BATCH ? count - first : IMPORT_WRITE_BATCH;
+        int started = 0;
+        for (int i = 0; i < threadCount; i++) {
+            ImportHasher *hasher = &hashers[i];
+            long from = roundCount * i / threadCount;
+            hasher->entries = accepted + first + from;
+            hasher->accounts = accounts + from;
+            hasher->count = roundCount * (i + 1) / threadCount - from;
+            hasher->created = created;
+            hasher->seed = (unsigned int)rand();
+            if (pthread_create(&hasher->thread, NULL, importHashWorker, hasher) != 0) break;
+            started++;
+        }
+        for (int i = 0; i < started; i++) {
+            pthread_join(hashers[i].thread, NULL);
+        }
+        success = started == threadCount;
         
-        if (account.isActive && account.balance > 0) {
-            float interest = centsToFloat(account.balance) * interestRate;
-            long interestCents = floatToCents(interest);
-            account.balance += interestCents;
-            
-            fseek(file, position, SEEK_SET);
-            fwrite(&account, sizeof(BankAccount), 1, file);
+        for (long i = 0; success && i < roundCount; ) {
+            int shard = shardOfAccount(&shardMap, accounts[i].accountNumber);
+            long run = 1;
+            while (i + run < roundCount && shardOfAccount(&shardMap, accounts[i + run].accountNumber) == shard) run++;
             
-            Transaction transaction;
-            transaction.transactionId = 0;
-            transaction.accountNumber = account.accountNumber;
-            strcpy(transaction.type, "INTEREST");
-            transaction.amount = interestCents;
-            transaction.balanceAfter = account.balance;
-            getCurrentTimestamp(transaction.timestamp);
-            strcpy(transaction.description, "Monthly interest credit");
-            recordTransaction(&transaction);
+            const char *bytes = (const char *)(accounts + i);
+            size_t length = run * sizeof(BankAccount), done = 0;
+            off_t offset = (off_t)(originalCounts[shard] + written[shard]) * sizeof(BankAccount);
+            while (success && done < length) {
+                ssize_t moved = writeAt(fds[shard], bytes + done, length - done, offset + done);
+                success = moved > 0;
+                if (moved > 0) done += moved;
+            }
+            written[shard] += run;
+            i += run;
+        }
+        if (count >= JOB_MIN_SHARD) {
+            printf("\r⏳ Writing accounts: %ld/%ld", first + roundCount, count);
+            fflush(stdout);
         }
     }
+    if (count >= JOB_MIN_SHARD) printf("\n");
     
-    fclose(file);
+    free(accounts);
+    return success;
 }
 
-void generateAccountStatement() {
-    char filename[100];
-    snprintf(filename, sizeof(filename), "statement_%d.txt", currentUser.accountNumber);
+// Adds the accounts in a CSV file in one pass. The file is parsed and
+// sorted on several threads and merged against the account numbers
+// already in use. The new accounts get their creation records in one log
+// append, then are hashed and appended to the store in large batches, and
+// the account indexes are rebuilt once at the end.
+int runImport(const char *path) {
+    struct timespec start;
+    clock_gettime(CLOCK_REALTIME, &start);
+    
+    int fd = openDescriptor(path, O_RDONLY, 0);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        if (fd >= 0) close(fd);
+        printf("❌ Cannot open import file %s\n", path);
+        return 0;
+    }
+    long size = info.st_size, done = 0;
+    char *text = malloc(size + 1);
+    while (text != NULL && done < size) {
+        ssize_t moved = readAt(fd, text + done, size - done, done);
+        if (moved <= 0) break;
+        done += moved;
+    }
+    close(fd);
+    if (text == NULL || done < size) {
+        free(text);
+        printf("❌ Cannot read import file %s\n", path);
+        return 0;
+    }
+    text[size] = 0;
+    
+    // One stretch of whole lines per thread
+    int threadCount = jobThreadCount(size / 64);
+    ImportSlice slices[JOB_MAX_THREADS];
+    memset(slices, 0, sizeof(slices));
+    long from = 0;
+    for (int i = 0; i < threadCount; i++) {
+        long to = size * (i + 1) / threadCount;
+        if (to < from) to = from;
+        char *newline = i < threadCount - 1 && to < size ? memchr(text + to, '\n', size - to) : NULL;
+        to = newline != NULL ? newline - text + 1 : size;
+        slices[i].text = text + from;
+        slices[i].length = to - from;
+        from = to;
+    }
     
-    FILE* file = fopen(filename, "w");
-    if (!file) {
-        printf("❌ Failed to create statement file!\n");
-        return;
+    int started = 0;
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&slices[i].thread, NULL, importParseWorker, &slices[i]) != 0) break;
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(slices[i].thread, NULL);
     }
     
-    fprintf(file, "============================================\n");
-    fprintf(file, "           BANK ACCOUNT STATEMENT\n");
-    fprintf(file, "============================================\n");
-    fprintf(file, "Account Holder: %s\n", currentUser.fullName);
-    fprintf(file, "Account Number: %d\n", currentUser.accountNumber);
-    fprintf(file, "Statement Date: ");
+    int success = started == threadCount;
+    long lines = 0, parsed = 0, rejected = 0;
+    for (int i = 0; i < started; i++) {
+        success = success && !slices[i].failed;
+        for (long k = 0; k < slices[i].entryCount; k++) slices[i].entries[k].line += lines;
+        for (long k = 0; k < slices[i].rejectCount; k++) slices[i].rejects[k].line += lines;
+        lines += slices[i].lineCount;
+        parsed += slices[i].entryCount;
+        rejected += slices[i].rejectCount;
+    }
+    double parseSeconds = microsSince(&start) / 1e6;
+    
+    // Nothing else may add accounts until the new ones are indexed
+    lockAccountStore(1);
+    long existingCount = 0;
+    int *existing = success && flushAccountCache(1) ? collectAccountNumbers(&existingCount) : NULL;
+    const ImportEntry **accepted = malloc((parsed > 0 ? parsed : 1) * sizeof(ImportEntry *));
+    ImportReject *rejects = malloc((parsed + rejected > 0 ? parsed + rejected : 1) * sizeof(ImportReject));
+    success = success && existing != NULL && accepted != NULL && rejects != NULL;
+    
+    long acceptedCount = 0;
+    if (success) {
+        long copied = 0;
+        for (int i = 0; i < threadCount; i++) {
+            memcpy(rejects + copied, slices[i].rejects, slices[i].rejectCount * sizeof(ImportReject));
+            copied += slices[i].rejectCount;
+        }
+        
+        // Merge the sorted slices, walking the taken numbers alongside. On
+        // a tie the lower slice wins, as it comes first in the file.
+        long heads[JOB_MAX_THREADS] = { 0 };
+        long taken = 0;
+        int lastNumber = 0;
+        while (1) {
+            int best = -1;
+            for (int i = 0; i < threadCount; i++) {
+                if (heads[i] < slices[i].entryCount &&
+                    (best < 0 || slices[i].entries[heads[i]].accountNumber <
+                                 slices[best].entries[heads[best]].accountNumber)) {
+                    best = i;
+                }
+            }
+            if (best < 0) break;
+            
+            const ImportEntry *entry = &slices[best].entries[heads[best]++];
+            while (taken < existingCount && existing[taken] < entry->accountNumber) taken++;
+            if (entry->accountNumber == lastNumber ||
+                (taken < existingCount && existing[taken] == entry->accountNumber)) {
+                rejects[rejected].line = entry->line;
+                rejects[rejected++].result = POST_ACCOUNT_EXISTS;
+            } else {
+                accepted[acceptedCount++] = entry;
+            }
+            lastNumber = entry->accountNumber;
+        }
+    }
+    double mergeSeconds = microsSince(&start) / 1e6 - parseSeconds;
+    
+    LogRecord *records = NULL;
+    long recordCount = 0;
+    long firstRecord = -1;
+    int appended = 0;
+    if (success && acceptedCount > 0) {
+        // A closed account gets its closure record straight after its
+        // creation record, so replay and --verify see it closed as well
+        long closedCount = 0;
+        for (long i = 0; i < acceptedCount; i++) {
+            if (!accepted[i]->isActive) closedCount++;
+        }
+        records = malloc((acceptedCount + closedCount) * sizeof(LogRecord));
+        uint32_t description = internDescription("Account imported");
+        uint32_t closure = internDescription("Account closed permanently");
+        int64_t timestamp = currentMicros();
+        success = records != NULL && description != 0 && closure != 0;
+        for (long i = 0; success && i < acceptedCount; i++) {
+            LogRecord *record = &records[recordCount++];
+            memset(record, 0, sizeof(LogRecord));
+            record->accountNumber = accepted[i]->accountNumber;
+            record->type = TX_ACCOUNT_CREATION;
+            record->amount = accepted[i]->balance;
+            record->balanceAfter = accepted[i]->balance;
+            record->timestamp = timestamp;
+            record->description = description;
+            if (!accepted[i]->isActive) {
+                records[recordCount] = *record;
+                record = &records[recordCount++];
+                record->type = TX_ACCOUNT_CLOSURE;
+                record->amount = 0;
+                record->description = closure;
+            }
+        }
+        
+        // Recovery can only repair accounts it finds in the log, so the
+        // creation records are on disk before any account reaches the store
+        appended = success && appendTransactions(records, (int)recordCount, &firstRecord);
+        success = appended && flushTransactionLog() && syncDescriptionTable() &&
+                  syncDescriptor(transactionLog.fd) == 0;
+        
+        int fds[MAX_SHARDS];
+        long originalCounts[MAX_SHARDS];
+        int opened = 0;
+        for (int shard = 0; success && shard < shardMap.shardCount; shard++) {
+            char shardPath[64];
+            shardFilePath(&shardMap, shard, shardPath, sizeof(shardPath));
+            fds[shard] = openDescriptor(shardPath, O_WRONLY | O_CREAT, 0644);
+            success = fds[shard] >= 0 && fstat(fds[shard], &info) == 0;
+            if (fds[shard] >= 0) opened++;
+            if (success) originalCounts[shard] = info.st_size / sizeof(BankAccount);
+        }
+        
+        success = success && writeImportedAccounts(accepted, acceptedCount, fds, originalCounts);
+        for (int shard = 0; shard < opened; shard++) {
+            success = success && syncDescriptor(fds[shard]) == 0;
+        }
+        if (!success) {
+            // Take the store back to where it was and the records out of the log
+            for (int shard = 0; shard < opened; shard++) {
+                if (ftruncate(fds[shard], originalCounts[shard] * sizeof(BankAccount)) != 0) {
+                    printf("⚠️  Could not remove the partly imported accounts from a shard file.\n");
+                }
+            }
+            if (appended) rollbackTransactions(firstRecord, (int)recordCount);
+        }
+        for (int shard = 0; shard < opened; shard++) {
+            close(fds[shard]);
+        }
+    }
     
-    char timestamp[20];
-    getCurrentTimestamp(timestamp);
-    fprintf(file, "%s\n", timestamp);
-    fprintf(file, "Current Balance: K%.2f\n", centsToFloat(currentUser.balance));
-    fprintf(file, "============================================\n");
+    int durable = 1;
+    if (success && acceptedCount > 0) {
+        // The indexes are rebuilt in one pass instead of taking every account in turn
+        int direct = directIndex.fd >= 0;
+        if (!rebuildAccountIndex()) {
+            printf("⚠️  Could not rebuild %s; it will be rebuilt at the next start.\n", ACCOUNTS_INDEX);
+        }
+        if (direct && !openDirectIndex(storeRecordCount())) {
+            printf("⚠️  Could not rebuild %s; lookups will use the hash index.\n", ACCOUNTS_DIRECT);
+        }
+        if (!commitTransactions(records, (int)recordCount, firstRecord)) {
+            printf("⚠️  The accounts were imported, but the log could not be saved to disk.\n");
+            durable = 0;
+        }
+        if (!writeCheckpoint()) printf("⚠️  Could not write a checkpoint of the account balances.\n");
+    }
+    unlockAccountStore(1);
+    double seconds = microsSince(&start) / 1e6;
+    
+    if (rejects != NULL) {
+        printf("Reject report for %s:\n", path);
+        qsort(rejects, rejected, sizeof(ImportReject), compareImportRejects);
+        for (long i = 0; i < rejected; i++) {
+            printf("  line %ld: %s\n", rejects[i].line, postResultMessage(rejects[i].result));
+        }
+    }
     
-    Transaction *transactions = NULL;
-    int count = 0;
+    printHeader("IMPORT SUMMARY");
+    printf("%-10s %ld\n", "lines", lines);
+    printf("%-10s %ld\n", "imported", success ? acceptedCount : 0);
+    printf("%-10s %ld\n", "rejected", rejected);
+    printf("%-10s parse %.2f s on %d thread(s), merge %.2f s, log and store %.2f s\n", "phases",
+           parseSeconds, threadCount, mergeSeconds, seconds - parseSeconds - mergeSeconds);
+    printf("%-10s %ld accounts in %.2f s (%.0f accounts/s)\n", "total", success ? acceptedCount : 0, seconds,
+           success && seconds > 0 ? acceptedCount / seconds : 0.0);
+    if (!success) printf("❌ The import failed; no accounts were added.\n");
+    printf("============================================\n");
     
-    if (getAccountTransactions(currentUser.accountNumber, &transactions, &count)) {
-        fprintf(file, "Transaction History:\n");
-        fprintf(file, "Date       | Type            | Amount    | Balance\n");
-        fprintf(file, "-----------+-----------------+-----------+-----------\n");
+    for (int i = 0; i < threadCount; i++) {
+        free(slices[i].entries);
+        free(slices[i].rejects);
+    }
+    free(text);
+    free(existing);
+    free(accepted);
+    free(rejects);
+    free(records);
+    return success && durable;
+}
+
+// Formats one part of a round of the export. A comma in a name would split
+// the field, so it is written as a space.
+void *exportFormatWorker(void *arg) {
+    ExportFormatter *formatter = arg;
+    char *output = formatter->buffer;
+    
+    for (long i = 0; i < formatter->count; i++) {
+        const BankAccount *account = &formatter->accounts[i];
+        if (account->accountNumber == 0) continue;
         
-        for (int i = 0; i < count; i++) {
-            fprintf(file, "%s | %-15s | K%8.2f | K%8.2f\n",
-                   transactions[i].timestamp,
-                   transactions[i].type,
-                   centsToFloat(transactions[i].amount),
-                   centsToFloat(transactions[i].balanceAfter));
+        char name[MAX_NAME_LENGTH];
+        snprintf(name, sizeof(name), "%.*s", MAX_NAME_LENGTH - 1, account->fullName);
+        for (char *c = name; *c != 0; c++) {
+            if (*c == ',' || *c == '\n' || *c == '\r') *c = ' ';
         }
+        output += snprintf(output, EXPORT_LINE_MAX, "%d,%s,%ld.%02ld,%d,%lld,%.16s,%.64s\n",
+                           account->accountNumber, name, account->balance / 100, account->balance % 100,
+                           account->isActive ? 1 : 0, (long long)account->dateCreated,
+                           account->salt, account->passwordHash);
+        formatter->exported++;
+    }
+    formatter->length = output - formatter->buffer;
+    return NULL;
+}
+
+// Writes every account in the format --import reads back: those in the
+// store, closed ones included, then those moved to the archive, so their
+// numbers stay taken in a database built from the file. Each file is read
+// EXPORT_BATCH records at a time; a round is formatted on several threads
+// and written in file order.
+int runExport(const char *path) {
+    struct timespec start;
+    clock_gettime(CLOCK_REALTIME, &start);
+    
+    // The file holds password hashes, so only its owner may read it
+    int fd = openDescriptor(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    FILE *output = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (output == NULL) {
+        if (fd >= 0) close(fd);
+        printf("❌ Cannot create export file %s\n", path);
+        return 0;
+    }
+    setvbuf(output, NULL, _IOFBF, STATEMENT_WRITE_BUFFER);
+    
+    int threadCount = jobThreadCount(EXPORT_BATCH);
+    ExportFormatter formatters[JOB_MAX_THREADS];
+    BankAccount *accounts = malloc(EXPORT_BATCH * sizeof(BankAccount));
+    char *buffer = malloc((long)EXPORT_BATCH * EXPORT_LINE_MAX);
+    long exported = 0;
+    
+    lockAccountStore(0);
+    int success = accounts != NULL && buffer != NULL && flushAccountCache(0) &&
+                  fprintf(output, "# account,name,balance,active,created,salt,password_hash\n") > 0;
+    for (int shard = 0; success && shard <= shardMap.shardCount; shard++) {
+        // One pass per shard file, then one over the archive if there is one
+        FILE *file = shard < shardMap.shardCount ? openShardFile(shard, "rb") : openFile(ACCOUNTS_ARCHIVE, "rb");
+        if (file == NULL && shard == shardMap.shardCount && access(ACCOUNTS_ARCHIVE, F_OK) != 0) break;
+        success = file != NULL;
         
-        freeTransactions(transactions);
+        long count;
+        while (success && (count = (long)readRecords(accounts, sizeof(BankAccount), EXPORT_BATCH, file)) > 0) {
+            int started = 0;
+            for (int i = 0; i < threadCount; i++) {
+                ExportFormatter *formatter = &formatters[i];
+                long first = count * i / threadCount;
+                formatter->accounts = accounts + first;
+                formatter->count = count * (i + 1) / threadCount - first;
+                formatter->buffer = buffer + first * EXPORT_LINE_MAX;
+                formatter->length = 0;
+                formatter->exported = 0;
+                if (pthread_create(&formatter->thread, NULL, exportFormatWorker, formatter) != 0) break;
+                started++;
+            }
+            for (int i = 0; i < started; i++) {
+                pthread_join(formatters[i].thread, NULL);
+            }
+            success = started == threadCount;
+            
+            for (int i = 0; success && i < threadCount; i++) {
+                success = (long)writeRecords(formatters[i].buffer, 1, formatters[i].length, output) ==
+                          formatters[i].length;
+                exported += formatters[i].exported;
+            }
+        }
+        if (file != NULL) {
+            success = success && !ferror(file);
+            fclose(file);
+        }
     }
+    unlockAccountStore(0);
     
-    fprintf(file, "============================================\n");
-    fclose(file);
+    success = success && fflush(output) == 0 && syncDescriptor(fileno(output)) == 0;
+    success = (fclose(output) == 0) && success;
+    free(accounts);
+    free(buffer);
     
-    printf("✅ Account statement generated: %s\n", filename);
+    double seconds = microsSince(&start) / 1e6;
+    if (success) {
+        printf("📤 Exported %ld account(s) to %s in %.2f s (%.0f accounts/s)\n", exported, path, seconds,
+               seconds > 0 ? exported / seconds : 0.0);
+    } else {
+        printf("❌ Could not export the accounts to %s!\n", path);
+    }
+    return success;
 }
 
 // Business Logic Functions
@@ -508,7 +8577,7 @@ void mainMenu() {
         printHeader("MAIN MENU");
         printf("1. Register New Account\n");
         printf("2. Login\n");
-        printf("3. Apply Monthly Interest (Admin)\n");
+        printf("3. Admin Tools\n");
         printf("4. Exit\n");
         printf("============================================\n");
         
@@ -524,8 +8593,7 @@ void mainMenu() {
                 }
                 break;
             case 3:
-                applyMonthlyInterest();
-                printf("✅ Monthly interest applied to all active accounts!\n");
+                adminMenu();
                 break;
             case 4:
                 printf("Thank you for using Online Banking System!\n");
@@ -537,10 +8605,212 @@ void mainMenu() {
     } while (choice != 4);
 }
 
+void adminMenu() {
+    int choice;
+    long count;
+    
+    do {
+        printHeader("ADMIN TOOLS");
+        printf("1. Apply Monthly Interest\n");
+        printf("2. Generate All Statements\n");
+        printf("3. Find Transaction by ID\n");
+        printf("4. Account Cache Statistics\n");
+        printf("5. Verify Balances Against Log\n");
+        printf("6. Performance Metrics\n");
+        printf("7. Transactions by Date\n");
+        printf("8. Compact Closed Accounts\n");
+        printf("9. Daily and Monthly Totals\n");
+        printf("10. Back to Main Menu\n");
+        printf("============================================\n");
+        
+        choice = getIntegerInput("Enter your choice (1-10): ");
+        
+        switch(choice) {
+            case 1:
+                count = applyMonthlyInterest();
+                if (count >= 0) {
+                    printf("✅ Monthly interest applied to %ld active account(s)!\n", count);
+                } else {
+                    printf("❌ Monthly interest could not be applied!\n");
+                }
+                break;
+            case 2:
+                count = generateAllStatements();
+                if (count >= 0) {
+                    printf("✅ %ld statement(s) generated in %s/\n", count, STATEMENTS_DIR);
+                } else {
+                    printf("❌ Failed to generate statements!\n");
+                }
+                break;
+            case 3:
+                lookupTransaction();
+                break;
+            case 4:
+                showCacheStatistics();
+                break;
+            case 5:
+                printHeader("VERIFY BALANCES");
+                verifyLedger();
+                break;
+            case 6:
+                showMetrics();
+                break;
+            case 7:
+                listTransactionsByDate();
+                break;
+            case 8:
+                count = compactAccounts();
+                if (count > 0) {
+                    printf("✅ %ld closed account(s) moved to %s!\n", count, ACCOUNTS_ARCHIVE);
+                } else if (count == 0) {
+                    printf("✅ There are no closed accounts to compact.\n");
+                }
+                break;
+            case 9:
+                showRollups();
+                break;
+            case 10:
+                break;
+            default:
+                printf("Invalid choice! Please select 1-10.\n");
+        }
+    } while (choice != 10);
+}
+
+void lookupTransaction() {
+    printHeader("FIND TRANSACTION");
+    
+    int transactionId = getIntegerInput("Enter transaction ID: ");
+    Transaction transaction;
+    if (!findTransactionById(transactionId, &transaction)) {
+        printf("❌ No transaction with ID %d!\n", transactionId);
+        return;
+    }
+    
+    printf("Transaction ID: %d\n", transaction.transactionId);
+    printf("Account Number: %d\n", transaction.accountNumber);
+    printf("Type: %s\n", transaction.type);
+    printf("Amount: K%.2f\n", centsToFloat(transaction.amount));
+    printf("Balance After: K%.2f\n", centsToFloat(transaction.balanceAfter));
+    printf("Date: %s\n", transaction.timestamp);
+    printf("Description: %s\n", transaction.description);
+    printf("============================================\n");
+}
+
+// Reads YYYY-MM-DD as YYYYMMDD (withDay) or YYYY-MM as YYYYMM; -1 if invalid
+int parseRollupKey(const char *text, int withDay) {
+    int year, month, day = 1;
+    char extra;
+    if (withDay) {
+        if (parseDate(text, 0) < 0 || sscanf(text, "%d-%d-%d", &year, &month, &day) != 3) return -1;
+        return year * 10000 + month * 100 + day;
+    }
+    if (sscanf(text, "%d-%d%c", &year, &month, &extra) != 2 || year < 1970 || month < 1 || month > 12) {
+        return -1;
+    }
+    return year * 100 + month;
+}
+
+// Totals for one day by type, and one account's money in and out for a
+// month; each is a single lookup in the rollups, whatever the log's size
+void showRollups() {
+    printHeader("DAILY AND MONTHLY TOTALS");
+    
+    time_t now = time(NULL);
+    struct tm t;
+    localtime_r(&now, &t);
+    int today = (t.tm_year + 1900) * 10000 + (t.tm_mon + 1) * 100 + t.tm_mday;
+    
+    char text[32];
+    safeInputString(text, sizeof(text), "Date (YYYY-MM-DD, blank for today): ");
+    int day = text[0] == 0 ? today : parseRollupKey(text, 1);
+    if (day < 0) {
+        printf("❌ Invalid date! Enter it as YYYY-MM-DD.\n");
+        return;
+    }
+    
+    DayRollup daily;
+    int found = readDayRollup(day, &daily);
+    if (found < 0) {
+        printf("❌ The totals are unavailable; restart the program to rebuild them.\n");
+        return;
+    }
+    printf("Totals for %04d-%02d-%02d:\n", day / 10000, day / 100 % 100, day % 100);
+    if (!found) {
+        printf("No transactions on this day.\n");
+    } else {
+        printf("Type              | Count    | Amount\n");
+        printf("------------------+----------+---------------\n");
+        for (int type = TX_DEPOSIT; type < TX_TYPES; type++) {
+            if (daily.counts[type] == 0) continue;
+            printf("%-17s | %-8ld | K%13.2f\n", transactionTypeNames[type], (long)daily.counts[type],
+                   daily.amounts[type] / 100.0);
+        }
+    }
+    printf("============================================\n");
+    
+    int accountNumber = getIntegerInput("Account number for monthly totals (0 to skip): ");
+    if (accountNumber <= 0) return;
+    safeInputString(text, sizeof(text), "Month (YYYY-MM, blank for this month): ");
+    int month = text[0] == 0 ? today / 100 : parseRollupKey(text, 0);
+    if (month < 0) {
+        printf("❌ Invalid month! Enter it as YYYY-MM.\n");
+        return;
+    }
+    
+    MonthRollup monthly;
+    found = readMonthRollup(accountNumber, month, &monthly);
+    if (found < 0) {
+        printf("❌ The totals are unavailable; restart the program to rebuild them.\n");
+        return;
+    }
+    printf("Account %d in %04d-%02d:\n", accountNumber, month / 100, month % 100);
+    if (!found) {
+        printf("No transactions in this month.\n");
+    } else {
+        printf("Money in:      K%.2f\n", monthly.moneyIn / 100.0);
+        printf("Money out:     K%.2f\n", monthly.moneyOut / 100.0);
+        printf("Net flow:      K%.2f\n", (monthly.moneyIn - monthly.moneyOut) / 100.0);
+        printf("Transactions:  %ld\n", (long)monthly.records);
+    }
+    printf("============================================\n");
+}
+
+// Lists the transactions of one account, or of all accounts, in a period
+void listTransactionsByDate() {
+    printHeader("TRANSACTIONS BY DATE");
+    
+    int accountNumber = getIntegerInput("Enter account number (0 for all accounts): ");
+    int64_t from, to;
+    char period[80];
+    int ranged = readPeriod(&from, &to, period, sizeof(period));
+    if (ranged == 0) printf("❌ A start date is required!\n");
+    if (ranged <= 0) return;
+    
+    RangeCursor range;
+    if (!openRangeCursor(&range, accountNumber, from, to, HISTORY_PAGE_SIZE)) {
+        printf("❌ Failed to read the transaction log!\n");
+        return;
+    }
+    printf("Period: %s\n", period);
+    printf("============================================\n");
+    showRangeResults(&range);
+    printf("============================================\n");
+    closeRangeCursor(&range);
+}
+
 void userMenu() {
     int choice;
     
     do {
+        // With --shared, other terminals may have moved the balance or closed the account
+        if (sharedLocks.fd >= 0 &&
+            (!findAccountByNumber(currentUser.accountNumber, &currentUser) || !currentUser.isActive)) {
+            printf("⚠️  This account has been closed from another terminal.\n");
+            isLoggedIn = 0;
+            break;
+        }
+        
         printHeader("USER DASHBOARD");
         printf("Welcome, %s!\n", currentUser.fullName);
         printf("============================================\n");
@@ -647,22 +8917,19 @@ void registerAccount() {
     newAccount.isActive = 1;
     newAccount.dateCreated = time(NULL);
     
-    if (!createAccount(&newAccount)) {
+    PostResult result = postOpenAccount(&newAccount);
+    if (result == POST_ACCOUNT_EXISTS) {
+        printf("❌ Account number already exists! Please choose a different number.\n");
+        return;
+    }
+    if (!postApplied(result)) {
         printf("❌ Failed to create account! Please try again.\n");
         return;
     }
-    
-    Transaction transaction;
-    transaction.transactionId = 0;
-    transaction.accountNumber = newAccount.accountNumber;
-    strcpy(transaction.type, "ACCOUNT_CREATION");
-    transaction.amount = newAccount.balance;
-    transaction.balanceAfter = newAccount.balance;
-    getCurrentTimestamp(transaction.timestamp);
-    strcpy(transaction.description, "Account created with initial deposit");
-    
-    if (!recordTransaction(&transaction)) {
-        printf("⚠️  Account created but failed to record transaction.\n");
+    if (result == POST_NOT_DURABLE) {
+        printf("⚠️  Your account was created, but it could not be saved to disk and may be lost\n");
+        printf("   if the system stops. Please check it at the counter.\n");
+        return;
     }
     
     printf("\n🎉 CONGRATULATIONS! 🎉\n");
@@ -679,6 +8946,21 @@ void registerAccount() {
     printf("============================================\n\n");
 }
 
+// Checks the credentials of an open account and fills in account on success
+int authenticateUser(int accountNumber, const char *password, BankAccount *account) {
+    struct timespec start;
+    startMetric(&start);
+    int authenticated = 0;
+    
+    if (findAccountByNumber(accountNumber, account) && account->isActive) {
+        char testHash[65];
+        hashPassword(password, account->salt, testHash);
+        authenticated = strcmp(account->passwordHash, testHash) == 0;
+    }
+    stopMetric(METRIC_LOGIN, &start);
+    return authenticated;
+}
+
 int login() {
     printHeader("ACCOUNT LOGIN");
     
@@ -687,21 +8969,11 @@ int login() {
     safeInputString(password, MAX_PASSWORD_LENGTH, "Enter your password: ");
     
     BankAccount account;
-    if (findAccountByNumber(accountNumber, &account)) {
-        if (!account.isActive) {
-            printf("❌ Login failed! Invalid account number or password.\n");
-            return 0;
-        }
-        
-        char testHash[65];
-        hashPassword(password, account.salt, testHash);
-        
-        if (strcmp(account.passwordHash, testHash) == 0) {
-            currentUser = account;
-            isLoggedIn = 1;
-            printf("✅ Login successful! Welcome back, %s!\n", account.fullName);
-            return 1;
-        }
+    if (authenticateUser(accountNumber, password, &account)) {
+        currentUser = account;
+        isLoggedIn = 1;
+        printf("✅ Login successful! Welcome back, %s!\n", account.fullName);
+        return 1;
     }
     
     printf("❌ Login failed! Invalid account number or password.\n");
@@ -723,30 +8995,20 @@ void depositFunds() {
         return;
     }
     
-    long amountCents = floatToCents(amount);
-    long newBalanceCents = currentUser.balance + amountCents;
-    
-    if (!updateAccountBalance(currentUser.accountNumber, newBalanceCents)) {
+    long newBalanceCents;
+    PostResult result = postDeposit(currentUser.accountNumber, floatToCents(amount), &newBalanceCents);
+    if (!postApplied(result)) {
         printf("❌ Failed to process deposit! Please try again.\n");
         return;
     }
     
-    Transaction transaction;
-    transaction.transactionId = 0;
-    transaction.accountNumber = currentUser.accountNumber;
-    strcpy(transaction.type, "DEPOSIT");
-    transaction.amount = amountCents;
-    transaction.balanceAfter = newBalanceCents;
-    getCurrentTimestamp(transaction.timestamp);
-    strcpy(transaction.description, "Cash deposit");
-    
-    if (!recordTransaction(&transaction)) {
-        printf("⚠️  Deposit processed but failed to record transaction.\n");
-    }
-    
     currentUser.balance = newBalanceCents;
     
-    printf("✅ Deposit successful!\n");
+    if (result == POST_NOT_DURABLE) {
+        printf("⚠️  Deposit applied, but it could not be saved to disk and may be lost if the system stops.\n");
+    } else {
+        printf("✅ Deposit successful!\n");
+    }
     printf("New balance: K%.2f\n", centsToFloat(currentUser.balance));
 }
 
@@ -772,29 +9034,25 @@ void withdrawFunds() {
         return;
     }
     
-    long newBalanceCents = currentUser.balance - amountCents;
-    
-    if (!updateAccountBalance(currentUser.accountNumber, newBalanceCents)) {
-        printf("❌ Failed to process withdrawal! Please try again.\n");
+    long newBalanceCents;
+    PostResult result = postWithdrawal(currentUser.accountNumber, amountCents, &newBalanceCents);
+    if (result == POST_VELOCITY_LIMIT) {
+        printf("❌ Withdrawal refused: it would take your account past its spending limit.\n");
+        showVelocityLimits();
         return;
     }
-    
-    Transaction transaction;
-    transaction.transactionId = 0;
-    transaction.accountNumber = currentUser.accountNumber;
-    strcpy(transaction.type, "WITHDRAWAL");
-    transaction.amount = amountCents;
-    transaction.balanceAfter = newBalanceCents;
-    getCurrentTimestamp(transaction.timestamp);
-    strcpy(transaction.description, "Cash withdrawal");
-    
-    if (!recordTransaction(&transaction)) {
-        printf("⚠️  Withdrawal processed but failed to record transaction.\n");
+    if (!postApplied(result)) {
+        printf("❌ Failed to process withdrawal! Please try again.\n");
+        return;
     }
     
     currentUser.balance = newBalanceCents;
     
-    printf("✅ Withdrawal successful!\n");
+    if (result == POST_NOT_DURABLE) {
+        printf("⚠️  Withdrawal applied, but it could not be saved to disk and may be lost if the system stops.\n");
+    } else {
+        printf("✅ Withdrawal successful!\n");
+    }
     printf("New balance: K%.2f\n", centsToFloat(currentUser.balance));
 }
 
@@ -840,38 +9098,25 @@ void transferFunds() {
         return;
     }
     
-    if (!transferFundsWithRollback(currentUser.accountNumber, targetAccountNumber, amountCents)) {
+    long newBalanceCents;
+    PostResult result = postTransfer(currentUser.accountNumber, targetAccountNumber, amountCents, &newBalanceCents);
+    if (result == POST_VELOCITY_LIMIT) {
+        printf("❌ Transfer refused: it would take your account past its spending limits.\n");
+        showVelocityLimits();
+        return;
+    }
+    if (!postApplied(result)) {
         printf("❌ Failed to process transfer! Please try again.\n");
         return;
     }
     
-    Transaction senderTransaction, receiverTransaction;
-    
-    senderTransaction.transactionId = 0;
-    senderTransaction.accountNumber = currentUser.accountNumber;
-    strcpy(senderTransaction.type, "TRANSFER_SENT");
-    senderTransaction.amount = amountCents;
-    senderTransaction.balanceAfter = currentUser.balance - amountCents;
-    getCurrentTimestamp(senderTransaction.timestamp);
-    snprintf(senderTransaction.description, MAX_DESCRIPTION_LENGTH, 
-             "Transfer to account %d (%s)", targetAccountNumber, targetAccount.fullName);
-    
-    receiverTransaction.transactionId = 0;
-    receiverTransaction.accountNumber = targetAccountNumber;
-    strcpy(receiverTransaction.type, "TRANSFER_RECEIVED");
-    receiverTransaction.amount = amountCents;
-    receiverTransaction.balanceAfter = targetAccount.balance + amountCents;
-    getCurrentTimestamp(receiverTransaction.timestamp);
-    snprintf(receiverTransaction.description, MAX_DESCRIPTION_LENGTH, 
-             "Transfer from account %d (%s)", currentUser.accountNumber, currentUser.fullName);
+    currentUser.balance = newBalanceCents;
     
-    if (!recordTransaction(&senderTransaction) || !recordTransaction(&receiverTransaction)) {
-        printf("⚠️  Transfer processed but failed to record some transactions.\n");
+    if (result == POST_NOT_DURABLE) {
+        printf("⚠️  Transfer applied, but it could not be saved to disk and may be lost if the system stops.\n");
+    } else {
+        printf("✅ Transfer successful!\n");
     }
-    
-    currentUser.balance -= amountCents;
-    
-    printf("✅ Transfer successful!\n");
     printf("Transferred: K%.2f to %s\n", amount, targetAccount.fullName);
     printf("Your new balance: K%.2f\n", centsToFloat(currentUser.balance));
 }
@@ -906,27 +9151,39 @@ void changePassword() {
         return;
     }
     
-    if (!updateAccountPassword(currentUser.accountNumber, newPassword)) {
-        printf("❌ Failed to change password! Please try again.\n");
-        return;
+    // The record carries the balance, which another terminal may have
+    // changed since login, so it is read again under the account's lock
+    int accountNumber = currentUser.accountNumber;
+    lockSharedAccounts(accountNumber, accountNumber);
+    BankAccount account;
+    LogRecord transaction;
+    long firstRecord;
+    int changed = findAccountByNumber(accountNumber, &account);
+    if (changed) {
+        fillTransaction(&transaction, accountNumber, TX_PASSWORD_CHANGE, 0,
+                        account.balance, "Password changed successfully");
+        changed = appendTransactions(&transaction, 1, &firstRecord);
     }
+    if (changed && !updateAccountPassword(accountNumber, newPassword)) {
+        rollbackTransactions(firstRecord, 1);
+        changed = 0;
+    }
+    int durable = changed && commitTransactions(&transaction, 1, firstRecord);
+    unlockSharedAccounts(accountNumber, accountNumber);
     
-    Transaction transaction;
-    transaction.transactionId = 0;
-    transaction.accountNumber = currentUser.accountNumber;
-    strcpy(transaction.type, "PASSWORD_CHANGE");
-    transaction.amount = 0;
-    transaction.balanceAfter = currentUser.balance;
-    getCurrentTimestamp(transaction.timestamp);
-    strcpy(transaction.description, "Password changed successfully");
-    
-    if (!recordTransaction(&transaction)) {
-        printf("⚠️  Password changed but failed to record transaction.\n");
+    if (!changed) {
+        printf("❌ Failed to change password! Please try again.\n");
+        return;
     }
     
     findAccountByNumber(currentUser.accountNumber, &currentUser);
     
-    printf("✅ Password changed successfully!\n");
+    if (!durable) {
+        printf("⚠️  Password changed, but the change could not be saved to disk and may be lost if the\n");
+        printf("   system stops. Use the new password; if it is refused, use the old one.\n");
+    } else {
+        printf("✅ Password changed successfully!\n");
+    }
 }
 
 void displayAccountDetails() {
@@ -942,16 +9199,42 @@ void displayAccountDetails() {
     strftime(dateStr, sizeof(dateStr), "%Y-%m-%d", tm_info);
     printf("Date Created: %s\n", dateStr);
     
+    time_t now = time(NULL);
+    struct tm t;
+    localtime_r(&now, &t);
+    MonthRollup monthly;
+    if (readMonthRollup(currentUser.accountNumber, (t.tm_year + 1900) * 100 + t.tm_mon + 1, &monthly) > 0) {
+        printf("This Month: K%.2f in, K%.2f out\n", monthly.moneyIn / 100.0, monthly.moneyOut / 100.0);
+    }
+    
     printf("============================================\n");
 }
 
 void viewTransactionHistory() {
     printHeader("TRANSACTION HISTORY");
     
-    Transaction *transactions = NULL;
-    int count = 0;
+    int64_t from, to;
+    char period[80];
+    int ranged = readPeriod(&from, &to, period, sizeof(period));
+    if (ranged < 0) return;
+    if (ranged) {
+        RangeCursor range;
+        if (!openRangeCursor(&range, currentUser.accountNumber, from, to, HISTORY_PAGE_SIZE)) {
+            printf("❌ Failed to load transaction history!\n");
+            return;
+        }
+        printf("Account: %s (%d)\n", currentUser.fullName, currentUser.accountNumber);
+        printf("Period: %s\n", period);
+        printf("============================================\n");
+        showRangeResults(&range);
+        printf("============================================\n");
+        closeRangeCursor(&range);
+        return;
+    }
+    
+    HistoryCursor cursor;
     
-    if (!getAccountTransactions(currentUser.accountNumber, &transactions, &count)) {
+    if (!openHistoryCursor(&cursor, currentUser.accountNumber, 0, 1, HISTORY_PAGE_SIZE)) {
         printf("❌ Failed to load transaction history!\n");
         return;
     }
@@ -960,27 +9243,36 @@ void viewTransactionHistory() {
     printf("Current Balance: K%.2f\n", centsToFloat(currentUser.balance));
     printf("============================================\n");
     
+    // Newest first, one screen at a time
+    int count = nextHistoryBatch(&cursor);
     if (count == 0) {
         printf("No transactions found for this account.\n");
-    } else {
-        printf("Date       | Type            | Amount    | Balance   | Description\n");
-        printf("-----------+-----------------+-----------+-----------+----------------\n");
-        
+    } else if (count > 0) {
+        printf("ID       | Date       | Type            | Amount    | Balance   | Description\n");
+        printf("---------+-----------+-----------------+-----------+-----------+----------------\n");
+    }
+    
+    while (count > 0) {
         for (int i = 0; i < count; i++) {
-            printf("%s | %-15s | K%8.2f | K%8.2f | %s\n",
-                   transactions[i].timestamp,
-                   transactions[i].type,
-                   centsToFloat(transactions[i].amount),
-                   centsToFloat(transactions[i].balanceAfter),
-                   transactions[i].description);
+            printf("%-8d | %s | %-15s | K%8.2f | K%8.2f | %s\n",
+                   cursor.page[i].transactionId,
+                   cursor.page[i].timestamp,
+                   cursor.page[i].type,
+                   centsToFloat(cursor.page[i].amount),
+                   centsToFloat(cursor.page[i].balanceAfter),
+                   cursor.page[i].description);
         }
+        if (cursor.nextRecord < 0) break;
+        
+        char answer[8];
+        safeInputString(answer, sizeof(answer), "-- Press Enter for older transactions, or q to stop: ");
+        if (tolower((unsigned char)answer[0]) == 'q') break;
+        count = nextHistoryBatch(&cursor);
     }
+    if (count < 0) printf("❌ Failed to load the rest of the transaction history!\n");
     
     printf("============================================\n");
-    
-    if (transactions != NULL) {
-        freeTransactions(transactions);
-    }
+    closeHistoryCursor(&cursor);
 }
 
 void closeCurrentAccount() {
@@ -1013,22 +9305,17 @@ void closeCurrentAccount() {
         return;
     }
     
-    if (!closeAccount(currentUser.accountNumber)) {
+    PostResult result = postCloseAccount(currentUser.accountNumber);
+    if (!postApplied(result)) {
         printf("❌ Failed to close account! Please try again.\n");
         return;
     }
     
-    Transaction transaction;
-    transaction.transactionId = 0;
-    transaction.accountNumber = currentUser.accountNumber;
-    strcpy(transaction.type, "ACCOUNT_CLOSURE");
-    transaction.amount = 0;
-    transaction.balanceAfter = 0;
-    getCurrentTimestamp(transaction.timestamp);
-    strcpy(transaction.description, "Account closed permanently");
-    recordTransaction(&transaction);
-    
-    printf("✅ Account closed successfully!\n");
+    if (result == POST_NOT_DURABLE) {
+        printf("⚠️  Account closed, but the closure could not be saved to disk and may be lost if the system stops.\n");
+    } else {
+        printf("✅ Account closed successfully!\n");
+    }
     isLoggedIn = 0;
 }
 
@@ -1046,6 +9333,7 @@ void printHeader(const char *title) {
 
 void getCurrentTimestamp(char* buffer) {
     time_t now = time(NULL);
-    struct tm *t = localtime(&now);
-    strftime(buffer, 20, "%Y-%m-%d %H:%M", t);
+    struct tm t;
+    localtime_r(&now, &t);
+    strftime(buffer, 20, "%Y-%m-%d %H:%M", &t);
 }